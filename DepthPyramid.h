@@ -0,0 +1,61 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+
+// Threads per side of a workgroup in Shaders/hiz_reduce.comp (local_size_x/y)
+const uint32_t HIZ_REDUCE_GROUP_SIZE = 8;
+
+// Hierarchical Z pyramid of the depth buffer, for occlusion culling. Level 0 is half the depth buffer's size
+// (rounded up), each level after half the one before, down to 1 x 1. Every texel holds the furthest depth of the
+// texels it covers in the level above, so anything nearer than that somewhere in a rectangle may be visible.
+// Built by a compute pass (one dispatch per level) and left in GENERAL layout, to be sampled by the next culling pass.
+class DepthPyramid
+{
+public:
+	DepthPyramid();
+
+	void create(DeviceAllocator * newAllocator, VkDevice newDevice, VkImageView depthImageView, VkExtent2D depthExtent);
+
+	void recordBuild(VkCommandBuffer commandBuffer);
+	bool isBuilt();
+
+	VkImageView getImageView();
+	VkSampler getSampler();
+
+	void destroy();
+
+	~DepthPyramid();
+
+private:
+	// Push constant of hiz_reduce.comp
+	struct HiZReducePush {
+		glm::uvec2 sourceSize;
+		glm::uvec2 destinationSize;
+	};
+
+	DeviceAllocator * allocator = nullptr;
+	VkDevice device = VK_NULL_HANDLE;
+
+	VkExtent2D depthExtent = {};
+	std::vector<VkExtent2D> levelExtents;
+	bool built = false;					// A build has been recorded (and so runs before anything recorded after it)
+
+	VkImage image = VK_NULL_HANDLE;
+	DeviceAllocation imageMemory;
+	VkImageView imageView = VK_NULL_HANDLE;			// Every level, for culling
+	std::vector<VkImageView> levelViews;			// One level each, for building
+	VkSampler sampler = VK_NULL_HANDLE;				// Nearest, clamped (reads are all texelFetch)
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> levelSets;			// Level's source (depth buffer or level above) and destination
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+
+	VkImageView createLevelView(uint32_t baseLevel, uint32_t levelCount);
+};
@@ -0,0 +1,351 @@
+#include "DeviceAllocator.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+
+#include "Utilities.h"
+
+DeviceAllocator::DeviceAllocator()
+{
+}
+
+void DeviceAllocator::create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkDeviceSize newBlockSize)
+{
+	physicalDevice = newPhysicalDevice;
+	device = newDevice;
+	blockSize = newBlockSize;
+
+	// Memory types and heaps don't change, so query them once
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	// Find largest DEVICE_LOCAL heap, and a heap that is both DEVICE_LOCAL and HOST_VISIBLE
+	VkDeviceSize largestDeviceLocalHeap = 0;
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+	{
+		if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			largestDeviceLocalHeap = std::max(largestDeviceLocalHeap, memoryProperties.memoryHeaps[i].size);
+		}
+	}
+
+	VkMemoryPropertyFlags directUploadProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		uint32_t heapIndex = memoryProperties.memoryTypes[i].heapIndex;
+
+		// Only worth using if it covers the whole of VRAM (unified memory or resizable BAR), not just a small window
+		if ((memoryProperties.memoryTypes[i].propertyFlags & directUploadProperties) == directUploadProperties
+			&& memoryProperties.memoryHeaps[heapIndex].size >= largestDeviceLocalHeap)
+		{
+			directUploadTypeIndex = static_cast<int>(i);
+			directUploadHeapIndex = static_cast<int>(heapIndex);
+			break;
+		}
+	}
+}
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements & memRequirements, VkMemoryPropertyFlags properties, bool linearResource)
+{
+	return allocateFromType(memRequirements, findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits, properties), linearResource);
+}
+
+DeviceAllocation DeviceAllocator::allocateFromType(const VkMemoryRequirements & memRequirements, uint32_t memoryTypeIndex, bool linearResource)
+{
+	DeviceAllocation allocation = {};
+	allocation.memoryTypeIndex = memoryTypeIndex;
+	allocation.linear = linearResource;
+	allocation.size = memRequirements.size;
+
+	// Resources bigger than half a block get their own memory, otherwise they would waste most of a block
+	if (memRequirements.size > blockSize / 2)
+	{
+		allocation.memory = allocateDeviceMemory(memRequirements.size, allocation.memoryTypeIndex, &allocation.mapped);
+		allocation.offset = 0;
+		allocation.blockIndex = -1;
+		return allocation;
+	}
+
+	VkDeviceSize alignment = std::max<VkDeviceSize>(memRequirements.alignment, 1);
+	MemoryPool &pool = pools[allocation.memoryTypeIndex][linearResource ? 1 : 0];
+
+	// Try every existing block first (best fit inside each block)
+	for (size_t i = 0; i < pool.blocks.size(); i++)
+	{
+		MemoryBlock &block = pool.blocks[i];
+		if (block.memory == VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
+		if (allocateFromBlock(block, memRequirements.size, alignment, &allocation.offset, &allocation.size))
+		{
+			allocation.memory = block.memory;
+			allocation.blockIndex = static_cast<int>(i);
+			allocation.mapped = block.mapped ? static_cast<char *>(block.mapped) + allocation.offset : nullptr;
+			return allocation;
+		}
+	}
+
+	// No room in any block, so create a new one and allocate from it
+	int blockIndex = createBlock(pool, allocation.memoryTypeIndex, memRequirements.size + alignment);
+	MemoryBlock &block = pool.blocks[blockIndex];
+	if (!allocateFromBlock(block, memRequirements.size, alignment, &allocation.offset, &allocation.size))
+	{
+		throw std::runtime_error("Failed to sub-allocate from a new Device Memory block!");
+	}
+
+	allocation.memory = block.memory;
+	allocation.blockIndex = blockIndex;
+	allocation.mapped = block.mapped ? static_cast<char *>(block.mapped) + allocation.offset : nullptr;
+
+	return allocation;
+}
+
+void DeviceAllocator::free(DeviceAllocation & allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	// Dedicated allocations own their memory outright
+	if (allocation.blockIndex < 0)
+	{
+		freeDeviceMemory(allocation.memory, allocation.memoryTypeIndex, allocation.size);
+		allocation = DeviceAllocation();
+		return;
+	}
+
+	MemoryPool &pool = pools[allocation.memoryTypeIndex][allocation.linear ? 1 : 0];
+	MemoryBlock &block = pool.blocks[allocation.blockIndex];
+
+	// Return region to block (merges with any free neighbours)
+	insertFreeRegion(block, allocation.offset, allocation.size);
+	block.usedSize -= allocation.size;
+
+	// Release empty blocks, but always keep one block per pool alive to avoid allocation churn
+	if (block.usedSize == 0)
+	{
+		size_t liveBlocks = 0;
+		for (const auto &poolBlock : pool.blocks)
+		{
+			if (poolBlock.memory != VK_NULL_HANDLE)
+			{
+				liveBlocks++;
+			}
+		}
+
+		if (liveBlocks > 1)
+		{
+			freeDeviceMemory(block.memory, allocation.memoryTypeIndex, block.size);
+			block = MemoryBlock();		// Slot stays in vector so other block indices remain valid
+		}
+	}
+
+	allocation = DeviceAllocation();
+}
+
+bool DeviceAllocator::allocateDirectUpload(const VkMemoryRequirements & memRequirements, bool linearResource, DeviceAllocation * allocation)
+{
+	// Resource has to be allowed in the direct upload memory type (otherwise the caller stages instead)
+	if (directUploadTypeIndex < 0 || (memRequirements.memoryTypeBits & (1u << directUploadTypeIndex)) == 0)
+	{
+		return false;
+	}
+
+	// Leave some of the heap for resources that must live there (render targets, textures), staging is used past that
+	const VkMemoryHeap &heap = memoryProperties.memoryHeaps[directUploadHeapIndex];
+	if (heapUsage[directUploadHeapIndex] + std::max(memRequirements.size, blockSize) > heap.size / 4 * 3)
+	{
+		return false;
+	}
+
+	// Exactly that memory type, so its heap is the one budgeted above (allocation may still fail, caller then stages instead)
+	try {
+		*allocation = allocateFromType(memRequirements, static_cast<uint32_t>(directUploadTypeIndex), linearResource);
+	}
+	catch (const std::runtime_error &) {
+		return false;
+	}
+
+	return true;
+}
+
+uint32_t DeviceAllocator::getMemoryAllocationCount()
+{
+	return memoryAllocationCount;
+}
+
+bool DeviceAllocator::hasDirectUploadMemory()
+{
+	return directUploadTypeIndex >= 0;
+}
+
+void DeviceAllocator::destroy()
+{
+	for (auto &memoryTypePools : pools)
+	{
+		for (auto &pool : memoryTypePools)
+		{
+			for (auto &block : pool.blocks)
+			{
+				if (block.memory != VK_NULL_HANDLE)
+				{
+					vkFreeMemory(device, block.memory, nullptr);
+				}
+			}
+			pool.blocks.clear();
+		}
+	}
+
+	memoryAllocationCount = 0;
+	std::fill(std::begin(heapUsage), std::end(heapUsage), 0);
+}
+
+DeviceAllocator::~DeviceAllocator()
+{
+}
+
+VkDeviceMemory DeviceAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void ** mapped)
+{
+	VkMemoryAllocateInfo memoryAllocInfo = {};
+	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocInfo.allocationSize = size;
+	memoryAllocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkDeviceMemory memory;
+	VkResult result = vkAllocateMemory(device, &memoryAllocInfo, nullptr, &memory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate Device Memory!");
+	}
+	memoryAllocationCount++;
+	heapUsage[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex] += size;
+
+	// Host visible memory is mapped once for its whole lifetime, as a block can only be mapped once at a time
+	*mapped = nullptr;
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		result = vkMapMemory(device, memory, 0, size, 0, mapped);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to map Device Memory!");
+		}
+	}
+
+	return memory;
+}
+
+void DeviceAllocator::freeDeviceMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size)
+{
+	vkFreeMemory(device, memory, nullptr);
+	memoryAllocationCount--;
+	heapUsage[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex] -= size;
+}
+
+int DeviceAllocator::createBlock(MemoryPool & pool, uint32_t memoryTypeIndex, VkDeviceSize minSize)
+{
+	// Don't let a single block take up too much of a small heap (e.g. 256MB BAR heaps), but always fit the request
+	VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+	VkDeviceSize newBlockSize = std::min(blockSize, std::max<VkDeviceSize>(heapSize / 8, blockSize / 8));
+	newBlockSize = std::max(newBlockSize, minSize);
+
+	MemoryBlock newBlock;
+	newBlock.memory = allocateDeviceMemory(newBlockSize, memoryTypeIndex, &newBlock.mapped);
+	newBlock.size = newBlockSize;
+	insertFreeRegion(newBlock, 0, newBlockSize);
+
+	// Re-use a released slot if there is one
+	for (size_t i = 0; i < pool.blocks.size(); i++)
+	{
+		if (pool.blocks[i].memory == VK_NULL_HANDLE)
+		{
+			pool.blocks[i] = newBlock;
+			return static_cast<int>(i);
+		}
+	}
+
+	pool.blocks.push_back(newBlock);
+	return static_cast<int>(pool.blocks.size()) - 1;
+}
+
+bool DeviceAllocator::allocateFromBlock(MemoryBlock & block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * offset, VkDeviceSize * reservedSize)
+{
+	// Smallest free region that is big enough comes first, so the first that fits after alignment is the best fit
+	for (auto it = block.freeBySize.lower_bound(size); it != block.freeBySize.end(); ++it)
+	{
+		VkDeviceSize regionSize = it->first;
+		VkDeviceSize regionOffset = it->second;
+
+		VkDeviceSize alignedOffset = (regionOffset + alignment - 1) / alignment * alignment;
+		VkDeviceSize padding = alignedOffset - regionOffset;
+		if (padding + size > regionSize)
+		{
+			continue;
+		}
+
+		// Take the region, then hand back the unused space before and after the allocation
+		eraseFreeRegion(block, regionOffset, regionSize);
+		if (padding > 0)
+		{
+			insertFreeRegion(block, regionOffset, padding);
+		}
+		if (padding + size < regionSize)
+		{
+			insertFreeRegion(block, alignedOffset + size, regionSize - padding - size);
+		}
+
+		block.usedSize += size;
+		*offset = alignedOffset;
+		*reservedSize = size;
+		return true;
+	}
+
+	return false;
+}
+
+void DeviceAllocator::insertFreeRegion(MemoryBlock & block, VkDeviceSize offset, VkDeviceSize size)
+{
+	// Merge with following free region
+	auto next = block.freeByOffset.lower_bound(offset);
+	if (next != block.freeByOffset.end() && offset + size == next->first)
+	{
+		VkDeviceSize nextSize = next->second;
+		eraseFreeRegion(block, next->first, nextSize);
+		size += nextSize;
+	}
+
+	// Merge with preceding free region
+	auto prev = block.freeByOffset.lower_bound(offset);
+	if (prev != block.freeByOffset.begin())
+	{
+		--prev;
+		if (prev->first + prev->second == offset)
+		{
+			VkDeviceSize prevOffset = prev->first;
+			VkDeviceSize prevSize = prev->second;
+			eraseFreeRegion(block, prevOffset, prevSize);
+			offset = prevOffset;
+			size += prevSize;
+		}
+	}
+
+	block.freeByOffset[offset] = size;
+	block.freeBySize.insert(std::make_pair(size, offset));
+}
+
+void DeviceAllocator::eraseFreeRegion(MemoryBlock & block, VkDeviceSize offset, VkDeviceSize size)
+{
+	block.freeByOffset.erase(offset);
+
+	auto range = block.freeBySize.equal_range(size);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second == offset)
+		{
+			block.freeBySize.erase(it);
+			break;
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <map>
+
+// Default size of each VkDeviceMemory block the allocator carves sub-allocations from
+const VkDeviceSize DEVICE_ALLOCATOR_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// A region of device memory handed out by the DeviceAllocator
+struct DeviceAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;		// Memory block the allocation lives in
+	VkDeviceSize offset = 0;					// Offset of the allocation inside the memory block (bind at this offset)
+	VkDeviceSize size = 0;						// Size requested for the allocation (alignment padding goes back to the free list)
+	void * mapped = nullptr;					// Host pointer to start of allocation (only for HOST_VISIBLE memory)
+	uint32_t memoryTypeIndex = 0;				// Memory type the block was allocated from
+	int blockIndex = -1;						// Index of block in its pool (-1 = dedicated allocation)
+	bool linear = true;							// Buffer / linear image (true) or optimal tiled image (false)
+};
+
+// Pooled allocator that sub-allocates buffers and images out of large VkDeviceMemory blocks.
+// One pool exists per memory type and per resource kind (linear or optimal), so linear and optimal
+// resources never share a block and bufferImageGranularity can never be violated between neighbours.
+class DeviceAllocator
+{
+public:
+	DeviceAllocator();
+
+	void create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkDeviceSize newBlockSize = DEVICE_ALLOCATOR_BLOCK_SIZE);
+
+	DeviceAllocation allocate(const VkMemoryRequirements &memRequirements, VkMemoryPropertyFlags properties, bool linearResource);
+	bool allocateDirectUpload(const VkMemoryRequirements &memRequirements, bool linearResource, DeviceAllocation * allocation);
+	void free(DeviceAllocation &allocation);
+
+	uint32_t getMemoryAllocationCount();
+	bool hasDirectUploadMemory();
+
+	void destroy();
+
+	~DeviceAllocator();
+
+private:
+	// Single VkDeviceMemory block and its free space
+	struct MemoryBlock {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		VkDeviceSize usedSize = 0;
+		void * mapped = nullptr;
+		std::map<VkDeviceSize, VkDeviceSize> freeByOffset;			// Free regions (offset -> size), kept coalesced
+		std::multimap<VkDeviceSize, VkDeviceSize> freeBySize;		// Same free regions (size -> offset), for best fit search
+	};
+
+	// All blocks of one memory type for one resource kind
+	struct MemoryPool {
+		std::vector<MemoryBlock> blocks;
+	};
+
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	VkDeviceSize blockSize;
+
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+
+	MemoryPool pools[VK_MAX_MEMORY_TYPES][2];		// [memory type][0 = optimal, 1 = linear]
+	uint32_t memoryAllocationCount = 0;
+	VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS] = {};	// Bytes of VkDeviceMemory allocated from each heap
+
+	// DEVICE_LOCAL | HOST_VISIBLE memory type on a heap that is big enough to hold resources written straight from
+	// the CPU (unified memory, resizable BAR), or -1 if there is none (e.g. only the small 256MB BAR window)
+	int directUploadTypeIndex = -1;
+	int directUploadHeapIndex = -1;					// Heap of that memory type
+
+	DeviceAllocation allocateFromType(const VkMemoryRequirements &memRequirements, uint32_t memoryTypeIndex, bool linearResource);
+	VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void ** mapped);
+	void freeDeviceMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size);
+	int createBlock(MemoryPool &pool, uint32_t memoryTypeIndex, VkDeviceSize minSize);
+	bool allocateFromBlock(MemoryBlock &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * offset, VkDeviceSize * reservedSize);
+	void insertFreeRegion(MemoryBlock &block, VkDeviceSize offset, VkDeviceSize size);
+	void eraseFreeRegion(MemoryBlock &block, VkDeviceSize offset, VkDeviceSize size);
+};
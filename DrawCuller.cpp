@@ -0,0 +1,526 @@
+#include "DrawCuller.h"
+
+#include <stdexcept>
+#include <array>
+#include <algorithm>
+
+#include "Mesh.h"
+
+DrawCuller::DrawCuller()
+{
+}
+
+void DrawCuller::create(DeviceAllocator * newAllocator, VkDevice newDevice, uint32_t imageCount,
+	PFN_vkCmdDrawIndexedIndirectCountKHR newDrawIndexedIndirectCount, bool newOcclusionCulling)
+{
+	allocator = newAllocator;
+	device = newDevice;
+	drawIndexedIndirectCount = newDrawIndexedIndirectCount;
+	occlusionCulling = newOcclusionCulling;
+
+	// DESCRIPTOR SET LAYOUT
+	// 0: draws (also read by the vertex shader), 1: LODs, 2: draw commands, 3: batch draw counts
+	// Occlusion culling adds 4: occlusion candidates and counts, 5: depth pyramid
+	std::vector<VkDescriptorSetLayoutBinding> bindings(occlusionCulling ? 6 : 4);
+	uint32_t storageBufferCount = occlusionCulling ? 5 : 4;
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = i < storageBufferCount ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = i == 0 ? VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &setLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Descriptor Set Layout!");
+	}
+
+	// DESCRIPTOR POOL
+	// A set per swapchain image
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = imageCount * storageBufferCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = imageCount;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = imageCount;
+	poolCreateInfo.poolSizeCount = occlusionCulling ? 2 : 1;
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Descriptor Pool!");
+	}
+
+	// PIPELINE
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DrawCullPush);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &setLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Pipeline Layout!");
+	}
+
+	// Same shader, compiled with OCCLUSION_CULLING for the phases and the Hi-Z test
+	std::vector<char> shaderCode = readFile(occlusionCulling ? "Shaders/draw_cull_occlusion.spv" : "Shaders/draw_cull.spv");
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = shaderCode.size();
+	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t *>(shaderCode.data());
+
+	VkShaderModule shaderModule;
+	result = vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+
+	// Module is no longer needed once the pipeline has been made
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Compute Pipeline!");
+	}
+
+	// BUFFERS
+	// Each image's buffers start at their minimum size, so its set is valid before there is anything to draw
+	imageBuffers.resize(imageCount);
+	std::vector<VkDescriptorSetLayout> setLayouts(imageCount, setLayout);
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = descriptorPool;
+	setAllocInfo.descriptorSetCount = imageCount;
+	setAllocInfo.pSetLayouts = setLayouts.data();
+
+	std::vector<VkDescriptorSet> sets(imageCount);
+	result = vkAllocateDescriptorSets(device, &setAllocInfo, sets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate Descriptor Sets!");
+	}
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		imageBuffers[i].descriptorSet = sets[i];
+		imageBuffers[i].version = 0;
+		updateImageBuffers(i);
+	}
+}
+
+VkDescriptorSetLayout DrawCuller::getSetLayout()
+{
+	return setLayout;
+}
+
+void DrawCuller::setDepthPyramid(DepthPyramid * newDepthPyramid)
+{
+	depthPyramid = newDepthPyramid;
+
+	// Pyramid lives as long as the culler, so every image's set can point at it now
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.sampler = depthPyramid->getSampler();
+	imageInfo.imageView = depthPyramid->getImageView();
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	for (auto &buffers : imageBuffers)
+	{
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = buffers.descriptorSet;
+		write.dstBinding = 5;
+		write.dstArrayElement = 0;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.descriptorCount = 1;
+		write.pImageInfo = &imageInfo;
+
+		vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	}
+}
+
+void DrawCuller::setDraws(const std::vector<IndirectDraw> & newDraws, const std::vector<IndirectLod> & newLods, const std::vector<IndirectBatch> & newBatches)
+{
+	// Copied to each image's buffers when it is next recorded
+	draws = newDraws;
+	lods = newLods;
+	batches = newBatches;
+	version++;
+}
+
+const IndirectDraw & DrawCuller::getDraw(uint32_t drawIndex)
+{
+	return draws[drawIndex];
+}
+
+void DrawCuller::updateDraw(uint32_t drawIndex, const IndirectDraw & draw)
+{
+	draws[drawIndex] = draw;
+
+	// Copied to each image's buffer when it is next recorded (images still on an older version copy everything anyway)
+	for (auto &buffers : imageBuffers)
+	{
+		if (buffers.version == version && !buffers.drawDirty[drawIndex])
+		{
+			buffers.drawDirty[drawIndex] = 1;
+			buffers.dirtyDraws.push_back(drawIndex);
+		}
+	}
+}
+
+void DrawCuller::recordCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex, const glm::mat4 & viewProjection, glm::vec3 cameraPos, float pixelsPerUnit)
+{
+	ImageBuffers &buffers = imageBuffers[imageIndex];
+
+	// Image's last frame has finished, so its counts say how many of its draws were drawn
+	visibleCount = 0;
+	const uint32_t * counts = static_cast<const uint32_t *>(buffers.countBufferMemory.mapped);
+	for (uint32_t i = 0; i < buffers.countCapacity; i++)
+	{
+		visibleCount += counts[i];
+	}
+	visibleCount = std::min(visibleCount, buffers.culledDrawCount);
+	occludedCount = 0;
+	if (occlusionCulling)
+	{
+		const OcclusionHeader * header = static_cast<const OcclusionHeader *>(buffers.occlusionBufferMemory.mapped);
+		occludedCount = std::min(header->occludedCount, buffers.culledDrawCount - visibleCount);
+	}
+	culledCount = buffers.culledDrawCount - visibleCount - occludedCount;
+
+	updateImageBuffers(imageIndex);
+	buffers.culledDrawCount = static_cast<uint32_t>(draws.size());
+	if (draws.empty())
+	{
+		return;
+	}
+
+	// Last time this image's command buffer ran, the commands and counts were written and then drawn from
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	// Start every batch empty (without a count to draw with, every slot is drawn, so unused ones need no instances)
+	vkCmdFillBuffer(commandBuffer, buffers.countBuffer, 0, VK_WHOLE_SIZE, 0);
+	if (drawIndexedIndirectCount == nullptr)
+	{
+		vkCmdFillBuffer(commandBuffer, buffers.commandBuffer, 0, VK_WHOLE_SIZE, 0);
+	}
+	if (occlusionCulling)
+	{
+		vkCmdFillBuffer(commandBuffer, buffers.occlusionBuffer, 0, sizeof(OcclusionHeader), 0);
+	}
+
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	// A thread per draw (in rows of workgroups, as dispatches are limited in each dimension)
+	push = {};
+	push.viewProjection = viewProjection;
+	push.camera = glm::vec4(cameraPos, pixelsPerUnit);
+	push.drawCount = static_cast<uint32_t>(draws.size());
+	uint32_t groupCount = (push.drawCount + DRAW_CULL_GROUP_SIZE - 1) / DRAW_CULL_GROUP_SIZE;
+	push.groupsPerRow = std::min(groupCount, MAX_DISPATCH_GROUPS);
+	push.lodErrorPixels = LOD_ERROR_PIXELS;
+	push.batchCount = static_cast<uint32_t>(batches.size());
+	push.phase = 0;
+	push.pyramidBuilt = depthPyramid != nullptr && depthPyramid->isBuilt() ? 1 : 0;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &buffers.descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+	vkCmdDispatch(commandBuffer, push.groupsPerRow, (groupCount + push.groupsPerRow - 1) / push.groupsPerRow, 1);
+
+	// Commands and counts are read by the draws (and the counts by the CPU, once the frame is done),
+	// the candidates and counts by the second phase
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT;
+	if (occlusionCulling)
+	{
+		memoryBarrier.dstAccessMask |= VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		dstStages |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	}
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStages, 0,
+		1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void DrawCuller::recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	ImageBuffers &buffers = imageBuffers[imageIndex];
+	if (draws.empty())
+	{
+		return;
+	}
+
+	// Any number of draws could be candidates, threads past the candidate count stop straight away
+	push.phase = 1;
+	uint32_t groupCount = (push.drawCount + DRAW_CULL_GROUP_SIZE - 1) / DRAW_CULL_GROUP_SIZE;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &buffers.descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+	vkCmdDispatch(commandBuffer, push.groupsPerRow, (groupCount + push.groupsPerRow - 1) / push.groupsPerRow, 1);
+
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+		1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void DrawCuller::recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkPipelineLayout pipelineLayout, uint32_t setIndex, uint32_t phase)
+{
+	ImageBuffers &buffers = imageBuffers[imageIndex];
+	if (draws.empty())
+	{
+		return;
+	}
+
+	// Vertex shader reads each draw's transform and texture from the draw buffer
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, setIndex, 1, &buffers.descriptorSet, 0, nullptr);
+
+	for (uint32_t i = 0; i < batches.size(); i++)
+	{
+		const IndirectBatch &batch = batches[i];
+
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &batch.vertexBuffer, &offset);
+		vkCmdBindIndexBuffer(commandBuffer, batch.indexBuffer, 0, batch.indexType);
+
+		// Second phase's commands and counts follow the first's
+		VkDeviceSize commandOffset = sizeof(VkDrawIndexedIndirectCommand) * (phase * draws.size() + batch.firstCommand);
+		VkDeviceSize countOffset = sizeof(uint32_t) * (phase * batches.size() + i);
+		if (drawIndexedIndirectCount != nullptr)
+		{
+			drawIndexedIndirectCount(commandBuffer, buffers.commandBuffer, commandOffset, buffers.countBuffer, countOffset,
+				batch.drawCount, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, buffers.commandBuffer, commandOffset, batch.drawCount, sizeof(VkDrawIndexedIndirectCommand));
+		}
+	}
+}
+
+uint32_t DrawCuller::getDrawCount()
+{
+	return static_cast<uint32_t>(draws.size());
+}
+
+uint32_t DrawCuller::getVisibleCount()
+{
+	// Of the last frame drawn by the image being recorded (the GPU's counts aren't known until its frame is done)
+	return visibleCount;
+}
+
+uint32_t DrawCuller::getCulledCount()
+{
+	// Outside the frustum (occluded draws are counted separately)
+	return culledCount;
+}
+
+uint32_t DrawCuller::getOccludedCount()
+{
+	return occludedCount;
+}
+
+void DrawCuller::destroy()
+{
+	if (device == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	for (auto &buffers : imageBuffers)
+	{
+		vkDestroyBuffer(device, buffers.drawBuffer, nullptr);
+		allocator->free(buffers.drawBufferMemory);
+		vkDestroyBuffer(device, buffers.lodBuffer, nullptr);
+		allocator->free(buffers.lodBufferMemory);
+		vkDestroyBuffer(device, buffers.commandBuffer, nullptr);
+		allocator->free(buffers.commandBufferMemory);
+		vkDestroyBuffer(device, buffers.countBuffer, nullptr);
+		allocator->free(buffers.countBufferMemory);
+		if (buffers.occlusionBuffer != VK_NULL_HANDLE)
+		{
+			vkDestroyBuffer(device, buffers.occlusionBuffer, nullptr);
+			allocator->free(buffers.occlusionBufferMemory);
+		}
+	}
+	imageBuffers.clear();
+
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+	device = VK_NULL_HANDLE;
+}
+
+DrawCuller::~DrawCuller()
+{
+}
+
+void DrawCuller::updateImageBuffers(uint32_t imageIndex)
+{
+	ImageBuffers &buffers = imageBuffers[imageIndex];
+	if (buffers.version == version)
+	{
+		// Same draws, so just the records updated since
+		IndirectDraw * mappedDraws = static_cast<IndirectDraw *>(buffers.drawBufferMemory.mapped);
+		for (uint32_t drawIndex : buffers.dirtyDraws)
+		{
+			mappedDraws[drawIndex] = draws[drawIndex];
+			buffers.drawDirty[drawIndex] = 0;
+		}
+		buffers.dirtyDraws.clear();
+		return;
+	}
+
+	// Draws and LODs are written by the CPU, commands only by the culling pass, counts by the culling pass and read back.
+	// With occlusion culling each phase has its own commands and counts
+	VkMemoryPropertyFlags hostProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	uint32_t phaseCount = occlusionCulling ? 2 : 1;
+	bool grown = growBuffer(&buffers.drawBuffer, &buffers.drawBufferMemory, &buffers.drawCapacity,
+		std::max(static_cast<uint32_t>(draws.size()), MIN_INDIRECT_DRAWS), sizeof(IndirectDraw),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostProperties);
+	grown = growBuffer(&buffers.lodBuffer, &buffers.lodBufferMemory, &buffers.lodCapacity,
+		std::max(static_cast<uint32_t>(lods.size()), MIN_INDIRECT_LODS), sizeof(IndirectLod),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostProperties) || grown;
+	grown = growBuffer(&buffers.commandBuffer, &buffers.commandBufferMemory, &buffers.commandCapacity,
+		phaseCount * std::max(static_cast<uint32_t>(draws.size()), MIN_INDIRECT_DRAWS), sizeof(VkDrawIndexedIndirectCommand),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) || grown;
+	grown = growBuffer(&buffers.countBuffer, &buffers.countBufferMemory, &buffers.countCapacity,
+		phaseCount * std::max(static_cast<uint32_t>(batches.size()), MIN_INDIRECT_BATCHES), sizeof(uint32_t),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		hostProperties) || grown;
+	if (occlusionCulling)
+	{
+		// Header, then room for every draw to be a candidate
+		uint32_t headerSize = sizeof(OcclusionHeader) / sizeof(uint32_t);
+		grown = growBuffer(&buffers.occlusionBuffer, &buffers.occlusionBufferMemory, &buffers.occlusionCapacity,
+			headerSize + std::max(static_cast<uint32_t>(draws.size()), MIN_INDIRECT_DRAWS), sizeof(uint32_t),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostProperties) || grown;
+	}
+
+	if (grown)
+	{
+		writeDescriptorSet(imageIndex);
+	}
+
+	if (!draws.empty())
+	{
+		memcpy(buffers.drawBufferMemory.mapped, draws.data(), sizeof(IndirectDraw) * draws.size());
+	}
+	if (!lods.empty())
+	{
+		memcpy(buffers.lodBufferMemory.mapped, lods.data(), sizeof(IndirectLod) * lods.size());
+	}
+	buffers.version = version;
+	buffers.dirtyDraws.clear();
+	buffers.drawDirty.assign(draws.size(), 0);
+}
+
+bool DrawCuller::growBuffer(VkBuffer * buffer, DeviceAllocation * memory, uint32_t * capacity, uint32_t required, VkDeviceSize elementSize,
+	VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+{
+	if (required <= *capacity)
+	{
+		return false;
+	}
+
+	// Replaces the image's old buffer (its last frame has finished with it)
+	if (*buffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(device, *buffer, nullptr);
+		allocator->free(*memory);
+	}
+
+	uint32_t newCapacity = std::max(*capacity, 1u);
+	while (newCapacity < required)
+	{
+		newCapacity *= 2;
+	}
+
+	// Host visible buffers go in device local memory too where there is memory for it
+	VkDeviceSize bufferSize = elementSize * newCapacity;
+	if (!(properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) || !createDirectUploadBuffer(allocator, device, bufferSize, usage, buffer, memory))
+	{
+		createBuffer(allocator, device, bufferSize, usage, properties, buffer, memory);
+	}
+
+	// Nothing counted yet
+	if (memory->mapped != nullptr)
+	{
+		memset(memory->mapped, 0, static_cast<size_t>(bufferSize));
+	}
+
+	*capacity = newCapacity;
+	return true;
+}
+
+void DrawCuller::writeDescriptorSet(uint32_t imageIndex)
+{
+	ImageBuffers &buffers = imageBuffers[imageIndex];
+
+	std::array<VkDescriptorBufferInfo, 5> bufferInfos = {};
+	bufferInfos[0] = { buffers.drawBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[1] = { buffers.lodBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[2] = { buffers.commandBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[3] = { buffers.countBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[4] = { buffers.occlusionBuffer, 0, VK_WHOLE_SIZE };
+
+	// (the depth pyramid's binding is written once, by setDepthPyramid)
+	std::vector<VkWriteDescriptorSet> writes(occlusionCulling ? 5 : 4);
+	for (uint32_t i = 0; i < writes.size(); i++)
+	{
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = buffers.descriptorSet;
+		writes[i].dstBinding = i;
+		writes[i].dstArrayElement = 0;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].descriptorCount = 1;
+		writes[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+#include "DepthPyramid.h"
+
+// Threads per draw in Shaders/draw_cull.comp (local_size_x)
+const uint32_t DRAW_CULL_GROUP_SIZE = 64;
+
+// Starting sizes of each swapchain image's culling buffers (doubled whenever they run out)
+const uint32_t MIN_INDIRECT_DRAWS = 256;
+const uint32_t MIN_INDIRECT_LODS = 64;
+const uint32_t MIN_INDIRECT_BATCHES = 64;
+
+// One instance of one mesh (layout matches Shaders/draw_cull.comp and Shaders/shader_indirect.vert)
+struct IndirectDraw {
+	glm::mat4 model;			// Instance, mesh's node and position dequantisation in one
+	glm::vec4 texTransform;		// UV dequantisation (xy = offset, zw = scale)
+	glm::vec4 sphere;			// World space bounding sphere (xyz = centre, w = radius)
+	uint32_t lodOffset;			// LODs of the mesh in the LOD table
+	uint32_t lodCount;
+	uint32_t batch;				// Batch the draw is drawn by
+	uint32_t textureId;			// Bindless texture
+	float lodScale;				// Largest axis scale of the mesh's world transform (LOD errors are in mesh space)
+	uint32_t firstCommand;		// Batch's first command (visible draws of the batch are packed from here)
+	uint32_t padding[2];
+};
+
+// One LOD of a mesh (layout matches Shaders/draw_cull.comp)
+struct IndirectLod {
+	uint32_t indexOffset;		// In the arena's index buffer (mesh's firstIndex included)
+	uint32_t indexCount;
+	float error;
+	int32_t vertexOffset;		// Mesh's vertices in the arena's vertex buffer
+};
+
+// Draws sharing vertex and index buffers (a GeometryArena page, one index type), so one indirect draw covers them all
+struct IndirectBatch {
+	VkBuffer vertexBuffer;
+	VkBuffer indexBuffer;
+	VkIndexType indexType;
+	uint32_t firstCommand;		// Batch's draws are consecutive, from here
+	uint32_t drawCount;
+};
+
+// GPU driven culling and drawing. The scene's draws (one per instance of each mesh), their meshes' LODs and the
+// batches they're drawn in live in storage buffers, only rewritten when the scene changes (a draw that just moves
+// is updated on its own, and only its record is copied to each image's buffer). Each frame a compute
+// pass tests every draw's bounding sphere against the view frustum, picks its LOD, and packs a
+// VkDrawIndexedIndirectCommand for each visible draw at the front of its batch's commands, counting them.
+// Each batch is then drawn with one indirect draw (using the count where the device has draw indirect count),
+// so the CPU cost of a frame depends on the number of batches, not the number of draws.
+// The vertex shader finds its draw's transform and texture through firstInstance (the draw's index).
+// With occlusion culling, culling runs in two phases around a DepthPyramid. The first draws whatever was not hidden
+// behind last frame's depth, the pyramid is then built from those draws, and the second retests the hidden ones
+// against it, drawing any that have come into view. The pyramid is rebuilt from the finished depth at the end of the
+// frame for the next frame's first phase. Each phase has its own half of the commands and counts.
+class DrawCuller
+{
+public:
+	DrawCuller();
+
+	void create(DeviceAllocator * newAllocator, VkDevice newDevice, uint32_t imageCount,
+		PFN_vkCmdDrawIndexedIndirectCountKHR newDrawIndexedIndirectCount, bool newOcclusionCulling);
+	VkDescriptorSetLayout getSetLayout();
+	void setDepthPyramid(DepthPyramid * newDepthPyramid);
+
+	void setDraws(const std::vector<IndirectDraw> & newDraws, const std::vector<IndirectLod> & newLods, const std::vector<IndirectBatch> & newBatches);
+	const IndirectDraw & getDraw(uint32_t drawIndex);
+	void updateDraw(uint32_t drawIndex, const IndirectDraw & draw);
+
+	void recordCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex, const glm::mat4 & viewProjection, glm::vec3 cameraPos, float pixelsPerUnit);
+	void recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkPipelineLayout pipelineLayout, uint32_t setIndex, uint32_t phase);
+
+	uint32_t getDrawCount();
+	uint32_t getVisibleCount();
+	uint32_t getCulledCount();
+	uint32_t getOccludedCount();
+
+	void destroy();
+
+	~DrawCuller();
+
+private:
+	// Push constant of draw_cull.comp
+	struct DrawCullPush {
+		glm::mat4 viewProjection;
+		glm::vec4 camera;				// xyz = position, w = pixels a world space unit covers at distance 1
+		uint32_t drawCount;
+		uint32_t groupsPerRow;			// Workgroups in x of the dispatch (draw = (y * groupsPerRow + x) * group size + thread)
+		float lodErrorPixels;
+		uint32_t batchCount;
+		uint32_t phase;					// 0: every draw, against last frame's pyramid, 1: the first phase's occluded draws
+		uint32_t pyramidBuilt;
+		uint32_t padding[2];
+	};
+
+	// Header of the occlusion buffer (followed by the candidates, the indices of draws the first phase found occluded)
+	struct OcclusionHeader {
+		uint32_t candidateCount;
+		uint32_t occludedCount;
+		uint32_t padding[2];
+	};
+
+	// Buffers of one swapchain image (rewritten when its command buffer is recorded, same as the uniform buffers)
+	struct ImageBuffers {
+		VkBuffer drawBuffer = VK_NULL_HANDLE;
+		DeviceAllocation drawBufferMemory;
+		uint32_t drawCapacity = 0;
+		VkBuffer lodBuffer = VK_NULL_HANDLE;
+		DeviceAllocation lodBufferMemory;
+		uint32_t lodCapacity = 0;
+		VkBuffer commandBuffer = VK_NULL_HANDLE;
+		DeviceAllocation commandBufferMemory;
+		uint32_t commandCapacity = 0;
+		VkBuffer countBuffer = VK_NULL_HANDLE;
+		DeviceAllocation countBufferMemory;		// Host visible, so last frame's counts can be read back
+		uint32_t countCapacity = 0;
+		VkBuffer occlusionBuffer = VK_NULL_HANDLE;
+		DeviceAllocation occlusionBufferMemory;	// Host visible, so last frame's occluded count can be read back
+		uint32_t occlusionCapacity = 0;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		uint32_t version = 0;					// Version of the draws in the buffers
+		std::vector<uint32_t> dirtyDraws;		// Draws updated since the buffers were last written (just these are copied)
+		std::vector<uint8_t> drawDirty;			// Whether each draw is in dirtyDraws
+		uint32_t culledDrawCount = 0;			// Draws tested by the last culling pass recorded for the image
+	};
+
+	DeviceAllocator * allocator = nullptr;
+	VkDevice device = VK_NULL_HANDLE;
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;	// nullptr: batches draw every slot (unused ones are empty)
+
+	std::vector<IndirectDraw> draws;
+	std::vector<IndirectLod> lods;
+	std::vector<IndirectBatch> batches;
+	uint32_t version = 1;
+	uint32_t visibleCount = 0;
+	uint32_t culledCount = 0;
+	uint32_t occludedCount = 0;
+
+	bool occlusionCulling = false;
+	DepthPyramid * depthPyramid = nullptr;
+	DrawCullPush push = {};						// Of the first phase, reused by the second
+
+	std::vector<ImageBuffers> imageBuffers;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+
+	void updateImageBuffers(uint32_t imageIndex);
+	bool growBuffer(VkBuffer * buffer, DeviceAllocation * memory, uint32_t * capacity, uint32_t required, VkDeviceSize elementSize,
+		VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
+	void writeDescriptorSet(uint32_t imageIndex);
+};
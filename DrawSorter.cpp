@@ -0,0 +1,80 @@
+#include "DrawSorter.h"
+
+#include <cstring>
+#include <algorithm>
+
+DrawSorter::DrawSorter()
+{
+}
+
+uint64_t DrawSorter::makeKey(uint32_t pipeline, uint32_t textureId, uint32_t geometryBuffer, float depth)
+{
+	// Bits of a non-negative float sort the same way as its value, so its top bits are a quantised depth that keeps
+	// its precision close to the camera (any distance-like value will do, e.g. squared distance)
+	uint32_t depthBits;
+	float clampedDepth = std::max(depth, 0.0f);
+	memcpy(&depthBits, &clampedDepth, sizeof(depthBits));
+	uint64_t quantisedDepth = depthBits >> (31 - DRAW_KEY_DEPTH_BITS);		// (sign bit is always 0)
+
+	uint64_t key = pipeline & ((1u << DRAW_KEY_PIPELINE_BITS) - 1);
+	key = (key << DRAW_KEY_TEXTURE_BITS) | (textureId & ((1u << DRAW_KEY_TEXTURE_BITS) - 1));
+	key = (key << DRAW_KEY_GEOMETRY_BITS) | std::min(geometryBuffer, DRAW_KEY_GEOMETRY_OTHER);
+	key = (key << DRAW_KEY_DEPTH_BITS) | quantisedDepth;
+	return key;
+}
+
+void DrawSorter::sort(std::vector<uint64_t> * keys, std::vector<uint32_t> * values)
+{
+	size_t count = keys->size();
+	if (count < 2)
+	{
+		return;
+	}
+
+	// Counts of every digit of every byte, in one pass over the keys
+	uint32_t counts[8][256] = {};
+	for (uint64_t key : *keys)
+	{
+		for (uint32_t digit = 0; digit < 8; digit++)
+		{
+			counts[digit][(key >> (digit * 8)) & 0xFF]++;
+		}
+	}
+
+	keyScratch.resize(count);
+	valueScratch.resize(count);
+
+	// Least significant digit first, each pass stable so the previous passes' order holds within equal digits
+	for (uint32_t digit = 0; digit < 8; digit++)
+	{
+		// Every key has the same digit here, so the pass wouldn't move anything
+		uint32_t firstDigit = ((*keys)[0] >> (digit * 8)) & 0xFF;
+		if (counts[digit][firstDigit] == count)
+		{
+			continue;
+		}
+
+		uint32_t offsets[256];
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			offsets[i] = offset;
+			offset += counts[digit][i];
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t slot = offsets[((*keys)[i] >> (digit * 8)) & 0xFF]++;
+			keyScratch[slot] = (*keys)[i];
+			valueScratch[slot] = (*values)[i];
+		}
+
+		// Sorted so far is now in the scratch vectors (swapping keeps both allocations for next time)
+		keys->swap(keyScratch);
+		values->swap(valueScratch);
+	}
+}
+
+DrawSorter::~DrawSorter()
+{
+}
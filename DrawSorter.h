@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Bits of each field of a draw's sort key, most significant first. Draws sort by pipeline, then texture, then
+// geometry buffer, so each is bound as few times as possible, and finally front to back, so early depth testing
+// rejects as much as it can
+const uint32_t DRAW_KEY_PIPELINE_BITS = 8;
+const uint32_t DRAW_KEY_TEXTURE_BITS = 24;
+const uint32_t DRAW_KEY_GEOMETRY_BITS = 8;
+const uint32_t DRAW_KEY_DEPTH_BITS = 24;
+
+// Geometry buffer of draws whose indices aren't in the shared geometry buffers (sorted after those that are)
+const uint32_t DRAW_KEY_GEOMETRY_OTHER = (1u << DRAW_KEY_GEOMETRY_BITS) - 1;
+
+// Sorts a frame's draws by 64 bit keys (see makeKey) with an LSD radix sort: eight passes of 8 bit digits, each a
+// stable counting sort, so the order is linear in the number of draws. Digits every key shares (e.g. the pipeline,
+// or the top bits of the texture ids) are skipped. Scratch space is kept between frames.
+class DrawSorter
+{
+public:
+	DrawSorter();
+
+	static uint64_t makeKey(uint32_t pipeline, uint32_t textureId, uint32_t geometryBuffer, float depth);
+
+	void sort(std::vector<uint64_t> * keys, std::vector<uint32_t> * values);
+
+	~DrawSorter();
+
+private:
+	std::vector<uint64_t> keyScratch;
+	std::vector<uint32_t> valueScratch;
+};
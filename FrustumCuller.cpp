@@ -0,0 +1,169 @@
+#include "FrustumCuller.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_CULLER_SSE
+#endif
+
+FrustumCuller::FrustumCuller()
+{
+	for (auto &plane : planes)
+	{
+		plane = glm::vec4(0.0f);
+	}
+}
+
+void FrustumCuller::setFrustum(const glm::mat4 & viewProjection)
+{
+	// Planes from the rows of the view projection matrix (depth 0 - 1): left, right, bottom, top, near, far
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[2];
+	planes[5] = rows[3] - rows[2];
+
+	// Unit normals, so plane distances are world space distances
+	for (auto &plane : planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+}
+
+void FrustumCuller::clear()
+{
+	centreX.clear();
+	centreY.clear();
+	centreZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+	sphereX.clear();
+	sphereY.clear();
+	sphereZ.clear();
+	sphereRadius.clear();
+}
+
+uint32_t FrustumCuller::addBounds(const glm::mat4 & transform, glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec4 boundingSphere)
+{
+	// Box: centre moves with the transform, and each world axis' extent is the sum of the rotated/scaled local extents along it
+	glm::vec3 centre = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+	glm::vec3 localExtent = (boundsMax - boundsMin) * 0.5f;
+	glm::vec3 extent = glm::abs(glm::vec3(transform[0])) * localExtent.x + glm::abs(glm::vec3(transform[1])) * localExtent.y +
+		glm::abs(glm::vec3(transform[2])) * localExtent.z;
+
+	// Sphere: radius grows with the largest axis scale
+	glm::vec3 sphereCentre = glm::vec3(transform * glm::vec4(glm::vec3(boundingSphere), 1.0f));
+	float scale = glm::max(glm::length(glm::vec3(transform[0])), glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	centreX.push_back(centre.x);
+	centreY.push_back(centre.y);
+	centreZ.push_back(centre.z);
+	extentX.push_back(extent.x);
+	extentY.push_back(extent.y);
+	extentZ.push_back(extent.z);
+	sphereX.push_back(sphereCentre.x);
+	sphereY.push_back(sphereCentre.y);
+	sphereZ.push_back(sphereCentre.z);
+	sphereRadius.push_back(boundingSphere.w * scale);
+
+	return static_cast<uint32_t>(sphereRadius.size()) - 1;
+}
+
+void FrustumCuller::cull()
+{
+	size_t count = sphereRadius.size();
+	visible.resize(count);
+	visibleCount = 0;
+
+	size_t i = 0;
+
+#ifdef FRUSTUM_CULLER_SSE
+	// Four entries at a time, each lane a different entry
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 boxX = _mm_loadu_ps(&centreX[i]);
+		__m128 boxY = _mm_loadu_ps(&centreY[i]);
+		__m128 boxZ = _mm_loadu_ps(&centreZ[i]);
+		__m128 boxExtentX = _mm_loadu_ps(&extentX[i]);
+		__m128 boxExtentY = _mm_loadu_ps(&extentY[i]);
+		__m128 boxExtentZ = _mm_loadu_ps(&extentZ[i]);
+		__m128 centreSphereX = _mm_loadu_ps(&sphereX[i]);
+		__m128 centreSphereY = _mm_loadu_ps(&sphereY[i]);
+		__m128 centreSphereZ = _mm_loadu_ps(&sphereZ[i]);
+		__m128 negativeRadius = _mm_sub_ps(zero, _mm_loadu_ps(&sphereRadius[i]));
+
+		__m128 outside = zero;
+		for (const auto &plane : planes)
+		{
+			__m128 planeX = _mm_set1_ps(plane.x);
+			__m128 planeY = _mm_set1_ps(plane.y);
+			__m128 planeZ = _mm_set1_ps(plane.z);
+			__m128 planeW = _mm_set1_ps(plane.w);
+
+			// Box is outside if its centre is further behind the plane than its extents reach along the normal
+			__m128 boxDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX, boxX), _mm_mul_ps(planeY, boxY)), _mm_add_ps(_mm_mul_ps(planeZ, boxZ), planeW));
+			__m128 boxReach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), boxExtentX), _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), boxExtentY)),
+				_mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), boxExtentZ));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(boxDistance, boxReach), zero));
+
+			// Sphere is outside if its centre is more than its radius behind the plane
+			__m128 sphereDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX, centreSphereX), _mm_mul_ps(planeY, centreSphereY)),
+				_mm_add_ps(_mm_mul_ps(planeZ, centreSphereZ), planeW));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(sphereDistance, negativeRadius));
+		}
+
+		int outsideMask = _mm_movemask_ps(outside);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			visible[i + lane] = (outsideMask >> lane) & 1 ? 0 : 1;
+			visibleCount += visible[i + lane];
+		}
+	}
+#endif
+
+	// Whatever is left over (or everything, without SSE)
+	for (; i < count; i++)
+	{
+		bool outside = false;
+		for (const auto &plane : planes)
+		{
+			float boxDistance = plane.x * centreX[i] + plane.y * centreY[i] + plane.z * centreZ[i] + plane.w;
+			float boxReach = std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i];
+			float sphereDistance = plane.x * sphereX[i] + plane.y * sphereY[i] + plane.z * sphereZ[i] + plane.w;
+			outside = outside || boxDistance + boxReach < 0.0f || sphereDistance < -sphereRadius[i];
+		}
+
+		visible[i] = outside ? 0 : 1;
+		visibleCount += visible[i];
+	}
+}
+
+bool FrustumCuller::isVisible(uint32_t entry)
+{
+	return visible[entry] != 0;
+}
+
+uint32_t FrustumCuller::getVisibleCount()
+{
+	return visibleCount;
+}
+
+uint32_t FrustumCuller::getCulledCount()
+{
+	return static_cast<uint32_t>(visible.size()) - visibleCount;
+}
+
+FrustumCuller::~FrustumCuller()
+{
+}
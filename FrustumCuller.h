@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+// CPU view frustum culling of everything that might be drawn in a frame. Each entry's world space bounding box
+// (centre and half extents) and bounding sphere go into a structure of arrays table, one array per component,
+// so cull() can test four entries against each plane at once with SSE. An entry is culled when either of its
+// bounds is wholly outside one of the six planes.
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	void setFrustum(const glm::mat4 & viewProjection);
+
+	void clear();
+	uint32_t addBounds(const glm::mat4 & transform, glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec4 boundingSphere);
+
+	void cull();
+	bool isVisible(uint32_t entry);
+	uint32_t getVisibleCount();
+	uint32_t getCulledCount();
+
+	~FrustumCuller();
+
+private:
+	glm::vec4 planes[6];				// xyz = normal (unit length, pointing in), w = distance
+
+	// Bounds table (world space)
+	std::vector<float> centreX, centreY, centreZ;		// Box centre
+	std::vector<float> extentX, extentY, extentZ;		// Box half extents
+	std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+
+	std::vector<uint8_t> visible;		// Result of the last cull()
+	uint32_t visibleCount = 0;
+};
@@ -0,0 +1,256 @@
+#include "GeometryArena.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+GeometryArena::GeometryArena()
+{
+}
+
+void GeometryArena::create(DeviceAllocator * newAllocator, VkDevice newDevice, uint32_t transferFamily, uint32_t graphicsFamily)
+{
+	allocator = newAllocator;
+	device = newDevice;
+
+	// Transfer queue copies new meshes into a page while the graphics queue draws the rest of it, so a separate transfer
+	// family can't hand over ownership of the page (it's the whole buffer's), the page is shared by both instead
+	if (transferFamily != graphicsFamily)
+	{
+		sharingFamilies = { transferFamily, graphicsFamily };
+	}
+
+	// First page up front, so loading the first model doesn't have to make it
+	pages.emplace_back();
+	createPage(&pages[0], GEOMETRY_PAGE_VERTEX_SIZE, GEOMETRY_PAGE_INDEX_SIZE);
+}
+
+GeometryAllocation GeometryArena::allocate(UploadBatch * uploadBatch, const void * vertices, VkDeviceSize vertexSize, const void * indices, VkDeviceSize indexSize)
+{
+	// Meshlet culling reads indices as whole 32 bit words (so 16 bit indices round up)
+	VkDeviceSize indexRangeSize = (indexSize + 3) & ~VkDeviceSize(3);
+
+	// First page with room for both, or a new page (in the slot of a destroyed one if there is one)
+	GeometryAllocation allocation;
+	bool allocated = false;
+	for (uint32_t i = 0; i < pages.size() && !allocated; i++)
+	{
+		if (pages[i].vertexBuffer != VK_NULL_HANDLE && tryAllocate(&pages[i], vertexSize, indexRangeSize, &allocation))
+		{
+			allocation.page = i;
+			allocated = true;
+		}
+	}
+
+	if (!allocated)
+	{
+		uint32_t pageIndex = 0;
+		while (pageIndex < pages.size() && pages[pageIndex].vertexBuffer != VK_NULL_HANDLE)
+		{
+			pageIndex++;
+		}
+		if (pageIndex == pages.size())
+		{
+			pages.emplace_back();
+		}
+
+		createPage(&pages[pageIndex], std::max(vertexSize, GEOMETRY_PAGE_VERTEX_SIZE), std::max(indexRangeSize, GEOMETRY_PAGE_INDEX_SIZE));
+		if (!tryAllocate(&pages[pageIndex], vertexSize, indexRangeSize, &allocation))
+		{
+			throw std::runtime_error("Failed to allocate mesh geometry!");
+		}
+		allocation.page = pageIndex;
+	}
+
+	Page &page = pages[allocation.page];
+	upload(uploadBatch, page.vertexBuffer, page.vertexBufferMemory, allocation.vertexOffset, vertices, vertexSize);
+	upload(uploadBatch, page.indexBuffer, page.indexBufferMemory, allocation.indexOffset, indices, indexSize);
+
+	return allocation;
+}
+
+void GeometryArena::free(const GeometryAllocation & allocation)
+{
+	// Caller makes sure the GPU has finished with it (as for any buffer being destroyed)
+	Page &page = pages[allocation.page];
+	releaseRange(&page.vertexFreeRanges, allocation.vertexOffset, allocation.vertexSize);
+	releaseRange(&page.indexFreeRanges, allocation.indexOffset, allocation.indexSize);
+
+	page.allocationCount--;
+	if (page.allocationCount == 0 && allocation.page != 0)
+	{
+		destroyPage(&page);
+	}
+}
+
+VkBuffer GeometryArena::getVertexBuffer(uint32_t page)
+{
+	return pages[page].vertexBuffer;
+}
+
+VkBuffer GeometryArena::getIndexBuffer(uint32_t page)
+{
+	return pages[page].indexBuffer;
+}
+
+void GeometryArena::destroy()
+{
+	if (device == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	for (auto &page : pages)
+	{
+		if (page.vertexBuffer != VK_NULL_HANDLE)
+		{
+			destroyPage(&page);
+		}
+	}
+	pages.clear();
+	device = VK_NULL_HANDLE;
+}
+
+GeometryArena::~GeometryArena()
+{
+}
+
+bool GeometryArena::tryAllocate(Page * page, VkDeviceSize vertexSize, VkDeviceSize indexSize, GeometryAllocation * allocation)
+{
+	// Vertices on whole vertices, so their offset is a vertexOffset
+	if (!reserveRange(&page->vertexFreeRanges, vertexSize, sizeof(PackedVertex), &allocation->vertexOffset))
+	{
+		return false;
+	}
+
+	if (!reserveRange(&page->indexFreeRanges, indexSize, GEOMETRY_INDEX_ALIGNMENT, &allocation->indexOffset))
+	{
+		releaseRange(&page->vertexFreeRanges, allocation->vertexOffset, vertexSize);
+		return false;
+	}
+
+	allocation->vertexSize = vertexSize;
+	allocation->indexSize = indexSize;
+	page->allocationCount++;
+	return true;
+}
+
+bool GeometryArena::reserveRange(std::vector<FreeRange> * freeRanges, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * offset)
+{
+	// Best fit, to leave the large ranges for large meshes
+	size_t best = freeRanges->size();
+	VkDeviceSize bestWaste = 0;
+	for (size_t i = 0; i < freeRanges->size(); i++)
+	{
+		const FreeRange &range = (*freeRanges)[i];
+		VkDeviceSize alignedOffset = (range.offset + alignment - 1) / alignment * alignment;
+		if (alignedOffset + size > range.offset + range.size)
+		{
+			continue;
+		}
+
+		VkDeviceSize waste = range.size - size;
+		if (best == freeRanges->size() || waste < bestWaste)
+		{
+			best = i;
+			bestWaste = waste;
+		}
+	}
+
+	if (best == freeRanges->size())
+	{
+		return false;
+	}
+
+	// Take the aligned part, leaving any padding before it and the rest after it free
+	FreeRange range = (*freeRanges)[best];
+	*offset = (range.offset + alignment - 1) / alignment * alignment;
+	VkDeviceSize end = *offset + size;
+
+	freeRanges->erase(freeRanges->begin() + best);
+	if (end < range.offset + range.size)
+	{
+		freeRanges->insert(freeRanges->begin() + best, { end, range.offset + range.size - end });
+	}
+	if (*offset > range.offset)
+	{
+		freeRanges->insert(freeRanges->begin() + best, { range.offset, *offset - range.offset });
+	}
+
+	return true;
+}
+
+void GeometryArena::releaseRange(std::vector<FreeRange> * freeRanges, VkDeviceSize offset, VkDeviceSize size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	// Keep the list sorted by offset, so neighbours are next to each other in it
+	auto next = std::lower_bound(freeRanges->begin(), freeRanges->end(), offset,
+		[](const FreeRange &range, VkDeviceSize rangeOffset) { return range.offset < rangeOffset; });
+	auto range = freeRanges->insert(next, { offset, size });
+
+	// Merge with the range after it, then the range before it
+	auto after = range + 1;
+	if (after != freeRanges->end() && range->offset + range->size == after->offset)
+	{
+		range->size += after->size;
+		range = freeRanges->erase(after) - 1;
+	}
+	if (range != freeRanges->begin())
+	{
+		auto before = range - 1;
+		if (before->offset + before->size == range->offset)
+		{
+			before->size += range->size;
+			freeRanges->erase(range);
+		}
+	}
+}
+
+void GeometryArena::createPage(Page * page, VkDeviceSize vertexSize, VkDeviceSize indexSize)
+{
+	// Index buffers are also read as storage buffers by meshlet culling
+	createPageBuffer(vertexSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &page->vertexBuffer, &page->vertexBufferMemory);
+	createPageBuffer(indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		&page->indexBuffer, &page->indexBufferMemory);
+
+	page->vertexFreeRanges = { { 0, vertexSize } };
+	page->indexFreeRanges = { { 0, indexSize } };
+	page->allocationCount = 0;
+}
+
+void GeometryArena::destroyPage(Page * page)
+{
+	vkDestroyBuffer(device, page->vertexBuffer, nullptr);
+	allocator->free(page->vertexBufferMemory);
+	vkDestroyBuffer(device, page->indexBuffer, nullptr);
+	allocator->free(page->indexBufferMemory);
+
+	*page = Page();
+}
+
+void GeometryArena::createPageBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer * buffer, DeviceAllocation * memory)
+{
+	// Meshes are written straight into it if GPU memory is host visible (unified memory, resizable BAR), otherwise staged
+	if (createDirectUploadBuffer(allocator, device, size, usage, buffer, memory))
+	{
+		return;
+	}
+
+	createBuffer(allocator, device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory,
+		sharingFamilies);
+}
+
+void GeometryArena::upload(UploadBatch * uploadBatch, VkBuffer buffer, const DeviceAllocation & memory, VkDeviceSize offset, const void * data, VkDeviceSize size)
+{
+	if (memory.mapped != nullptr)
+	{
+		memcpy(static_cast<char *>(memory.mapped) + offset, data, static_cast<size_t>(size));
+		return;
+	}
+
+	// Copy runs when the batch is submitted (page is shared by both queue families, so there's no ownership to hand over)
+	uploadBatch->uploadToBuffer(buffer, offset, data, size, !sharingFamilies.empty());
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+#include "UploadBatch.h"
+
+// Size of each page's vertex and index buffers (a mesh too large for a page gets a page of its own size)
+const VkDeviceSize GEOMETRY_PAGE_VERTEX_SIZE = 64 * 1024 * 1024;
+const VkDeviceSize GEOMETRY_PAGE_INDEX_SIZE = 32 * 1024 * 1024;
+
+// Each mesh's indices start on this boundary, so they can also be bound as a storage buffer of whole 32 bit words
+// (meshlet culling reads them). 256 is the largest minStorageBufferOffsetAlignment a device can have
+const VkDeviceSize GEOMETRY_INDEX_ALIGNMENT = 256;
+
+// Where one mesh's vertices and indices are in the arena (offsets and sizes in bytes)
+struct GeometryAllocation {
+	uint32_t page = 0;
+	VkDeviceSize vertexOffset = 0;
+	VkDeviceSize vertexSize = 0;
+	VkDeviceSize indexOffset = 0;
+	VkDeviceSize indexSize = 0;
+};
+
+// Vertices and indices of every mesh, packed into shared vertex and index buffers, so meshes are drawn with their
+// firstIndex and vertexOffset and a whole scene needs its buffers bound once. Buffers come in pages, with a new page
+// only made when no page has room, so there is normally just one.
+// Each page keeps free lists of its vertex and index buffers, sorted by offset. Freeing a mesh merges its ranges with
+// any free neighbours, so the space unloaded models leave behind joins back up for larger meshes, and a page left
+// empty is destroyed (other than the first, which is kept for the next load).
+class GeometryArena
+{
+public:
+	GeometryArena();
+
+	void create(DeviceAllocator * newAllocator, VkDevice newDevice, uint32_t transferFamily, uint32_t graphicsFamily);
+
+	GeometryAllocation allocate(UploadBatch * uploadBatch, const void * vertices, VkDeviceSize vertexSize, const void * indices, VkDeviceSize indexSize);
+	void free(const GeometryAllocation & allocation);
+
+	VkBuffer getVertexBuffer(uint32_t page);
+	VkBuffer getIndexBuffer(uint32_t page);
+
+	void destroy();
+
+	~GeometryArena();
+
+private:
+	struct FreeRange {
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	struct Page {
+		VkBuffer vertexBuffer = VK_NULL_HANDLE;
+		DeviceAllocation vertexBufferMemory;
+		std::vector<FreeRange> vertexFreeRanges;
+		VkBuffer indexBuffer = VK_NULL_HANDLE;
+		DeviceAllocation indexBufferMemory;
+		std::vector<FreeRange> indexFreeRanges;
+		uint32_t allocationCount = 0;
+	};
+
+	DeviceAllocator * allocator = nullptr;
+	VkDevice device = VK_NULL_HANDLE;
+	std::vector<uint32_t> sharingFamilies;		// Transfer and graphics families if they differ (pages are shared concurrently)
+
+	std::vector<Page> pages;			// Destroyed pages leave an empty slot (allocations refer to pages by index)
+
+	bool tryAllocate(Page * page, VkDeviceSize vertexSize, VkDeviceSize indexSize, GeometryAllocation * allocation);
+	bool reserveRange(std::vector<FreeRange> * freeRanges, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * offset);
+	void releaseRange(std::vector<FreeRange> * freeRanges, VkDeviceSize offset, VkDeviceSize size);
+	void createPage(Page * page, VkDeviceSize vertexSize, VkDeviceSize indexSize);
+	void destroyPage(Page * page);
+	void createPageBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer * buffer, DeviceAllocation * memory);
+	void upload(UploadBatch * uploadBatch, VkBuffer buffer, const DeviceAllocation & memory, VkDeviceSize offset, const void * data, VkDeviceSize size);
+};
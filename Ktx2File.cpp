@@ -0,0 +1,147 @@
+#include "Ktx2File.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+// Identifier at the start of every KTX2 file ("«KTX 20»\r\n\x1A\n")
+static const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// File header, followed by the index (byte offsets of the data format, key/value and supercompression sections)
+struct Ktx2Header {
+	unsigned char identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+// Entry in level index (one per mip level, straight after the header)
+struct Ktx2LevelIndex {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+Ktx2File::Ktx2File()
+{
+}
+
+void Ktx2File::load(const std::string & fileLoc)
+{
+	std::ifstream file(fileLoc, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open a KTX2 file! (" + fileLoc + ")");
+	}
+	uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+	file.seekg(0);
+
+	// Header is little-endian, same as every platform we target
+	Ktx2Header header;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+		memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+	{
+		throw std::runtime_error("Not a KTX2 file! (" + fileLoc + ")");
+	}
+
+	if (header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1)
+	{
+		throw std::runtime_error("Only 2D KTX2 textures are supported! (" + fileLoc + ")");
+	}
+	if (header.supercompressionScheme != 0)
+	{
+		throw std::runtime_error("Supercompressed KTX2 textures are not supported! (" + fileLoc + ")");
+	}
+
+	// Must be a format we can upload (format is undefined for Basis Universal textures, which need transcoding)
+	uint32_t blockWidth, blockHeight, blockSize;
+	format = static_cast<VkFormat>(header.vkFormat);
+	if (!getFormatBlockInfo(format, &blockWidth, &blockHeight, &blockSize))
+	{
+		throw std::runtime_error("Unsupported KTX2 texture format! (" + fileLoc + ")");
+	}
+
+	width = header.pixelWidth;
+	height = header.pixelHeight;
+
+	// Level count of 0 means "generate mips at load", which can't be done for compressed data, so just use the base level
+	uint32_t levelCount = std::max(header.levelCount, 1u);
+	std::vector<Ktx2LevelIndex> levelIndex(levelCount);
+	if (!file.read(reinterpret_cast<char *>(levelIndex.data()), levelCount * sizeof(Ktx2LevelIndex)))
+	{
+		throw std::runtime_error("Truncated KTX2 file! (" + fileLoc + ")");
+	}
+
+	// Copy each level's blocks into one buffer, checking it holds exactly one whole level
+	levels.resize(levelCount);
+	VkDeviceSize dataSize = 0;
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		levels[i].width = std::max(width >> i, 1u);
+		levels[i].height = std::max(height >> i, 1u);
+		levels[i].offset = dataSize;
+		levels[i].size = static_cast<VkDeviceSize>((levels[i].width + blockWidth - 1) / blockWidth) *
+			((levels[i].height + blockHeight - 1) / blockHeight) * blockSize;
+
+		if (levelIndex[i].byteLength != levels[i].size || levelIndex[i].byteOffset + levelIndex[i].byteLength > fileSize)
+		{
+			throw std::runtime_error("Invalid KTX2 level data! (" + fileLoc + ")");
+		}
+
+		dataSize += levels[i].size;
+	}
+
+	data.resize(static_cast<size_t>(dataSize));
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		file.seekg(static_cast<std::streamoff>(levelIndex[i].byteOffset));
+		file.read(reinterpret_cast<char *>(data.data() + levels[i].offset), static_cast<std::streamsize>(levels[i].size));
+	}
+
+	if (!file)
+	{
+		throw std::runtime_error("Failed to read KTX2 level data! (" + fileLoc + ")");
+	}
+}
+
+VkFormat Ktx2File::getFormat()
+{
+	return format;
+}
+
+uint32_t Ktx2File::getWidth()
+{
+	return width;
+}
+
+uint32_t Ktx2File::getHeight()
+{
+	return height;
+}
+
+std::vector<TextureLevel> & Ktx2File::getLevels()
+{
+	return levels;
+}
+
+std::vector<unsigned char> & Ktx2File::getData()
+{
+	return data;
+}
+
+Ktx2File::~Ktx2File()
+{
+}
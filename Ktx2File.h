@@ -0,0 +1,36 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <string>
+
+#include "Utilities.h"
+
+// Reads a KTX2 texture container holding pre-built mip levels in a Vulkan format (e.g. BC7, BC1, ETC2, ASTC).
+// Only plain 2D textures are supported: no arrays, cube maps, 3D textures or supercompression (Basis/Zstandard).
+class Ktx2File
+{
+public:
+	Ktx2File();
+
+	void load(const std::string & fileLoc);
+
+	VkFormat getFormat();
+	uint32_t getWidth();
+	uint32_t getHeight();
+
+	std::vector<TextureLevel> & getLevels();
+	std::vector<unsigned char> & getData();
+
+	~Ktx2File();
+
+private:
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+
+	std::vector<TextureLevel> levels;		// Largest level first
+	std::vector<unsigned char> data;		// Every level, packed one after another
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file, so its contents can be used in place without reading them into a buffer.
+// Unmapped when closed (or destroyed).
+class MappedFile
+{
+public:
+	MappedFile();
+
+	bool open(const std::string & fileName);
+
+	const unsigned char * getData();
+	uint64_t getSize();
+
+	void close();
+
+	~MappedFile();
+
+private:
+	const unsigned char * data = nullptr;
+	uint64_t size = 0;
+
+#ifdef _WIN32
+	void * fileHandle = nullptr;
+	void * mappingHandle = nullptr;
+#endif
+
+	// Mapping can't be shared between owners
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+};
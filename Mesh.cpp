@@ -6,30 +6,23 @@ Mesh::Mesh()
 {
 }
 
-Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-	VkQueue transferQueue, VkCommandPool transferCommandPool, 
-	std::vector<Vertex>* vertices, std::vector<uint32_t> * indices,
-	int newTexId)
-{
-	vertexCount = vertices->size();
-	indexCount = indices->size();
-	physicalDevice = newPhysicalDevice;
+Mesh::Mesh(DeviceAllocator * newAllocator, VkDevice newDevice, MeshGeometry * newGeometry, int newTexId)
+{
+	allocator = newAllocator;
 	device = newDevice;
-	createVertexBuffer(transferQueue, transferCommandPool, vertices);
-	createIndexBuffer(transferQueue, transferCommandPool, indices);
-
-	model.model = glm::mat4(1.0f);
+	geometry = newGeometry;
 	texId = newTexId;
 }
 
-void Mesh::setModel(glm::mat4 newModel)
+MeshGeometry * Mesh::getGeometry()
 {
-	model.model = newModel;
+	return geometry;
 }
 
 Model Mesh::getModel()
 {
-	return model;
+	// Mesh's own transform is the dequantisation of its packed vertices
+	return geometry->getDequantisation();
 }
 
 int Mesh::getTexId()
@@ -39,95 +32,162 @@ int Mesh::getTexId()
 
 int Mesh::getVertexCount()
 {
-	return vertexCount;
+	return geometry->getVertexCount();
 }
 
 VkBuffer Mesh::getVertexBuffer()
 {
-	return vertexBuffer;
+	return geometry->getVertexBuffer();
+}
+
+int32_t Mesh::getVertexOffset()
+{
+	return geometry->getVertexOffset();
 }
 
 int Mesh::getIndexCount()
 {
-	return indexCount;
+	return geometry->getIndexCount();
+}
+
+VkIndexType Mesh::getIndexType()
+{
+	return geometry->getIndexType();
 }
 
 VkBuffer Mesh::getIndexBuffer()
 {
-	return indexBuffer;
+	return geometry->getIndexBuffer();
 }
 
-void Mesh::destroyBuffers()
+uint32_t Mesh::getFirstIndex()
 {
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
-	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	return geometry->getFirstIndex();
 }
 
+glm::vec3 Mesh::getBoundsMin()
+{
+	return geometry->getBoundsMin();
+}
 
-Mesh::~Mesh()
+glm::vec3 Mesh::getBoundsMax()
 {
+	return geometry->getBoundsMax();
 }
 
-void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices)
+glm::vec4 Mesh::getBoundingSphere()
 {
-	// Get size of buffer needed for vertices
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices->size();
+	return geometry->getBoundingSphere();
+}
 
-	// Temporary buffer to "stage" vertex data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+void Mesh::selectLod(const glm::mat4 & modelMatrix, glm::vec3 cameraPos, float pixelsPerUnit)
+{
+	const std::vector<MeshLod> &lods = geometry->getLods();
+	glm::vec3 boundsMin = geometry->getBoundsMin();
+	glm::vec3 boundsMax = geometry->getBoundsMax();
+
+	// Bounding sphere in world space (errors scale with the largest axis scale)
+	float scale = glm::max(glm::length(glm::vec3(modelMatrix[0])), glm::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+	glm::vec3 centre = glm::vec3(modelMatrix * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+	float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+
+	// Nearest the mesh could be to the camera (inside the sphere counts as right next to it)
+	float distance = glm::max(glm::length(centre - cameraPos) - radius, 1e-4f);
+	float errorToPixels = scale * pixelsPerUnit / distance;
+
+	if (lods[currentLod].error * errorToPixels > LOD_ERROR_PIXELS)
+	{
+		// Too coarse: go to the simplest finer LOD that's accurate enough
+		while (currentLod > 0 && lods[currentLod].error * errorToPixels > LOD_ERROR_PIXELS)
+		{
+			currentLod--;
+		}
+	}
+	else
+	{
+		// Only go coarser once comfortably under the limit
+		while (currentLod + 1 < lods.size() && lods[currentLod + 1].error * errorToPixels <= LOD_ERROR_PIXELS * LOD_HYSTERESIS)
+		{
+			currentLod++;
+		}
+	}
+}
 
-	// Create Staging Buffer and Allocate Memory to it
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&stagingBuffer, &stagingBufferMemory);
+const MeshLod & Mesh::getLod()
+{
+	return geometry->getLods()[currentLod];
+}
 
-	// MAP MEMORY TO VERTEX BUFFER
-	void * data;																// 1. Create pointer to a point in normal memory
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);			// 2. "Map" the vertex buffer memory to that point
-	memcpy(data, vertices->data(), (size_t)bufferSize);							// 3. Copy memory from vertices vector to the point
-	vkUnmapMemory(device, stagingBufferMemory);									// 4. Unmap the vertex buffer memory
+size_t Mesh::getLodIndex()
+{
+	return currentLod;
+}
 
-	// Create buffer with TRANSFER_DST_BIT to mark as recipient of transfer data (also VERTEX_BUFFER)
-	// Buffer memory is to be DEVICE_LOCAL_BIT meaning memory is on the GPU and only accessible by it and not CPU (host)
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
+void Mesh::createCulledIndexBuffers(uint32_t imageCount)
+{
+	// Culling output is written and read by the GPU only (room for every full detail index, all 32 bit)
+	VkDeviceSize culledSize = MESHLET_CULL_HEADER_SIZE + sizeof(uint32_t) * geometry->getLods()[0].indexCount;
+	culledIndexBuffers.resize(imageCount);
+	culledIndexBufferMemory.resize(imageCount);
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		createBuffer(allocator, device, culledSize,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &culledIndexBuffers[i], &culledIndexBufferMemory[i]);
+	}
+}
 
-	// Copy staging buffer to vertex buffer on GPU
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
+void Mesh::destroyCulledIndexBuffers()
+{
+	for (size_t i = 0; i < culledIndexBuffers.size(); i++)
+	{
+		vkDestroyBuffer(device, culledIndexBuffers[i], nullptr);
+		allocator->free(culledIndexBufferMemory[i]);
+	}
+
+	culledIndexBuffers.clear();
+	culledIndexBufferMemory.clear();
+	meshletCullSets.clear();
+}
+
+uint32_t Mesh::getMeshletCount()
+{
+	return geometry->getMeshletCount();
+}
+
+VkBuffer Mesh::getMeshletBuffer()
+{
+	return geometry->getMeshletBuffer();
+}
+
+VkBuffer Mesh::getCulledIndexBuffer(uint32_t imageIndex)
+{
+	return culledIndexBuffers[imageIndex];
+}
 
-	// Clean up staging buffer parts
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+void Mesh::setMeshletCullSets(const std::vector<VkDescriptorSet> & newMeshletCullSets)
+{
+	meshletCullSets = newMeshletCullSets;
 }
 
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices)
+const std::vector<VkDescriptorSet> & Mesh::getMeshletCullSets()
 {
-	// Get size of buffer needed for indices
-	VkDeviceSize bufferSize = sizeof(uint32_t) * indices->size();
-	
-	// Temporary buffer to "stage" index data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
+	return meshletCullSets;
+}
 
-	// MAP MEMORY TO INDEX BUFFER
-	void * data;																
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);			
-	memcpy(data, indices->data(), (size_t)bufferSize);							
-	vkUnmapMemory(device, stagingBufferMemory);
+bool Mesh::isMeshletCulled()
+{
+	// Meshlets cover the full detail mesh, simpler LODs are drawn whole
+	return !meshletCullSets.empty() && currentLod == 0;
+}
 
-	// Create buffer for INDEX data on GPU access only area
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
+void Mesh::destroyBuffers()
+{
+	// Only this draw's own buffers (geometry is freed along with the rest of its model file's)
+	destroyCulledIndexBuffers();
+}
 
-	// Copy from staging buffer to GPU access buffer
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
 
-	// Destroy + Release Staging Buffer resources
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+Mesh::~Mesh()
+{
 }
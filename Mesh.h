@@ -6,51 +6,73 @@
 #include <vector>
 
 #include "Utilities.h"
+#include "UploadBatch.h"
+#include "MeshGeometry.h"
 
-struct Model {
-	glm::mat4 model;
-};
+// Culled index buffers start with their VkDrawIndexedIndirectCommand, with the indices after it
+// (at an offset any storage buffer alignment allows)
+const VkDeviceSize MESHLET_CULL_HEADER_SIZE = 256;
+
+// A LOD is drawn once its error covers no more than this many pixels on screen
+const float LOD_ERROR_PIXELS = 1.0f;
 
+// Switching to a simpler LOD needs its error this far under the limit (stops LODs flickering at the boundary)
+const float LOD_HYSTERESIS = 0.75f;
+
+// One draw of a MeshGeometry (a node's use of a mesh, in one model), with the state that differs between draws
+// of the same geometry: its texture, the LOD it was last drawn at and its meshlet culling output
 class Mesh
 {
 public:
 	Mesh();
-	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-		VkQueue transferQueue, VkCommandPool transferCommandPool, 
-		std::vector<Vertex> * vertices, std::vector<uint32_t> * indices,
-		int newTexId);
+	Mesh(DeviceAllocator * newAllocator, VkDevice newDevice, MeshGeometry * newGeometry, int newTexId);
 
-	void setModel(glm::mat4 newModel);
+	MeshGeometry * getGeometry();
 	Model getModel();
 
 	int getTexId();
 
 	int getVertexCount();
 	VkBuffer getVertexBuffer();
+	int32_t getVertexOffset();
 
 	int getIndexCount();
+	VkIndexType getIndexType();
 	VkBuffer getIndexBuffer();
+	uint32_t getFirstIndex();
+
+	glm::vec3 getBoundsMin();
+	glm::vec3 getBoundsMax();
+	glm::vec4 getBoundingSphere();
+
+	void selectLod(const glm::mat4 & modelMatrix, glm::vec3 cameraPos, float pixelsPerUnit);
+	const MeshLod & getLod();
+	size_t getLodIndex();
+
+	void createCulledIndexBuffers(uint32_t imageCount);
+	void destroyCulledIndexBuffers();
+	uint32_t getMeshletCount();
+	VkBuffer getMeshletBuffer();
+	VkBuffer getCulledIndexBuffer(uint32_t imageIndex);
+	void setMeshletCullSets(const std::vector<VkDescriptorSet> & newMeshletCullSets);
+	const std::vector<VkDescriptorSet> & getMeshletCullSets();
+	bool isMeshletCulled();
 
 	void destroyBuffers();
 
 	~Mesh();
 
 private:
-	Model model;
-	int texId;
+	MeshGeometry * geometry = nullptr;	// Shared, owned by the model file's ModelGeometry
+	int texId = 0;
 
-	int vertexCount;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	size_t currentLod = 0;			// LOD drawn last frame
 
-	int indexCount;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	// Meshlet culling (only set up if the GPU culls meshlets, see MeshletCuller)
+	std::vector<VkBuffer> culledIndexBuffers;				// Per swapchain image: draw command, then surviving meshlets' indices
+	std::vector<DeviceAllocation> culledIndexBufferMemory;
+	std::vector<VkDescriptorSet> meshletCullSets;			// Per swapchain image
 
-	VkPhysicalDevice physicalDevice;
-	VkDevice device;
-
-	void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex> * vertices);
-	void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t> * indices);
+	DeviceAllocator * allocator = nullptr;
+	VkDevice device = VK_NULL_HANDLE;
 };
-
@@ -0,0 +1,341 @@
+#include "MeshCache.h"
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+// Layout: header, mesh records, material texture names, node tree, mesh references, then LOD/meshlet/vertex/index data (each block 16 byte aligned)
+static const char MESH_CACHE_MAGIC[8] = { 'M', 'E', 'S', 'H', 'C', 'A', 'C', 'H' };
+static const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+struct MeshCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t vertexSize;			// sizeof(PackedVertex) when written
+	uint32_t processingFlags;		// MESH_CACHE_* import stages applied
+	uint32_t padding;
+	uint64_t sourceSize;			// Source model file this was built from
+	int64_t sourceModifiedTime;
+	uint32_t meshCount;
+	uint32_t materialCount;
+	uint64_t materialNamesOffset;	// Each name is a uint32_t length followed by its characters
+	uint32_t nodeCount;
+	uint32_t meshReferenceCount;
+	uint64_t nodesOffset;			// nodeCount TransformNodes, parents first
+	uint64_t meshReferencesOffset;	// meshReferenceCount MeshReferences (the node drawing each use of a mesh)
+	uint64_t fileSize;				// Catches truncated files
+};
+
+struct MeshCacheRecord {
+	uint32_t materialIndex;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t indexType;				// VkIndexType of the mesh's indices
+	float boundsMin[3];
+	float boundsMax[3];
+	float boundingSphere[4];
+	float texTransform[4];			// Dequantisation of packed UVs
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t lodOffset;				// lodCount MeshLods (index ranges within the mesh's indices)
+	uint32_t lodCount;
+	uint32_t meshletCount;
+	uint64_t meshletOffset;			// meshletCount Meshlets (index ranges within the mesh's full detail indices)
+};
+
+static uint64_t alignCacheOffset(uint64_t offset)
+{
+	return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static uint64_t getCacheIndexSize(uint32_t indexType)
+{
+	return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+bool MeshCache::Load(const std::string & modelFile, uint32_t processingFlags, ModelData * modelData)
+{
+	uint64_t sourceSize;
+	int64_t sourceModifiedTime;
+	if (!GetSourceStamp(modelFile, &sourceSize, &sourceModifiedTime))
+	{
+		return false;
+	}
+
+	std::shared_ptr<MappedFile> cacheFile = std::make_shared<MappedFile>();
+	if (!cacheFile->open(GetCacheFileName(modelFile)))
+	{
+		return false;
+	}
+
+	const unsigned char * data = cacheFile->getData();
+	uint64_t size = cacheFile->getSize();
+
+	// Anything that doesn't match means the cache is stale (or from another build), so re-import
+	if (size < sizeof(MeshCacheHeader))
+	{
+		return false;
+	}
+	const MeshCacheHeader * header = reinterpret_cast<const MeshCacheHeader *>(data);
+	if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0 || header->version != MESH_CACHE_VERSION ||
+		header->vertexSize != sizeof(PackedVertex) || header->processingFlags != processingFlags || header->sourceSize != sourceSize || header->sourceModifiedTime != sourceModifiedTime ||
+		header->fileSize != size)
+	{
+		return false;
+	}
+
+	uint64_t recordsEnd = sizeof(MeshCacheHeader) + static_cast<uint64_t>(header->meshCount) * sizeof(MeshCacheRecord);
+	if (recordsEnd > size || header->materialNamesOffset > size || header->nodesOffset + static_cast<uint64_t>(header->nodeCount) * sizeof(TransformNode) > size ||
+		header->meshReferencesOffset + static_cast<uint64_t>(header->meshReferenceCount) * sizeof(MeshReference) > size)
+	{
+		return false;
+	}
+
+	// Material texture names
+	ModelData cachedData;
+	cachedData.textures.resize(header->materialCount);
+	uint64_t offset = header->materialNamesOffset;
+	for (auto &texture : cachedData.textures)
+	{
+		uint32_t nameLength;
+		if (offset + sizeof(nameLength) > size)
+		{
+			return false;
+		}
+		memcpy(&nameLength, data + offset, sizeof(nameLength));
+		offset += sizeof(nameLength);
+
+		if (offset + nameLength > size)
+		{
+			return false;
+		}
+		texture.fileName.assign(reinterpret_cast<const char *>(data + offset), nameLength);
+		offset += nameLength;
+	}
+
+	// Node tree (every node after its parent)
+	cachedData.nodes.resize(header->nodeCount);
+	memcpy(cachedData.nodes.data(), data + header->nodesOffset, header->nodeCount * sizeof(TransformNode));
+	for (uint32_t i = 0; i < header->nodeCount; i++)
+	{
+		if (cachedData.nodes[i].parent < -1 || cachedData.nodes[i].parent >= static_cast<int32_t>(i))
+		{
+			return false;
+		}
+	}
+
+	// Which node draws each use of a mesh
+	cachedData.meshReferences.resize(header->meshReferenceCount);
+	memcpy(cachedData.meshReferences.data(), data + header->meshReferencesOffset, header->meshReferenceCount * sizeof(MeshReference));
+	for (const auto &meshReference : cachedData.meshReferences)
+	{
+		if (meshReference.mesh >= header->meshCount || meshReference.node >= header->nodeCount)
+		{
+			return false;
+		}
+	}
+
+	// Meshes point straight into the mapping
+	const MeshCacheRecord * records = reinterpret_cast<const MeshCacheRecord *>(data + sizeof(MeshCacheHeader));
+	cachedData.meshes.resize(header->meshCount);
+	for (uint32_t i = 0; i < header->meshCount; i++)
+	{
+		const MeshCacheRecord &record = records[i];
+		if ((record.indexType != VK_INDEX_TYPE_UINT16 && record.indexType != VK_INDEX_TYPE_UINT32) ||
+			record.vertexOffset + static_cast<uint64_t>(record.vertexCount) * sizeof(PackedVertex) > size ||
+			record.indexOffset + static_cast<uint64_t>(record.indexCount) * getCacheIndexSize(record.indexType) > size ||
+			record.lodOffset + static_cast<uint64_t>(record.lodCount) * sizeof(MeshLod) > size ||
+			record.meshletOffset + static_cast<uint64_t>(record.meshletCount) * sizeof(Meshlet) > size ||
+			record.materialIndex >= header->materialCount)
+		{
+			return false;
+		}
+
+		MeshData &meshData = cachedData.meshes[i];
+		meshData.materialIndex = record.materialIndex;
+		meshData.boundsMin = glm::vec3(record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]);
+		meshData.boundsMax = glm::vec3(record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]);
+		meshData.boundingSphere = glm::vec4(record.boundingSphere[0], record.boundingSphere[1], record.boundingSphere[2], record.boundingSphere[3]);
+		meshData.indexType = static_cast<VkIndexType>(record.indexType);
+		meshData.texTransform = glm::vec4(record.texTransform[0], record.texTransform[1], record.texTransform[2], record.texTransform[3]);
+		meshData.mappedVertices = reinterpret_cast<const PackedVertex *>(data + record.vertexOffset);
+		meshData.mappedVertexCount = record.vertexCount;
+		meshData.mappedIndices = data + record.indexOffset;
+		meshData.mappedIndexCount = record.indexCount;
+
+		meshData.lods.resize(record.lodCount);
+		memcpy(meshData.lods.data(), data + record.lodOffset, record.lodCount * sizeof(MeshLod));
+		for (const auto &lod : meshData.lods)
+		{
+			if (static_cast<uint64_t>(lod.indexOffset) + lod.indexCount > record.indexCount)
+			{
+				return false;
+			}
+		}
+
+		meshData.meshlets.resize(record.meshletCount);
+		memcpy(meshData.meshlets.data(), data + record.meshletOffset, record.meshletCount * sizeof(Meshlet));
+		for (const auto &meshlet : meshData.meshlets)
+		{
+			if (static_cast<uint64_t>(meshlet.indexOffset) + meshlet.indexCount > record.indexCount)
+			{
+				return false;
+			}
+		}
+	}
+
+	cachedData.meshCacheFile = cacheFile;
+	*modelData = std::move(cachedData);
+
+	return true;
+}
+
+void MeshCache::Save(const std::string & modelFile, uint32_t processingFlags, const ModelData & modelData)
+{
+	uint64_t sourceSize;
+	int64_t sourceModifiedTime;
+	if (!GetSourceStamp(modelFile, &sourceSize, &sourceModifiedTime))
+	{
+		return;
+	}
+
+	MeshCacheHeader header = {};
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+	header.version = MESH_CACHE_VERSION;
+	header.vertexSize = sizeof(PackedVertex);
+	header.processingFlags = processingFlags;
+	header.sourceSize = sourceSize;
+	header.sourceModifiedTime = sourceModifiedTime;
+	header.meshCount = static_cast<uint32_t>(modelData.meshes.size());
+	header.materialCount = static_cast<uint32_t>(modelData.textures.size());
+	header.materialNamesOffset = sizeof(MeshCacheHeader) + modelData.meshes.size() * sizeof(MeshCacheRecord);
+
+	// Work out where the node tree, mesh references and each mesh's data go
+	uint64_t offset = header.materialNamesOffset;
+	for (const auto &texture : modelData.textures)
+	{
+		offset += sizeof(uint32_t) + texture.fileName.size();
+	}
+
+	header.nodeCount = static_cast<uint32_t>(modelData.nodes.size());
+	header.nodesOffset = alignCacheOffset(offset);
+	offset = header.nodesOffset + static_cast<uint64_t>(header.nodeCount) * sizeof(TransformNode);
+
+	header.meshReferenceCount = static_cast<uint32_t>(modelData.meshReferences.size());
+	header.meshReferencesOffset = alignCacheOffset(offset);
+	offset = header.meshReferencesOffset + static_cast<uint64_t>(header.meshReferenceCount) * sizeof(MeshReference);
+
+	std::vector<MeshCacheRecord> records(modelData.meshes.size());
+	for (size_t i = 0; i < modelData.meshes.size(); i++)
+	{
+		const MeshData &meshData = modelData.meshes[i];
+		MeshCacheRecord &record = records[i];
+		record.materialIndex = meshData.materialIndex;
+		record.vertexCount = static_cast<uint32_t>(meshData.getVertexCount());
+		record.indexCount = static_cast<uint32_t>(meshData.getIndexCount());
+		record.indexType = static_cast<uint32_t>(meshData.indexType);
+		memcpy(record.boundsMin, &meshData.boundsMin, sizeof(record.boundsMin));
+		memcpy(record.boundsMax, &meshData.boundsMax, sizeof(record.boundsMax));
+		memcpy(record.boundingSphere, &meshData.boundingSphere, sizeof(record.boundingSphere));
+		memcpy(record.texTransform, &meshData.texTransform, sizeof(record.texTransform));
+		record.lodCount = static_cast<uint32_t>(meshData.lods.size());
+		record.meshletCount = static_cast<uint32_t>(meshData.meshlets.size());
+
+		record.lodOffset = alignCacheOffset(offset);
+		offset = record.lodOffset + static_cast<uint64_t>(record.lodCount) * sizeof(MeshLod);
+		record.meshletOffset = alignCacheOffset(offset);
+		offset = record.meshletOffset + static_cast<uint64_t>(record.meshletCount) * sizeof(Meshlet);
+		record.vertexOffset = alignCacheOffset(offset);
+		offset = record.vertexOffset + static_cast<uint64_t>(record.vertexCount) * sizeof(PackedVertex);
+		record.indexOffset = alignCacheOffset(offset);
+		offset = record.indexOffset + static_cast<uint64_t>(record.indexCount) * meshData.getIndexSize();
+	}
+	header.fileSize = offset;
+
+	// Write to a file of our own, then move it into place, so a load never sees a half written cache
+	std::string cacheFileName = GetCacheFileName(modelFile);
+	std::ostringstream tempFileName;
+	tempFileName << cacheFileName << "." << std::this_thread::get_id() << ".tmp";
+
+	{
+		std::ofstream file(tempFileName.str(), std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return;		// Can't write next to the model (e.g. read-only folder), so just go without a cache
+		}
+
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(MeshCacheRecord));
+
+		for (const auto &texture : modelData.textures)
+		{
+			uint32_t nameLength = static_cast<uint32_t>(texture.fileName.size());
+			file.write(reinterpret_cast<const char *>(&nameLength), sizeof(nameLength));
+			file.write(texture.fileName.data(), nameLength);
+		}
+
+		static const char padding[MESH_CACHE_ALIGNMENT] = {};
+		file.write(padding, static_cast<std::streamsize>(header.nodesOffset - static_cast<uint64_t>(file.tellp())));
+		file.write(reinterpret_cast<const char *>(modelData.nodes.data()), header.nodeCount * sizeof(TransformNode));
+		file.write(padding, static_cast<std::streamsize>(header.meshReferencesOffset - static_cast<uint64_t>(file.tellp())));
+		file.write(reinterpret_cast<const char *>(modelData.meshReferences.data()), header.meshReferenceCount * sizeof(MeshReference));
+
+		for (size_t i = 0; i < modelData.meshes.size(); i++)
+		{
+			const MeshData &meshData = modelData.meshes[i];
+			const MeshCacheRecord &record = records[i];
+
+			file.write(padding, static_cast<std::streamsize>(record.lodOffset - static_cast<uint64_t>(file.tellp())));
+			file.write(reinterpret_cast<const char *>(meshData.lods.data()), record.lodCount * sizeof(MeshLod));
+			file.write(padding, static_cast<std::streamsize>(record.meshletOffset - static_cast<uint64_t>(file.tellp())));
+			file.write(reinterpret_cast<const char *>(meshData.meshlets.data()), record.meshletCount * sizeof(Meshlet));
+			file.write(padding, static_cast<std::streamsize>(record.vertexOffset - static_cast<uint64_t>(file.tellp())));
+			file.write(reinterpret_cast<const char *>(meshData.getVertexData()), record.vertexCount * sizeof(PackedVertex));
+			file.write(padding, static_cast<std::streamsize>(record.indexOffset - static_cast<uint64_t>(file.tellp())));
+			file.write(reinterpret_cast<const char *>(meshData.getIndexData()), record.indexCount * meshData.getIndexSize());
+		}
+
+		if (!file)
+		{
+			file.close();
+			std::remove(tempFileName.str().c_str());
+			return;
+		}
+	}
+
+	// Replace any stale cache (rename won't overwrite on Windows)
+	std::remove(cacheFileName.c_str());
+	if (std::rename(tempFileName.str().c_str(), cacheFileName.c_str()) != 0)
+	{
+		std::remove(tempFileName.str().c_str());
+	}
+}
+
+std::string MeshCache::GetCacheFileName(const std::string & modelFile)
+{
+	return modelFile + ".meshcache";
+}
+
+bool MeshCache::GetSourceStamp(const std::string & modelFile, uint64_t * size, int64_t * modifiedTime)
+{
+#ifdef _WIN32
+	struct _stat64 fileStat;
+	if (_stat64(modelFile.c_str(), &fileStat) != 0)
+	{
+		return false;
+	}
+#else
+	struct stat fileStat;
+	if (stat(modelFile.c_str(), &fileStat) != 0)
+	{
+		return false;
+	}
+#endif
+
+	*size = static_cast<uint64_t>(fileStat.st_size);
+	*modifiedTime = static_cast<int64_t>(fileStat.st_mtime);
+	return true;
+}
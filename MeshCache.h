@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include "MeshModel.h"
+
+// Bump whenever the cache layout or the processing done before caching (e.g. Vertex format) changes
+const uint32_t MESH_CACHE_VERSION = 9;
+
+// Import stages applied to the cached meshes (a cache made with different stages isn't used)
+const uint32_t MESH_CACHE_OPTIMISED = 1 << 0;		// MeshOptimiser has been run
+
+// Binary cache of a model's processed meshes (vertices, indices, LODs, meshlets, bounds), node tree, mesh references and material texture names,
+// stored next to the model as "<model file>.meshcache". Repeat loads map the cache and use it in place,
+// so Assimp doesn't run at all. A cache is only used if it matches the source file's size and modified time.
+class MeshCache
+{
+public:
+	static bool Load(const std::string & modelFile, uint32_t processingFlags, ModelData * modelData);
+	static void Save(const std::string & modelFile, uint32_t processingFlags, const ModelData & modelData);
+
+private:
+	static std::string GetCacheFileName(const std::string & modelFile);
+	static bool GetSourceStamp(const std::string & modelFile, uint64_t * size, int64_t * modifiedTime);
+};
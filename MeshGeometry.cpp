@@ -0,0 +1,172 @@
+#include "MeshGeometry.h"
+
+MeshGeometry::MeshGeometry()
+{
+}
+
+MeshGeometry::MeshGeometry(DeviceAllocator * newAllocator, VkDevice newDevice, GeometryArena * newArena,
+	UploadBatch * uploadBatch,
+	const PackedVertex * vertices, size_t newVertexCount, const void * indices, size_t newIndexCount, VkIndexType newIndexType,
+	Model newDequantisation)
+{
+	vertexCount = static_cast<int>(newVertexCount);
+	indexCount = static_cast<int>(newIndexCount);
+	indexType = newIndexType;
+	allocator = newAllocator;
+	device = newDevice;
+	arena = newArena;
+
+	// Vertices and indices go into the arena's shared buffers (written straight in, or through the upload batch)
+	VkDeviceSize indexSize = (indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)) * indexCount;
+	arenaAllocation = arena->allocate(uploadBatch, vertices, sizeof(PackedVertex) * vertexCount, indices, indexSize);
+
+	dequantisation = newDequantisation;
+
+	// Just the full mesh until told about any simpler LODs
+	lods = { { 0, static_cast<uint32_t>(indexCount), 0.0f } };
+}
+
+Model MeshGeometry::getDequantisation()
+{
+	return dequantisation;
+}
+
+int MeshGeometry::getVertexCount()
+{
+	return vertexCount;
+}
+
+VkBuffer MeshGeometry::getVertexBuffer()
+{
+	return arena->getVertexBuffer(arenaAllocation.page);
+}
+
+int32_t MeshGeometry::getVertexOffset()
+{
+	// Added to every index, so indices stay relative to the mesh's own vertices
+	return static_cast<int32_t>(arenaAllocation.vertexOffset / sizeof(PackedVertex));
+}
+
+int MeshGeometry::getIndexCount()
+{
+	return indexCount;
+}
+
+VkIndexType MeshGeometry::getIndexType()
+{
+	return indexType;
+}
+
+VkBuffer MeshGeometry::getIndexBuffer()
+{
+	return arena->getIndexBuffer(arenaAllocation.page);
+}
+
+uint32_t MeshGeometry::getFirstIndex()
+{
+	// In indices of the mesh's index type, with the arena's index buffer bound at offset 0
+	VkDeviceSize indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	return static_cast<uint32_t>(arenaAllocation.indexOffset / indexSize);
+}
+
+VkDeviceSize MeshGeometry::getIndexBufferOffset()
+{
+	return arenaAllocation.indexOffset;
+}
+
+VkDeviceSize MeshGeometry::getIndexBufferSize()
+{
+	return arenaAllocation.indexSize;
+}
+
+uint32_t MeshGeometry::getArenaPage()
+{
+	return arenaAllocation.page;
+}
+
+void MeshGeometry::setBounds(glm::vec3 newBoundsMin, glm::vec3 newBoundsMax, glm::vec4 newBoundingSphere)
+{
+	boundsMin = newBoundsMin;
+	boundsMax = newBoundsMax;
+	boundingSphere = newBoundingSphere;
+}
+
+glm::vec3 MeshGeometry::getBoundsMin()
+{
+	return boundsMin;
+}
+
+glm::vec3 MeshGeometry::getBoundsMax()
+{
+	return boundsMax;
+}
+
+glm::vec4 MeshGeometry::getBoundingSphere()
+{
+	return boundingSphere;
+}
+
+void MeshGeometry::setLods(const std::vector<MeshLod> & newLods)
+{
+	if (!newLods.empty())
+	{
+		lods = newLods;
+	}
+}
+
+const std::vector<MeshLod> & MeshGeometry::getLods()
+{
+	return lods;
+}
+
+void MeshGeometry::createMeshletBuffer(UploadBatch * uploadBatch, const Meshlet * meshlets, size_t newMeshletCount)
+{
+	meshletCount = static_cast<uint32_t>(newMeshletCount);
+
+	// Meshlets are only read by the culling shader
+	VkDeviceSize bufferSize = sizeof(Meshlet) * meshletCount;
+	if (createDirectUploadBuffer(allocator, device, bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &meshletBuffer, &meshletBufferMemory))
+	{
+		memcpy(meshletBufferMemory.mapped, meshlets, (size_t)bufferSize);
+	}
+	else
+	{
+		createBuffer(allocator, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &meshletBuffer, &meshletBufferMemory);
+		uploadBatch->uploadToBuffer(meshletBuffer, 0, meshlets, bufferSize);
+	}
+}
+
+void MeshGeometry::destroyMeshletBuffer()
+{
+	if (meshletBuffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vkDestroyBuffer(device, meshletBuffer, nullptr);
+	allocator->free(meshletBufferMemory);
+
+	meshletBuffer = VK_NULL_HANDLE;
+	meshletCount = 0;
+}
+
+uint32_t MeshGeometry::getMeshletCount()
+{
+	return meshletCount;
+}
+
+VkBuffer MeshGeometry::getMeshletBuffer()
+{
+	return meshletBuffer;
+}
+
+void MeshGeometry::destroyBuffers()
+{
+	arena->free(arenaAllocation);
+	destroyMeshletBuffer();
+}
+
+MeshGeometry::~MeshGeometry()
+{
+}
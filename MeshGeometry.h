@@ -0,0 +1,100 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+#include "UploadBatch.h"
+#include "GeometryArena.h"
+
+// Per draw push constant
+struct Model {
+	glm::mat4 model;			// Model matrix (including dequantisation of the mesh's packed positions)
+	glm::vec4 texTransform;		// Dequantisation of the mesh's packed UVs (xy = offset, zw = scale)
+};
+
+// Range of a mesh's index buffer drawing one level of detail (LOD 0 is the full mesh, later LODs are simpler)
+struct MeshLod {
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	float error;				// Furthest the LOD's surface is from the full mesh (object space)
+};
+
+// Small cluster of a mesh's triangles, culled on its own by the GPU (layout matches Shaders/meshlet_cull.comp)
+struct Meshlet {
+	glm::vec4 sphere;			// Bounding sphere, object space (xyz = centre, w = radius)
+	glm::vec4 cone;				// Normal cone (xyz = axis, w = cutoff), back facing when seen within the cutoff of the axis
+	uint32_t indexOffset;		// Range of the mesh's full detail indices
+	uint32_t indexCount;
+	uint32_t padding[2];
+};
+
+// GPU copy of one mesh's vertices, indices (every LOD) and meshlets, along with its bounds and LOD ranges.
+// Uploaded once per distinct mesh of a model file and shared by every Mesh that draws it (each node using it,
+// in every model loaded from that file), so it is freed with the file's ModelGeometry, not by the Meshes.
+// Vertices and indices live in the GeometryArena's shared buffers, so draws use its firstIndex and vertexOffset.
+class MeshGeometry
+{
+public:
+	MeshGeometry();
+	MeshGeometry(DeviceAllocator * newAllocator, VkDevice newDevice, GeometryArena * newArena,
+		UploadBatch * uploadBatch,
+		const PackedVertex * vertices, size_t newVertexCount, const void * indices, size_t newIndexCount, VkIndexType newIndexType,
+		Model newDequantisation);
+
+	Model getDequantisation();
+
+	int getVertexCount();
+	VkBuffer getVertexBuffer();
+	int32_t getVertexOffset();
+
+	int getIndexCount();
+	VkIndexType getIndexType();
+	VkBuffer getIndexBuffer();
+	uint32_t getFirstIndex();
+	VkDeviceSize getIndexBufferOffset();
+	VkDeviceSize getIndexBufferSize();
+	uint32_t getArenaPage();
+
+	void setBounds(glm::vec3 newBoundsMin, glm::vec3 newBoundsMax, glm::vec4 newBoundingSphere);
+	glm::vec3 getBoundsMin();
+	glm::vec3 getBoundsMax();
+	glm::vec4 getBoundingSphere();
+
+	void setLods(const std::vector<MeshLod> & newLods);
+	const std::vector<MeshLod> & getLods();
+
+	void createMeshletBuffer(UploadBatch * uploadBatch, const Meshlet * meshlets, size_t newMeshletCount);
+	void destroyMeshletBuffer();
+	uint32_t getMeshletCount();
+	VkBuffer getMeshletBuffer();
+
+	void destroyBuffers();
+
+	~MeshGeometry();
+
+private:
+	Model dequantisation;			// Scales the packed vertices back out to the mesh's bounds/UV range
+
+	int vertexCount = 0;
+	int indexCount = 0;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;	// UINT16 when the mesh has few enough vertices
+
+	GeometryArena * arena = nullptr;
+	GeometryAllocation arenaAllocation;				// Where its vertices and indices are in the arena
+
+	glm::vec3 boundsMin = glm::vec3(0.0f);	// Object space bounding box
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	glm::vec4 boundingSphere = glm::vec4(0.0f);	// Object space (xyz = centre, w = radius)
+
+	std::vector<MeshLod> lods;		// Ranges of the index buffer, full detail first
+
+	uint32_t meshletCount = 0;		// Only uploaded if the GPU culls meshlets (see MeshletCuller)
+	VkBuffer meshletBuffer = VK_NULL_HANDLE;
+	DeviceAllocation meshletBufferMemory;
+
+	DeviceAllocator * allocator = nullptr;
+	VkDevice device = VK_NULL_HANDLE;
+};
@@ -1,9 +1,26 @@
 #include "MeshModel.h"
 
-MeshModel::MeshModel(std::vector<Mesh> newMeshList)
+#include <cstring>
+
+MeshModel::MeshModel()
 {
+	// Model itself is instance 0
+	instances.transforms.push_back(glm::mat4(1.0f));
+	instances.ids.push_back(0);
+	instances.slots.push_back(0);
+}
+
+MeshModel::MeshModel(std::vector<Mesh> newMeshList, const std::vector<TransformNode> & nodes, std::vector<uint32_t> newMeshNodes) : MeshModel()
+{
+	hierarchy = TransformHierarchy(nodes);
 	meshList = newMeshList;
-	model = glm::mat4(1.0);
+	meshNodes = newMeshNodes;
+
+	for (auto node : meshNodes) {
+		if (node >= hierarchy.getNodeCount()) {
+			throw std::runtime_error("Mesh refers to a node the model doesn't have");
+		}
+	}
 }
 
 size_t MeshModel::getMeshCount()
@@ -20,14 +37,106 @@ Mesh* MeshModel::getMesh(size_t index)
 	return &meshList[index];
 }
 
+const glm::mat4 & MeshModel::getMeshTransform(size_t index)
+{
+	if (index >= meshNodes.size()) {
+		throw std::runtime_error("Attempted to access invalid mesh index");
+	}
+
+	return hierarchy.getWorldTransform(meshNodes[index]);
+}
+
 glm::mat4 MeshModel::getModel()
 {
-	return model;
+	return instances.transforms[0];
 }
 
 void MeshModel::setModel(glm::mat4 newModel)
 {
-	model = newModel;
+	instances.transforms[0] = newModel;
+}
+
+uint32_t MeshModel::addInstance(glm::mat4 transform)
+{
+	// Re-use a destroyed instance's id if there is one
+	uint32_t instanceId;
+	if (!instances.freeIds.empty()) {
+		instanceId = instances.freeIds.back();
+		instances.freeIds.pop_back();
+	}
+	else {
+		instanceId = static_cast<uint32_t>(instances.slots.size());
+		instances.slots.push_back(UINT32_MAX);
+	}
+
+	instances.slots[instanceId] = static_cast<uint32_t>(instances.transforms.size());
+	instances.transforms.push_back(transform);
+	instances.ids.push_back(instanceId);
+
+	return instanceId;
+}
+
+void MeshModel::setInstance(uint32_t instanceId, glm::mat4 transform)
+{
+	if (instanceId >= instances.slots.size() || instances.slots[instanceId] == UINT32_MAX) {
+		throw std::runtime_error("Attempted to access invalid instance id");
+	}
+
+	instances.transforms[instances.slots[instanceId]] = transform;
+}
+
+void MeshModel::removeInstance(uint32_t instanceId)
+{
+	if (instanceId == 0 || instanceId >= instances.slots.size() || instances.slots[instanceId] == UINT32_MAX) {
+		throw std::runtime_error("Attempted to remove invalid instance id");
+	}
+
+	// Last instance fills the gap, so the transforms stay packed (instance 0 is never moved)
+	uint32_t slot = instances.slots[instanceId];
+	instances.transforms[slot] = instances.transforms.back();
+	instances.ids[slot] = instances.ids.back();
+	instances.slots[instances.ids[slot]] = slot;
+	instances.transforms.pop_back();
+	instances.ids.pop_back();
+
+	instances.slots[instanceId] = UINT32_MAX;
+	instances.freeIds.push_back(instanceId);
+}
+
+const std::vector<glm::mat4> & MeshModel::getInstanceTransforms()
+{
+	return instances.transforms;
+}
+
+const ModelInstances & MeshModel::getInstances()
+{
+	return instances;
+}
+
+void MeshModel::setInstances(const ModelInstances & newInstances)
+{
+	instances = newInstances;
+}
+
+size_t MeshModel::getNodeCount()
+{
+	return hierarchy.getNodeCount();
+}
+
+glm::mat4 MeshModel::getNodeTransform(size_t node)
+{
+	return hierarchy.getLocalTransform(node);
+}
+
+void MeshModel::setNodeTransform(size_t node, glm::mat4 newTransform)
+{
+	hierarchy.setLocalTransform(node, newTransform);
+}
+
+void MeshModel::updateTransforms()
+{
+	// Only nodes moved since last time (and everything under them) are recomputed
+	hierarchy.update();
 }
 
 void MeshModel::destroyMeshModel()
@@ -71,39 +180,45 @@ std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene)
 	return textureList;
 }
 
-std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiNode* node, const aiScene* scene, std::vector<int> matToTex)
+void MeshModel::FlattenNodes(const aiScene * scene, std::vector<TransformNode> * nodes, std::vector<MeshReference> * meshReferences)
 {
-	std::vector<Mesh> meshList;
-
-	// Go through each mesh at this node and create it, then add it to meshList
-	for (size_t i = 0; i < node->mNumMeshes; i++) {
-		// LOAD MESH HERE
-
-		Mesh loadedMesh = LoadMesh(newPhysicalDevice,
-			newDevice, transferQueue, transferCommandPool,
-			scene->mMeshes[node->mMeshes[i]], scene, matToTex);
-		
-		meshList.push_back(loadedMesh);
-	}
-
-	// mNumChilder == 0 is a break point for recussion
+	// Every node, and every use of a scene mesh (mesh = index into scene->mMeshes), in the order a depth first walk
+	// meets them (node's own meshes, then its children's), so each node comes after its parent and each subtree is one run of nodes
+	std::vector<std::pair<const aiNode *, int32_t>> nodeStack = { { scene->mRootNode, -1 } };
+
+	nodes->clear();
+	meshReferences->clear();
+
+	while (!nodeStack.empty()) {
+		const aiNode * node = nodeStack.back().first;
+		int32_t nodeIndex = static_cast<int32_t>(nodes->size());
+
+		// Assimp matrices are row major, glm's are column major
+		TransformNode transformNode;
+		transformNode.parent = nodeStack.back().second;
+		transformNode.local = glm::transpose(glm::mat4(
+			node->mTransformation.a1, node->mTransformation.a2, node->mTransformation.a3, node->mTransformation.a4,
+			node->mTransformation.b1, node->mTransformation.b2, node->mTransformation.b3, node->mTransformation.b4,
+			node->mTransformation.c1, node->mTransformation.c2, node->mTransformation.c3, node->mTransformation.c4,
+			node->mTransformation.d1, node->mTransformation.d2, node->mTransformation.d3, node->mTransformation.d4));
+		nodes->push_back(transformNode);
+		nodeStack.pop_back();
+
+		for (size_t i = 0; i < node->mNumMeshes; i++) {
+			meshReferences->push_back({ node->mMeshes[i], static_cast<uint32_t>(nodeIndex) });
+		}
 
-	// Go through each node attached to this node, and load it, then append their meshes to this node's mesh list
-	for (size_t i = 0; i < node->mNumChildren; i++) {
-		std::vector<Mesh> newList = LoadNode(
-			newPhysicalDevice, 
-			newDevice, transferQueue, transferCommandPool, 
-			node->mChildren[i], scene, matToTex);
-		meshList.insert(meshList.end(), newList.begin(), newList.end());
+		// Children go on the stack in reverse, so the first child comes off first
+		for (size_t i = node->mNumChildren; i > 0; i--) {
+			nodeStack.push_back({ node->mChildren[i - 1], nodeIndex });
+		}
 	}
-
-	return meshList;
 }
 
-Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex)
+void MeshModel::LoadMesh(const aiMesh * mesh, MeshData * meshData)
 {
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+	std::vector<Vertex> &vertices = meshData->vertices;
+	std::vector<uint32_t> &indices = meshData->indices;
 
 	// Resize vertex list to hold all verticies for mesh
 	vertices.resize(mesh->mNumVertices);
@@ -125,31 +240,88 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
 			vertices[i].tex = { 0.0f, 0.0f };
 		}
 
-		// Set color
-		vertices[i].col = { 1.0f, 1.0f, 1.0f };
+		// Grow bounds to fit vertex
+		meshData->boundsMin = i == 0 ? vertices[i].pos : glm::min(meshData->boundsMin, vertices[i].pos);
+		meshData->boundsMax = i == 0 ? vertices[i].pos : glm::max(meshData->boundsMax, vertices[i].pos);
 	}
 
-	// Iterate over indices through faces and copy across
-	for (size_t i = 0; i < mesh->mNumFaces; i++) {
-		// Get a face
-		aiFace face = mesh->mFaces[i];
+	// Bounding sphere around the box centre, just big enough for the furthest vertex (tighter than the box's corners)
+	glm::vec3 sphereCentre = (meshData->boundsMin + meshData->boundsMax) * 0.5f;
+	float sphereRadius = 0.0f;
+	for (size_t i = 0; i < vertices.size(); i++) {
+		sphereRadius = glm::max(sphereRadius, glm::length(vertices[i].pos - sphereCentre));
+	}
+	meshData->boundingSphere = glm::vec4(sphereCentre, sphereRadius);
 
-		// Go through face's indices and add to list
-		for (size_t j = 0; j < face.mNumIndices; j++) {
-			indices.push_back(face.mIndices[j]);
+	// Copy indices of each triangle straight into place (faces are triangulated on import, so this is
+	// the full list, apart from any point/line faces, which a triangle list can't draw)
+	indices.resize(static_cast<size_t>(mesh->mNumFaces) * 3);
+	size_t indexCount = 0;
+	for (size_t i = 0; i < mesh->mNumFaces; i++) {
+		const aiFace &face = mesh->mFaces[i];
+		if (face.mNumIndices != 3) {
+			continue;
 		}
+
+		indices[indexCount++] = face.mIndices[0];
+		indices[indexCount++] = face.mIndices[1];
+		indices[indexCount++] = face.mIndices[2];
 	}
+	indices.resize(indexCount);
 
-	unsigned int materialIndex = mesh->mMaterialIndex;
+	meshData->materialIndex = mesh->mMaterialIndex;
+}
 
-	// Create new mesh with details and return it
-	Mesh newMesh = Mesh(
-		newPhysicalDevice, 
-		newDevice, 
-		transferQueue,
-		transferCommandPool, 
-		&vertices, 
-		&indices, matToTex[materialIndex]);
+void MeshModel::PackMesh(MeshData * meshData)
+{
+	// Quantise to UNORM16 across the mesh's bounds (positions) and UV range (texture coords)
+	glm::vec2 texMin(0.0f);
+	glm::vec2 texMax(0.0f);
+	for (size_t i = 0; i < meshData->vertices.size(); i++)
+	{
+		texMin = i == 0 ? meshData->vertices[i].tex : glm::min(texMin, meshData->vertices[i].tex);
+		texMax = i == 0 ? meshData->vertices[i].tex : glm::max(texMax, meshData->vertices[i].tex);
+	}
+
+	// Flat axes still need a non-zero scale to divide by
+	glm::vec3 posScale = glm::max(meshData->boundsMax - meshData->boundsMin, glm::vec3(1e-20f));
+	glm::vec2 texScale = glm::max(texMax - texMin, glm::vec2(1e-20f));
+	meshData->texTransform = glm::vec4(texMin, texMax - texMin);
+
+	meshData->packedVertices.resize(meshData->vertices.size());
+	for (size_t i = 0; i < meshData->vertices.size(); i++)
+	{
+		glm::vec3 pos = glm::clamp((meshData->vertices[i].pos - meshData->boundsMin) / posScale, 0.0f, 1.0f);
+		glm::vec2 tex = glm::clamp((meshData->vertices[i].tex - texMin) / texScale, 0.0f, 1.0f);
+
+		PackedVertex &packed = meshData->packedVertices[i];
+		packed.pos[0] = static_cast<uint16_t>(pos.x * 65535.0f + 0.5f);
+		packed.pos[1] = static_cast<uint16_t>(pos.y * 65535.0f + 0.5f);
+		packed.pos[2] = static_cast<uint16_t>(pos.z * 65535.0f + 0.5f);
+		packed.pos[3] = 0;
+		packed.tex[0] = static_cast<uint16_t>(tex.x * 65535.0f + 0.5f);
+		packed.tex[1] = static_cast<uint16_t>(tex.y * 65535.0f + 0.5f);
+	}
+
+	// 16 bit indices whenever every vertex can be addressed with them
+	if (meshData->vertices.size() <= 65536)
+	{
+		meshData->indexType = VK_INDEX_TYPE_UINT16;
+		meshData->packedIndices.resize(meshData->indices.size() * sizeof(uint16_t));
+		uint16_t * packedIndices = reinterpret_cast<uint16_t *>(meshData->packedIndices.data());
+		for (size_t i = 0; i < meshData->indices.size(); i++)
+		{
+			packedIndices[i] = static_cast<uint16_t>(meshData->indices[i]);
+		}
+	}
+	else
+	{
+		meshData->indexType = VK_INDEX_TYPE_UINT32;
+		meshData->packedIndices.resize(meshData->indices.size() * sizeof(uint32_t));
+		memcpy(meshData->packedIndices.data(), meshData->indices.data(), meshData->packedIndices.size());
+	}
 
-	return newMesh;
+	// Full precision copy is no longer needed
+	std::vector<Vertex>().swap(meshData->vertices);
+	std::vector<uint32_t>().swap(meshData->indices);
 }
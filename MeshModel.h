@@ -1,41 +1,134 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <memory>
 
 #include <glm/glm.hpp>
 #include <assimp/scene.h>
 
 #include "Mesh.h"
+#include "MappedFile.h"
+#include "TransformHierarchy.h"
+
+// CPU-side copy of one mesh, ready to upload (doesn't touch Vulkan, so can be built on any thread)
+struct MeshData {
+	std::vector<Vertex> vertices;		// Full precision mesh, while it is being imported/processed
+	std::vector<uint32_t> indices;
+	unsigned int materialIndex = 0;		// Index into scene materials
+	glm::vec3 boundsMin = glm::vec3(0.0f);	// Object space bounding box
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	glm::vec4 boundingSphere = glm::vec4(0.0f);	// Object space (xyz = centre, w = radius)
+
+	// GPU format, made by MeshModel::PackMesh (which frees the full precision mesh)
+	std::vector<PackedVertex> packedVertices;
+	std::vector<uint8_t> packedIndices;				// uint16_t or uint32_t indices (see indexType)
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	glm::vec4 texTransform = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);	// Dequantisation of packed UVs (xy = offset, zw = scale)
+
+	std::vector<MeshLod> lods;			// Ranges of the index list, full detail first (see MeshSimplifier)
+	std::vector<Meshlet> meshlets;		// Clusters of the full detail triangles (see MeshletBuilder)
+
+	// Set instead of the packed vectors when the mesh is used in place from a mapped mesh cache file
+	const PackedVertex * mappedVertices = nullptr;
+	const uint8_t * mappedIndices = nullptr;
+	size_t mappedVertexCount = 0;
+	size_t mappedIndexCount = 0;
+
+	size_t getIndexSize() const { return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t); }
+
+	const PackedVertex * getVertexData() const { return mappedVertices ? mappedVertices : packedVertices.data(); }
+	size_t getVertexCount() const { return mappedVertices ? mappedVertexCount : packedVertices.size(); }
+	const void * getIndexData() const { return mappedIndices ? mappedIndices : packedIndices.data(); }
+	size_t getIndexCount() const { return mappedIndices ? mappedIndexCount : packedIndices.size() / getIndexSize(); }
+};
+
+// CPU-side texture, either RGBA8 pixels decoded from an image file or pre-built (compressed) levels from a KTX2 file
+struct TextureData {
+	std::string fileName;				// File name in Textures/ (empty if material has no texture)
+	int width = 0;
+	int height = 0;
+	VkDeviceSize imageSize = 0;
+	VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+	uint32_t mipLevels = 1;				// Levels the texture image will have
+	unsigned char * pixels = nullptr;	// Owned by stb_image (free with stbi_image_free), nullptr if not decoded
+
+	std::vector<TextureLevel> levels;		// Pre-built levels (empty if mips are generated from pixels)
+	std::vector<unsigned char> levelData;
+};
+
+// A node's use of one of the model's meshes (scenes can use the same mesh from many nodes)
+struct MeshReference {
+	uint32_t mesh;						// Index into the model's meshes
+	uint32_t node;						// Index into the model's nodes
+};
+
+// Everything needed to create a MeshModel, imported and decoded off the render thread
+struct ModelData {
+	std::vector<TextureData> textures;	// 1:1 with scene materials
+	std::vector<MeshData> meshes;		// Each distinct mesh once
+	std::vector<MeshReference> meshReferences;	// Every mesh drawn, in node order
+	std::vector<TransformNode> nodes;	// Scene node tree, parents first (see MeshModel::FlattenNodes)
+	std::shared_ptr<MappedFile> meshCacheFile;	// Keeps mapped mesh data alive until it is uploaded (if loaded from cache)
+};
+
+// Copies of a model, each placed with its own transform and all drawn together (instance 0 is the model itself)
+struct ModelInstances {
+	std::vector<glm::mat4> transforms;	// Live instances, packed (instance 0 is always first)
+	std::vector<uint32_t> ids;			// Instance id of each transform
+	std::vector<uint32_t> slots;		// Instance id -> index into transforms (UINT32_MAX once destroyed)
+	std::vector<uint32_t> freeIds;		// Destroyed instance ids to re-use
+};
+
+// GPU side of a model file: each distinct mesh uploaded once, and how the node tree uses them.
+// Shared by every MeshModel loaded from the same file (see VulkanRenderer's geometry cache).
+struct ModelGeometry {
+	std::vector<MeshGeometry> meshes;
+	std::vector<int> meshTexIds;		// Texture each mesh is drawn with (0 = default texture)
+	std::vector<MeshReference> meshReferences;
+	std::vector<TransformNode> nodes;
+	std::vector<int> textureIds;		// Texture references held by the geometry (one per textured material)
+	UploadBatch uploadBatch;			// Upload of the meshes and textures
+	bool loaded = false;				// Uploaded (or uploading), so models can be made from it
+	bool failed = false;				// Load failed, so models using it stay empty
+};
 
 class MeshModel
 {
 public:
-	MeshModel(std::vector<Mesh> newMeshList);
+	MeshModel();
+	MeshModel(std::vector<Mesh> newMeshList, const std::vector<TransformNode> & nodes, std::vector<uint32_t> newMeshNodes);
 
 	size_t getMeshCount();
 	Mesh* getMesh(size_t index);
+	const glm::mat4 & getMeshTransform(size_t index);	// Model space transform of the mesh's node (as of updateTransforms)
 
 	glm::mat4 getModel();
 	void setModel(glm::mat4 newModel);
 
+	uint32_t addInstance(glm::mat4 transform);
+	void setInstance(uint32_t instanceId, glm::mat4 transform);
+	void removeInstance(uint32_t instanceId);
+	const std::vector<glm::mat4> & getInstanceTransforms();		// Every live instance, packed
+	const ModelInstances & getInstances();
+	void setInstances(const ModelInstances & newInstances);
+
+	size_t getNodeCount();
+	glm::mat4 getNodeTransform(size_t node);
+	void setNodeTransform(size_t node, glm::mat4 newTransform);		// Local transform, relative to the node's parent
+	void updateTransforms();
+
 	void destroyMeshModel();
 
 	static std::vector<std::string> LoadMaterials(const aiScene * scene);
-	static std::vector<Mesh> LoadNode(
-		VkPhysicalDevice newPhysicalDevice, 
-		VkDevice newDevice, 
-		VkQueue transferQueue, VkCommandPool transferCommandPool,
-		aiNode * node, const aiScene * scene, std::vector<int> matToTex);
-	
-	static Mesh LoadMesh(
-		VkPhysicalDevice newPhysicalDevice,
-		VkDevice newDevice,
-		VkQueue transferQueue, VkCommandPool transferCommandPool,
-		aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex
-	);
+	static void FlattenNodes(const aiScene * scene, std::vector<TransformNode> * nodes, std::vector<MeshReference> * meshReferences);
+	static void LoadMesh(const aiMesh * mesh, MeshData * meshData);
+	static void PackMesh(MeshData * meshData);
 
 private:
 	std::vector<Mesh> meshList;
-	glm::mat4 model;
+	std::vector<uint32_t> meshNodes;	// Node each mesh hangs from
+	TransformHierarchy hierarchy;		// Node transforms within the model
+	ModelInstances instances;			// Where the model is drawn (the model matrix is instance 0)
 };
 
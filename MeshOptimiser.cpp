@@ -0,0 +1,302 @@
+#include "MeshOptimiser.h"
+
+#include <algorithm>
+
+void MeshOptimiser::OptimiseMesh(MeshData * meshData, VertexCacheStats * statsBefore, VertexCacheStats * statsAfter)
+{
+	std::vector<uint32_t> &indices = meshData->indices;
+	std::vector<Vertex> &vertices = meshData->vertices;
+
+	*statsBefore = AnalyseVertexCache(indices, vertices.size());
+
+	if (indices.size() >= 3)
+	{
+		indices = OptimiseVertexCache(indices, vertices.size());
+		indices = OptimiseOverdraw(indices, vertices);
+		OptimiseVertexFetch(&indices, &vertices);
+	}
+
+	*statsAfter = AnalyseVertexCache(indices, vertices.size());
+}
+
+void MeshOptimiser::OptimiseLods(MeshData * meshData)
+{
+	std::vector<uint32_t> &indices = meshData->indices;
+
+	for (size_t i = 1; i < meshData->lods.size(); i++)
+	{
+		const MeshLod &lod = meshData->lods[i];
+		std::vector<uint32_t> lodIndices(indices.begin() + lod.indexOffset, indices.begin() + lod.indexOffset + lod.indexCount);
+
+		lodIndices = OptimiseVertexCache(lodIndices, meshData->vertices.size());
+		std::copy(lodIndices.begin(), lodIndices.end(), indices.begin() + lod.indexOffset);
+	}
+}
+
+VertexCacheStats MeshOptimiser::AnalyseVertexCache(const std::vector<uint32_t> & indices, size_t vertexCount)
+{
+	VertexCacheStats stats;
+	stats.triangleCount = indices.size() / 3;
+	stats.vertexCount = vertexCount;
+
+	// FIFO cache: a vertex is transformed if it isn't one of the last VERTEX_CACHE_SIZE vertices transformed
+	std::vector<size_t> cacheTimestamps(vertexCount, 0);
+	size_t time = VERTEX_CACHE_SIZE + 1;
+
+	for (uint32_t index : indices)
+	{
+		if (time - cacheTimestamps[index] > VERTEX_CACHE_SIZE)
+		{
+			cacheTimestamps[index] = time++;
+			stats.cacheMisses++;
+		}
+	}
+
+	return stats;
+}
+
+std::vector<uint32_t> MeshOptimiser::OptimiseVertexCache(const std::vector<uint32_t> & indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+
+	// Triangles using each vertex (offsets into one flat list)
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (uint32_t index : indices)
+	{
+		liveTriangles[index]++;
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+	}
+
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		adjacency[adjacencyFill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<size_t> cacheTimestamps(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnds;			// Recently used vertices, to continue from when fanning runs out
+	std::vector<uint32_t> candidates;
+	size_t time = VERTEX_CACHE_SIZE + 1;
+	uint32_t nextUnusedVertex = 0;			// Cursor for when there are no dead ends left either
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	// Fan out around one vertex at a time, then move to the candidate most likely to still be in cache
+	int64_t fanVertex = 0;
+	while (fanVertex >= 0)
+	{
+		candidates.clear();
+
+		for (uint32_t i = adjacencyOffsets[fanVertex]; i < adjacencyOffsets[fanVertex + 1]; i++)
+		{
+			uint32_t triangle = adjacency[i];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				uint32_t vertex = indices[triangle * 3 + corner];
+				result.push_back(vertex);
+				deadEnds.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+
+				if (time - cacheTimestamps[vertex] > VERTEX_CACHE_SIZE)
+				{
+					cacheTimestamps[vertex] = time++;
+				}
+			}
+
+			emitted[triangle] = true;
+		}
+
+		// Best candidate: oldest vertex that will still be in cache after its remaining triangles are emitted
+		fanVertex = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+			{
+				continue;
+			}
+
+			int64_t priority = 0;
+			size_t age = time - cacheTimestamps[vertex];
+			if (age + 2 * liveTriangles[vertex] <= VERTEX_CACHE_SIZE)
+			{
+				priority = static_cast<int64_t>(age);
+			}
+
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				fanVertex = vertex;
+			}
+		}
+
+		if (fanVertex >= 0)
+		{
+			continue;
+		}
+
+		// Dead end: go back through recently used vertices, then on to any vertex with triangles left
+		while (!deadEnds.empty() && fanVertex < 0)
+		{
+			uint32_t vertex = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[vertex] > 0)
+			{
+				fanVertex = vertex;
+			}
+		}
+
+		while (fanVertex < 0 && nextUnusedVertex < vertexCount)
+		{
+			if (liveTriangles[nextUnusedVertex] > 0)
+			{
+				fanVertex = nextUnusedVertex;
+			}
+			nextUnusedVertex++;
+		}
+	}
+
+	return result;
+}
+
+std::vector<uint32_t> MeshOptimiser::OptimiseOverdraw(const std::vector<uint32_t> & indices, const std::vector<Vertex> & vertices)
+{
+	size_t triangleCount = indices.size() / 3;
+
+	// Split into clusters wherever the cache-optimised order starts afresh (a triangle with all 3 vertices missing the cache),
+	// so reordering whole clusters keeps most of the cache hits
+	std::vector<size_t> clusterStarts;
+	std::vector<size_t> cacheTimestamps(vertices.size(), 0);
+	size_t time = VERTEX_CACHE_SIZE + 1;
+
+	for (size_t triangle = 0; triangle < triangleCount; triangle++)
+	{
+		uint32_t misses = 0;
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			uint32_t vertex = indices[triangle * 3 + corner];
+			if (time - cacheTimestamps[vertex] > VERTEX_CACHE_SIZE)
+			{
+				cacheTimestamps[vertex] = time++;
+				misses++;
+			}
+		}
+
+		if (triangle == 0 || misses == 3)
+		{
+			clusterStarts.push_back(triangle);
+		}
+	}
+	clusterStarts.push_back(triangleCount);
+
+	size_t clusterCount = clusterStarts.size() - 1;
+	if (clusterCount < 2)
+	{
+		return indices;
+	}
+
+	// Mesh centre (area weighted)
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t triangle = 0; triangle < triangleCount; triangle++)
+	{
+		const glm::vec3 &p0 = vertices[indices[triangle * 3 + 0]].pos;
+		const glm::vec3 &p1 = vertices[indices[triangle * 3 + 1]].pos;
+		const glm::vec3 &p2 = vertices[indices[triangle * 3 + 2]].pos;
+		float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+
+		meshCentroid += (p0 + p1 + p2) * (area / 3.0f);
+		meshArea += area;
+	}
+	meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : glm::vec3(0.0f);
+
+	// Clusters facing away from the centre are on the outside of the mesh, so are likely to occlude the rest
+	std::vector<float> clusterOutwardness(clusterCount);
+	for (size_t cluster = 0; cluster < clusterCount; cluster++)
+	{
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+
+		for (size_t triangle = clusterStarts[cluster]; triangle < clusterStarts[cluster + 1]; triangle++)
+		{
+			const glm::vec3 &p0 = vertices[indices[triangle * 3 + 0]].pos;
+			const glm::vec3 &p1 = vertices[indices[triangle * 3 + 1]].pos;
+			const glm::vec3 &p2 = vertices[indices[triangle * 3 + 2]].pos;
+			glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+			float triangleArea = glm::length(areaNormal);
+
+			centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+			normal += areaNormal;
+			area += triangleArea;
+		}
+
+		centroid = area > 0.0f ? centroid / area : centroid;
+		float normalLength = glm::length(normal);
+		normal = normalLength > 0.0f ? normal / normalLength : normal;
+
+		clusterOutwardness[cluster] = glm::dot(centroid - meshCentroid, normal);
+	}
+
+	std::vector<size_t> clusterOrder(clusterCount);
+	for (size_t i = 0; i < clusterCount; i++)
+	{
+		clusterOrder[i] = i;
+	}
+	std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&clusterOutwardness](size_t a, size_t b) {
+		return clusterOutwardness[a] > clusterOutwardness[b];
+	});
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (size_t cluster : clusterOrder)
+	{
+		result.insert(result.end(), indices.begin() + clusterStarts[cluster] * 3, indices.begin() + clusterStarts[cluster + 1] * 3);
+	}
+
+	// Keep the cache order if sorting cost too many extra vertex shader invocations
+	size_t missesBefore = AnalyseVertexCache(indices, vertices.size()).cacheMisses;
+	size_t missesAfter = AnalyseVertexCache(result, vertices.size()).cacheMisses;
+	if (missesAfter > missesBefore * OVERDRAW_CACHE_THRESHOLD)
+	{
+		return indices;
+	}
+
+	return result;
+}
+
+void MeshOptimiser::OptimiseVertexFetch(std::vector<uint32_t> * indices, std::vector<Vertex> * vertices)
+{
+	// New vertex numbers in order of first use by the index buffer
+	const uint32_t unassigned = UINT32_MAX;
+	std::vector<uint32_t> remap(vertices->size(), unassigned);
+	std::vector<Vertex> fetchOrderedVertices;
+	fetchOrderedVertices.reserve(vertices->size());
+
+	for (uint32_t &index : *indices)
+	{
+		if (remap[index] == unassigned)
+		{
+			remap[index] = static_cast<uint32_t>(fetchOrderedVertices.size());
+			fetchOrderedVertices.push_back((*vertices)[index]);
+		}
+
+		index = remap[index];
+	}
+
+	vertices->swap(fetchOrderedVertices);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "MeshModel.h"
+
+// Size of the FIFO post-transform cache the optimiser targets and simulates for its statistics
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Overdraw pass may only make the vertex cache this much worse (ratio of cache misses)
+const float OVERDRAW_CACHE_THRESHOLD = 1.05f;
+
+// Simulated post-transform cache behaviour of an index buffer
+struct VertexCacheStats {
+	size_t triangleCount = 0;
+	size_t vertexCount = 0;
+	size_t cacheMisses = 0;			// Vertex shader invocations
+
+	float getAcmr() const { return triangleCount ? float(cacheMisses) / float(triangleCount) : 0.0f; }	// Average Cache Miss Ratio (misses per triangle, 0.5 - 3)
+	float getAtvr() const { return vertexCount ? float(cacheMisses) / float(vertexCount) : 0.0f; }		// Average Transformed Vertex Ratio (misses per vertex, 1 is ideal)
+};
+
+// Import-time optimisation of a triangle list:
+// - Reorders triangles for post-transform vertex cache hits (Tipsify, Sander et al. 2007)
+// - Reorders clusters of triangles so outward facing ones draw first, to cut overdraw (if the cache allows)
+// - Renumbers vertices in first-use order, so vertex fetches walk through memory (drops unused vertices)
+class MeshOptimiser
+{
+public:
+	static void OptimiseMesh(MeshData * meshData, VertexCacheStats * statsBefore, VertexCacheStats * statsAfter);
+	static void OptimiseLods(MeshData * meshData);		// Vertex cache order for the simplified LODs (vertices are already in place)
+
+	static VertexCacheStats AnalyseVertexCache(const std::vector<uint32_t> & indices, size_t vertexCount);
+
+private:
+	static std::vector<uint32_t> OptimiseVertexCache(const std::vector<uint32_t> & indices, size_t vertexCount);
+	static std::vector<uint32_t> OptimiseOverdraw(const std::vector<uint32_t> & indices, const std::vector<Vertex> & vertices);
+	static void OptimiseVertexFetch(std::vector<uint32_t> * indices, std::vector<Vertex> * vertices);
+};
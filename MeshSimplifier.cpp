@@ -0,0 +1,430 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <unordered_set>
+#include <cmath>
+
+// Sum of squared distances to a set of planes (area weighted), as a symmetric 4x4 matrix
+struct MeshSimplifier::Quadric {
+	double a00 = 0.0, a11 = 0.0, a22 = 0.0, a01 = 0.0, a02 = 0.0, a12 = 0.0;
+	double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+	double c = 0.0;
+	double weight = 0.0;		// Total area, so errors come out as distances
+
+	void addPlane(glm::dvec3 normal, double distance, double planeWeight)
+	{
+		a00 += planeWeight * normal.x * normal.x;
+		a11 += planeWeight * normal.y * normal.y;
+		a22 += planeWeight * normal.z * normal.z;
+		a01 += planeWeight * normal.x * normal.y;
+		a02 += planeWeight * normal.x * normal.z;
+		a12 += planeWeight * normal.y * normal.z;
+		b0 += planeWeight * normal.x * distance;
+		b1 += planeWeight * normal.y * distance;
+		b2 += planeWeight * normal.z * distance;
+		c += planeWeight * distance * distance;
+		weight += planeWeight;
+	}
+
+	void add(const Quadric & other)
+	{
+		a00 += other.a00; a11 += other.a11; a22 += other.a22;
+		a01 += other.a01; a02 += other.a02; a12 += other.a12;
+		b0 += other.b0; b1 += other.b1; b2 += other.b2;
+		c += other.c;
+		weight += other.weight;
+	}
+
+	// Squared distance of a point from the planes (weighted average)
+	double evaluate(glm::dvec3 p) const
+	{
+		double result =
+			a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z +
+			2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z) +
+			2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+
+		return weight > 0.0 ? std::max(result / weight, 0.0) : 0.0;
+	}
+};
+
+void MeshSimplifier::GenerateLods(MeshData * meshData)
+{
+	std::vector<uint32_t> &indices = meshData->indices;
+	const std::vector<Vertex> &vertices = meshData->vertices;
+
+	// LOD 0 is the mesh as it is
+	meshData->lods.clear();
+	meshData->lods.push_back({ 0, static_cast<uint32_t>(indices.size()), 0.0f });
+
+	if (indices.size() < LOD_MIN_TRIANGLES * 3)
+	{
+		return;
+	}
+
+	std::vector<bool> locked = FindLockedVertices(indices, vertices.size());
+
+	// Each vertex starts with the planes of the triangles around it
+	std::vector<Quadric> quadrics(vertices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		glm::dvec3 p0 = vertices[indices[i]].pos;
+		glm::dvec3 p1 = vertices[indices[i + 1]].pos;
+		glm::dvec3 p2 = vertices[indices[i + 2]].pos;
+
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		double area = glm::length(normal);
+		if (area <= 0.0)
+		{
+			continue;
+		}
+		normal /= area;
+
+		Quadric plane;
+		plane.addPlane(normal, -glm::dot(normal, p0), area);
+		quadrics[indices[i]].add(plane);
+		quadrics[indices[i + 1]].add(plane);
+		quadrics[indices[i + 2]].add(plane);
+	}
+
+	float maxError = LOD_MAX_ERROR * glm::length(meshData->boundsMax - meshData->boundsMin);
+
+	// Vertex of the LOD each of the full mesh's vertices has been merged into (itself until it collapses)
+	std::vector<bool> used(vertices.size(), false);
+	std::vector<uint32_t> collapsedTo(vertices.size());
+	for (uint32_t index : indices)
+	{
+		used[index] = true;
+	}
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		collapsedTo[i] = static_cast<uint32_t>(i);
+	}
+
+	// Each LOD carries on simplifying from the last, so errors only grow
+	std::vector<uint32_t> lodIndices(indices);
+	float lodError = 0.0f;
+	while (meshData->lods.size() < MAX_MESH_LODS)
+	{
+		size_t previousIndexCount = lodIndices.size();
+		size_t targetIndexCount = static_cast<size_t>(previousIndexCount / 3 * LOD_TRIANGLE_RATIO) * 3;
+
+		lodError = std::max(lodError, Simplify(&lodIndices, vertices, locked, &quadrics, &collapsedTo, targetIndexCount, maxError));
+
+		// Not worth a LOD (locked vertices or the error limit stopped it)
+		if (lodIndices.size() > previousIndexCount * LOD_MIN_REDUCTION)
+		{
+			break;
+		}
+
+		// Quadric errors are an area weighted average of plane distances, so check the real furthest distance,
+		// and drop the LOD (and stop, later ones are further still) if it is over the limit
+		lodError = std::max(lodError, MeasureDeviation(lodIndices, vertices, collapsedTo, used));
+		if (lodError > maxError)
+		{
+			break;
+		}
+
+		meshData->lods.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(lodIndices.size()), lodError });
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+	}
+}
+
+std::vector<bool> MeshSimplifier::FindLockedVertices(const std::vector<uint32_t> & indices, size_t vertexCount)
+{
+	// An edge only used in one direction has no triangle on its other side: an open edge, or a UV seam
+	// (where the triangles either side use different copies of the vertices)
+	std::unordered_set<uint64_t> edges;
+	edges.reserve(indices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		for (size_t j = 0; j < 3; j++)
+		{
+			uint64_t a = indices[i + j];
+			uint64_t b = indices[i + (j + 1) % 3];
+			edges.insert((a << 32) | b);
+		}
+	}
+
+	std::vector<bool> locked(vertexCount, false);
+	for (uint64_t edge : edges)
+	{
+		uint64_t a = edge >> 32;
+		uint64_t b = edge & 0xFFFFFFFF;
+		if (edges.find((b << 32) | a) == edges.end())
+		{
+			locked[a] = true;
+			locked[b] = true;
+		}
+	}
+
+	return locked;
+}
+
+float MeshSimplifier::Simplify(std::vector<uint32_t> * indices, const std::vector<Vertex> & vertices, const std::vector<bool> & locked,
+	std::vector<Quadric> * quadrics, std::vector<uint32_t> * collapsedTo, size_t targetIndexCount, float maxError)
+{
+	struct Collapse {
+		uint32_t from;		// Vertex removed
+		uint32_t to;		// Vertex it merges into (keeps its position)
+		float error;
+	};
+
+	size_t vertexCount = vertices.size();
+	float resultError = 0.0f;
+
+	// Passes of the cheapest collapses that don't touch each other, until at the target or nothing more fits the error limit
+	while (indices->size() > targetIndexCount)
+	{
+		size_t triangleCount = indices->size() / 3;
+
+		// Triangles using each vertex (offsets into one flat list)
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (uint32_t index : *indices)
+		{
+			adjacencyOffsets[index + 1]++;
+		}
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+		}
+
+		std::vector<uint32_t> adjacency(indices->size());
+		std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < triangleCount; i++)
+		{
+			for (size_t j = 0; j < 3; j++)
+			{
+				adjacency[adjacencyFill[(*indices)[i * 3 + j]]++] = static_cast<uint32_t>(i);
+			}
+		}
+
+		// Cost of collapsing each edge either way (only unlocked vertices can move)
+		std::vector<Collapse> collapses;
+		collapses.reserve(indices->size() * 2);
+		for (size_t i = 0; i < indices->size(); i += 3)
+		{
+			for (size_t j = 0; j < 3; j++)
+			{
+				uint32_t a = (*indices)[i + j];
+				uint32_t b = (*indices)[i + (j + 1) % 3];
+
+				if (!locked[a])
+				{
+					Quadric merged = (*quadrics)[a];
+					merged.add((*quadrics)[b]);
+					collapses.push_back({ a, b, static_cast<float>(std::sqrt(merged.evaluate(vertices[b].pos))) });
+				}
+				if (!locked[b])
+				{
+					Quadric merged = (*quadrics)[b];
+					merged.add((*quadrics)[a]);
+					collapses.push_back({ b, a, static_cast<float>(std::sqrt(merged.evaluate(vertices[a].pos))) });
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) {
+			return a.error < b.error;
+		});
+
+		// Apply collapses, cheapest first, skipping any whose neighbourhood already changed this pass
+		std::vector<uint32_t> remap(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			remap[i] = static_cast<uint32_t>(i);
+		}
+		std::vector<bool> touched(vertexCount, false);
+
+		size_t trianglesToRemove = (indices->size() - targetIndexCount) / 3;
+		size_t trianglesRemoved = 0;
+		size_t collapseCount = 0;
+
+		for (const Collapse &collapse : collapses)
+		{
+			if (collapse.error > maxError || trianglesRemoved >= trianglesToRemove)
+			{
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to])
+			{
+				continue;
+			}
+
+			// Reject collapses that would flip a triangle around the removed vertex
+			bool flips = false;
+			size_t removedTriangles = 0;
+			glm::vec3 newPos = vertices[collapse.to].pos;
+			for (uint32_t k = adjacencyOffsets[collapse.from]; k < adjacencyOffsets[collapse.from + 1] && !flips; k++)
+			{
+				const uint32_t * triangle = &(*indices)[adjacency[k] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					removedTriangles++;		// Triangle on the collapsed edge, which disappears
+					continue;
+				}
+
+				glm::vec3 p[3], q[3];
+				for (size_t v = 0; v < 3; v++)
+				{
+					p[v] = vertices[triangle[v]].pos;
+					q[v] = triangle[v] == collapse.from ? newPos : p[v];
+				}
+
+				glm::vec3 oldNormal = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 newNormal = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(oldNormal, newNormal) <= 0.0f;
+			}
+			if (flips)
+			{
+				continue;
+			}
+
+			remap[collapse.from] = collapse.to;
+			(*quadrics)[collapse.to].add((*quadrics)[collapse.from]);
+			resultError = std::max(resultError, collapse.error);
+			trianglesRemoved += removedTriangles;
+			collapseCount++;
+
+			// Everything around the collapse now has stale costs
+			for (uint32_t k = adjacencyOffsets[collapse.from]; k < adjacencyOffsets[collapse.from + 1]; k++)
+			{
+				const uint32_t * triangle = &(*indices)[adjacency[k] * 3];
+				touched[triangle[0]] = true;
+				touched[triangle[1]] = true;
+				touched[triangle[2]] = true;
+			}
+		}
+
+		if (collapseCount == 0)
+		{
+			break;
+		}
+
+		// Rewrite the triangles, dropping those that collapsed to lines
+		size_t writeIndex = 0;
+		for (size_t i = 0; i < indices->size(); i += 3)
+		{
+			uint32_t a = remap[(*indices)[i]];
+			uint32_t b = remap[(*indices)[i + 1]];
+			uint32_t c = remap[(*indices)[i + 2]];
+			if (a != b && b != c && a != c)
+			{
+				(*indices)[writeIndex++] = a;
+				(*indices)[writeIndex++] = b;
+				(*indices)[writeIndex++] = c;
+			}
+		}
+		indices->resize(writeIndex);
+
+		// Vertices merged into a collapse's removed vertex follow it (a pass never collapses a vertex twice)
+		for (uint32_t &to : *collapsedTo)
+		{
+			to = remap[to];
+		}
+	}
+
+	return resultError;
+}
+
+float MeshSimplifier::MeasureDeviation(const std::vector<uint32_t> & lodIndices, const std::vector<Vertex> & vertices,
+	const std::vector<uint32_t> & collapsedTo, const std::vector<bool> & used)
+{
+	size_t vertexCount = vertices.size();
+
+	// Triangles of the LOD using each vertex (offsets into one flat list)
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (uint32_t index : lodIndices)
+	{
+		adjacencyOffsets[index + 1]++;
+	}
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+	}
+
+	std::vector<uint32_t> adjacency(lodIndices.size());
+	std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < lodIndices.size(); i++)
+	{
+		adjacency[adjacencyFill[lodIndices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	// Each collapsed vertex's distance to the surface the LOD now has where it was (the triangles around the vertex
+	// it merged into). Vertices still in the LOD are on its surface
+	float deviation = 0.0f;
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		uint32_t to = collapsedTo[i];
+		if (!used[i] || to == i)
+		{
+			continue;
+		}
+
+		glm::vec3 p = vertices[i].pos;
+		float distance = glm::length(p - vertices[to].pos);
+		for (uint32_t k = adjacencyOffsets[to]; k < adjacencyOffsets[to + 1]; k++)
+		{
+			const uint32_t * triangle = &lodIndices[adjacency[k] * 3];
+			distance = std::min(distance, PointTriangleDistance(p, vertices[triangle[0]].pos, vertices[triangle[1]].pos, vertices[triangle[2]].pos));
+		}
+
+		deviation = std::max(deviation, distance);
+	}
+
+	return deviation;
+}
+
+float MeshSimplifier::PointTriangleDistance(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+	// Closest point on the triangle, by which of its vertex, edge and face regions p is in (Ericson, Real-Time Collision Detection 5.1.5)
+	glm::vec3 ab = b - a;
+	glm::vec3 ac = c - a;
+	glm::vec3 ap = p - a;
+	float d1 = glm::dot(ab, ap);
+	float d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+	{
+		return glm::length(p - a);
+	}
+
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp);
+	float d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+	{
+		return glm::length(p - b);
+	}
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+	{
+		return glm::length(p - (a + ab * (d1 / (d1 - d3))));
+	}
+
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp);
+	float d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+	{
+		return glm::length(p - c);
+	}
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+	{
+		return glm::length(p - (a + ac * (d2 / (d2 - d6))));
+	}
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+	{
+		return glm::length(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+	}
+
+	float denominator = va + vb + vc;
+	if (denominator <= 0.0f)
+	{
+		return glm::length(p - a);		// Degenerate triangle
+	}
+	return glm::length(p - (a + ab * (vb / denominator) + ac * (vc / denominator)));
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "MeshModel.h"
+
+// Most LODs made per mesh (including the full mesh as LOD 0)
+const uint32_t MAX_MESH_LODS = 5;
+
+// Each LOD aims for this fraction of the previous LOD's triangles
+const float LOD_TRIANGLE_RATIO = 0.5f;
+
+// No LOD may be further than this from the full mesh (fraction of the mesh's bounding box diagonal), measured as
+// the furthest any of the full mesh's vertices is from the LOD's triangles around the vertex it collapsed into
+const float LOD_MAX_ERROR = 0.05f;
+
+// Stop making LODs once one can't get below this fraction of the previous LOD's triangles
+const float LOD_MIN_REDUCTION = 0.8f;
+
+// Meshes with fewer triangles than this keep just the full mesh
+const uint32_t LOD_MIN_TRIANGLES = 64;
+
+// Import-time generation of simplified LODs of a triangle list, by edge collapse ordered by quadric error
+// (Garland & Heckbert 1997). Every LOD uses the mesh's own vertices, and is appended to its index list,
+// so all LODs draw from the same vertex/index buffers. Vertices on open edges and UV seams never move,
+// so LODs don't open cracks or tear textures.
+class MeshSimplifier
+{
+public:
+	static void GenerateLods(MeshData * meshData);
+
+private:
+	struct Quadric;
+
+	static std::vector<bool> FindLockedVertices(const std::vector<uint32_t> & indices, size_t vertexCount);
+	static float Simplify(std::vector<uint32_t> * indices, const std::vector<Vertex> & vertices, const std::vector<bool> & locked,
+		std::vector<Quadric> * quadrics, std::vector<uint32_t> * collapsedTo, size_t targetIndexCount, float maxError);
+	static float MeasureDeviation(const std::vector<uint32_t> & lodIndices, const std::vector<Vertex> & vertices,
+		const std::vector<uint32_t> & collapsedTo, const std::vector<bool> & used);
+	static float PointTriangleDistance(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c);
+};
@@ -0,0 +1,136 @@
+#include "MeshletBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+
+void MeshletBuilder::BuildMeshlets(MeshData * meshData)
+{
+	meshData->meshlets.clear();
+
+	uint32_t indexCount = meshData->lods.empty() ? static_cast<uint32_t>(meshData->indices.size()) : meshData->lods[0].indexCount;
+	if (indexCount < MESHLET_MIN_TRIANGLES * 3)
+	{
+		return;
+	}
+
+	// Grow each meshlet until the next triangle would take it over its vertex or triangle limit
+	std::vector<uint32_t> vertexMeshlet(meshData->vertices.size(), UINT32_MAX);	// Last meshlet each vertex was counted in
+	uint32_t meshletStart = 0;
+	uint32_t meshletVertices = 0;
+
+	for (uint32_t i = 0; i < indexCount; i += 3)
+	{
+		uint32_t meshletId = static_cast<uint32_t>(meshData->meshlets.size());
+
+		uint32_t newVertices = 0;
+		for (uint32_t j = 0; j < 3; j++)
+		{
+			newVertices += vertexMeshlet[meshData->indices[i + j]] != meshletId ? 1 : 0;
+		}
+
+		if (meshletVertices + newVertices > MAX_MESHLET_VERTICES || (i - meshletStart) / 3 >= MAX_MESHLET_TRIANGLES)
+		{
+			meshData->meshlets.push_back(MakeMeshlet(*meshData, meshletStart, i - meshletStart));
+			meshletId++;
+			meshletStart = i;
+			meshletVertices = 0;
+		}
+
+		for (uint32_t j = 0; j < 3; j++)
+		{
+			uint32_t index = meshData->indices[i + j];
+			if (vertexMeshlet[index] != meshletId)
+			{
+				vertexMeshlet[index] = meshletId;
+				meshletVertices++;
+			}
+		}
+	}
+
+	meshData->meshlets.push_back(MakeMeshlet(*meshData, meshletStart, indexCount - meshletStart));
+}
+
+Meshlet MeshletBuilder::MakeMeshlet(const MeshData & meshData, uint32_t indexOffset, uint32_t indexCount)
+{
+	const std::vector<Vertex> &vertices = meshData.vertices;
+	const uint32_t * indices = &meshData.indices[indexOffset];
+
+	Meshlet meshlet = {};
+	meshlet.indexOffset = indexOffset;
+	meshlet.indexCount = indexCount;
+
+	// Bounding sphere (Ritter): start across two far apart points, then grow to take in any point outside
+	glm::vec3 first = vertices[indices[0]].pos;
+	glm::vec3 second = first;
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		glm::vec3 pos = vertices[indices[i]].pos;
+		if (glm::length(pos - first) > glm::length(second - first))
+		{
+			second = pos;
+		}
+	}
+	glm::vec3 third = second;
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		glm::vec3 pos = vertices[indices[i]].pos;
+		if (glm::length(pos - second) > glm::length(third - second))
+		{
+			third = pos;
+		}
+	}
+
+	glm::vec3 centre = (second + third) * 0.5f;
+	float radius = glm::length(third - second) * 0.5f;
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		glm::vec3 pos = vertices[indices[i]].pos;
+		float distance = glm::length(pos - centre);
+		if (distance > radius)
+		{
+			float newRadius = (radius + distance) * 0.5f;
+			centre += (pos - centre) * ((newRadius - radius) / distance);
+			radius = newRadius;
+		}
+	}
+	meshlet.sphere = glm::vec4(centre, radius);
+
+	// Normal cone: average the triangle normals, then find how far the furthest one strays from the average
+	std::vector<glm::vec3> normals;
+	normals.reserve(indexCount / 3);
+	glm::vec3 axis(0.0f);
+	for (uint32_t i = 0; i < indexCount; i += 3)
+	{
+		glm::vec3 p0 = vertices[indices[i]].pos;
+		glm::vec3 normal = glm::cross(vertices[indices[i + 1]].pos - p0, vertices[indices[i + 2]].pos - p0);
+		float area = glm::length(normal);
+		if (area > 0.0f)
+		{
+			normals.push_back(normal / area);
+			axis += normal;
+		}
+	}
+
+	float axisLength = glm::length(axis);
+	float minCosine = 1.0f;
+	if (axisLength > 0.0f)
+	{
+		axis /= axisLength;
+		for (const auto &normal : normals)
+		{
+			minCosine = std::min(minCosine, glm::dot(normal, axis));
+		}
+	}
+
+	// Viewed from within the cutoff of the axis, every triangle faces away (cutoff of 1 never culls)
+	if (axisLength <= 0.0f || minCosine <= MESHLET_MIN_CONE_COSINE)
+	{
+		meshlet.cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	}
+	else
+	{
+		meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - minCosine * minCosine));
+	}
+
+	return meshlet;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "MeshModel.h"
+
+// Most vertices and triangles in one meshlet (sizes commonly used for mesh shading, so culled clusters stay small)
+const uint32_t MAX_MESHLET_VERTICES = 64;
+const uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+// Meshes with fewer triangles than this are drawn whole (culling costs more than it saves)
+const uint32_t MESHLET_MIN_TRIANGLES = 256;
+
+// Normal cones wider than this (smallest cosine between a triangle normal and the axis) are never back facing as a whole
+const float MESHLET_MIN_CONE_COSINE = 0.1f;
+
+// Import-time split of a mesh's full detail triangles into meshlets, each with a bounding sphere and normal cone
+// for frustum and back-face culling. Meshlets are runs of consecutive triangles, so the index list stays as it is
+// (after vertex cache optimisation, consecutive triangles are already close together).
+class MeshletBuilder
+{
+public:
+	static void BuildMeshlets(MeshData * meshData);
+
+private:
+	static Meshlet MakeMeshlet(const MeshData & meshData, uint32_t indexOffset, uint32_t indexCount);
+};
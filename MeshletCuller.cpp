@@ -0,0 +1,241 @@
+#include "MeshletCuller.h"
+
+#include <stdexcept>
+#include <array>
+#include <algorithm>
+
+#include "Utilities.h"
+
+MeshletCuller::MeshletCuller()
+{
+}
+
+void MeshletCuller::create(VkDevice newDevice, const std::vector<VkBuffer> & newViewProjectionBuffers, VkDeviceSize newViewProjectionSize)
+{
+	device = newDevice;
+	viewProjectionBuffers = newViewProjectionBuffers;
+	viewProjectionSize = newViewProjectionSize;
+
+	// DESCRIPTOR SET LAYOUT
+	// 0: ViewProjection, 1: meshlets, 2: mesh's indices, 3: draw command, 4: surviving indices
+	std::array<VkDescriptorSetLayoutBinding, 5> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &setLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Descriptor Set Layout!");
+	}
+
+	// DESCRIPTOR POOL
+	// A set per culled mesh per swapchain image (freed when the mesh is destroyed)
+	uint32_t maxSets = MAX_MESHLET_CULLED_MESHES * static_cast<uint32_t>(viewProjectionBuffers.size());
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = maxSets;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = maxSets * 4;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	poolCreateInfo.maxSets = maxSets;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Descriptor Pool!");
+	}
+
+	// PIPELINE
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(MeshletCullPush);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &setLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Pipeline Layout!");
+	}
+
+	std::vector<char> shaderCode = readFile("Shaders/meshlet_cull.spv");
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = shaderCode.size();
+	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t *>(shaderCode.data());
+
+	VkShaderModule shaderModule;
+	result = vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+
+	// Module is no longer needed once the pipeline has been made
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Compute Pipeline!");
+	}
+}
+
+bool MeshletCuller::createMeshCulling(Mesh * mesh)
+{
+	// Mesh needs its culled index buffers and its geometry's meshlet buffer already (see Mesh::createCulledIndexBuffers)
+	uint32_t imageCount = static_cast<uint32_t>(viewProjectionBuffers.size());
+	std::vector<VkDescriptorSetLayout> setLayouts(imageCount, setLayout);
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = descriptorPool;
+	setAllocInfo.descriptorSetCount = imageCount;
+	setAllocInfo.pSetLayouts = setLayouts.data();
+
+	// Out of sets just means this mesh is drawn whole
+	std::vector<VkDescriptorSet> sets(imageCount);
+	if (vkAllocateDescriptorSets(device, &setAllocInfo, sets.data()) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		std::array<VkDescriptorBufferInfo, 5> bufferInfos = {};
+		bufferInfos[0] = { viewProjectionBuffers[i], 0, viewProjectionSize };
+		bufferInfos[1] = { mesh->getMeshletBuffer(), 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { mesh->getIndexBuffer(), mesh->getGeometry()->getIndexBufferOffset(), mesh->getGeometry()->getIndexBufferSize() };
+		bufferInfos[3] = { mesh->getCulledIndexBuffer(i), 0, sizeof(VkDrawIndexedIndirectCommand) };
+		bufferInfos[4] = { mesh->getCulledIndexBuffer(i), MESHLET_CULL_HEADER_SIZE, VK_WHOLE_SIZE };
+
+		std::array<VkWriteDescriptorSet, 5> writes = {};
+		for (uint32_t j = 0; j < writes.size(); j++)
+		{
+			writes[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[j].dstSet = sets[i];
+			writes[j].dstBinding = j;
+			writes[j].dstArrayElement = 0;
+			writes[j].descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[j].descriptorCount = 1;
+			writes[j].pBufferInfo = &bufferInfos[j];
+		}
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	}
+
+	mesh->setMeshletCullSets(sets);
+	return true;
+}
+
+void MeshletCuller::destroyMeshCulling(Mesh * mesh)
+{
+	const std::vector<VkDescriptorSet> &sets = mesh->getMeshletCullSets();
+	if (sets.empty())
+	{
+		return;
+	}
+
+	vkFreeDescriptorSets(device, descriptorPool, static_cast<uint32_t>(sets.size()), sets.data());
+	mesh->setMeshletCullSets({});
+}
+
+void MeshletCuller::recordCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex, const std::vector<MeshletCullDraw> & draws)
+{
+	// Last time this image's command buffer ran, the culled buffers were written and then drawn from
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	// Start each draw with no indices, one instance (culled indices are the mesh's own, so still offset to its vertices)
+	VkDrawIndexedIndirectCommand emptyDraw = {};
+	emptyDraw.instanceCount = 1;
+	for (const auto &draw : draws)
+	{
+		emptyDraw.vertexOffset = draw.mesh->getVertexOffset();
+		emptyDraw.firstInstance = draw.firstInstance;
+		vkCmdUpdateBuffer(commandBuffer, draw.mesh->getCulledIndexBuffer(imageIndex), 0, sizeof(emptyDraw), &emptyDraw);
+	}
+
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	// A workgroup per meshlet (in rows, as dispatches are limited in each dimension)
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	for (const auto &draw : draws)
+	{
+		MeshletCullPush push = {};
+		push.model = draw.model;
+		push.meshletCount = draw.mesh->getMeshletCount();
+		push.shortIndices = draw.mesh->getIndexType() == VK_INDEX_TYPE_UINT16 ? 1 : 0;
+		push.groupsPerRow = std::min(push.meshletCount, MAX_DISPATCH_GROUPS);
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout,
+			0, 1, &draw.mesh->getMeshletCullSets()[imageIndex], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+		vkCmdDispatch(commandBuffer, push.groupsPerRow, (push.meshletCount + push.groupsPerRow - 1) / push.groupsPerRow, 1);
+	}
+
+	// Surviving indices and counts are read by the draws
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+		1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void MeshletCuller::destroy()
+{
+	if (device == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+	device = VK_NULL_HANDLE;
+}
+
+MeshletCuller::~MeshletCuller()
+{
+}
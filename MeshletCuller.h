@@ -0,0 +1,61 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Mesh.h"
+
+// Most meshes that can have meshlet culling at once (others are drawn whole)
+const uint32_t MAX_MESHLET_CULLED_MESHES = 1024;
+
+// Threads per meshlet in Shaders/meshlet_cull.comp (local_size_x)
+const uint32_t MESHLET_CULL_GROUP_SIZE = 64;
+
+// A mesh to cull this frame, and where it is
+struct MeshletCullDraw {
+	Mesh * mesh;
+	glm::mat4 model;
+	uint32_t firstInstance;		// Its instance in this frame's instance buffer (drawn with it as firstInstance)
+};
+
+// GPU culling of meshes' meshlets, in a compute pass before the render pass (works without mesh shaders).
+// One workgroup per meshlet tests it against the view frustum and its normal cone, and copies the indices
+// of each meshlet that survives into the mesh's culled index buffer for this swapchain image, counting them
+// into the VkDrawIndexedIndirectCommand at its start. The mesh is then drawn with one indirect draw.
+class MeshletCuller
+{
+public:
+	MeshletCuller();
+
+	void create(VkDevice newDevice, const std::vector<VkBuffer> & newViewProjectionBuffers, VkDeviceSize newViewProjectionSize);
+
+	bool createMeshCulling(Mesh * mesh);
+	void destroyMeshCulling(Mesh * mesh);
+
+	void recordCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex, const std::vector<MeshletCullDraw> & draws);
+
+	void destroy();
+
+	~MeshletCuller();
+
+private:
+	// Push constant of meshlet_cull.comp
+	struct MeshletCullPush {
+		glm::mat4 model;
+		uint32_t meshletCount;
+		uint32_t shortIndices;			// Source indices are 16 bit
+		uint32_t groupsPerRow;			// Workgroups in x of the dispatch (meshlet = y * groupsPerRow + x)
+		uint32_t padding;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::vector<VkBuffer> viewProjectionBuffers;	// Per swapchain image
+	VkDeviceSize viewProjectionSize = 0;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+};
@@ -0,0 +1,14 @@
+@echo off
+rem Compiles the GLSL shaders to the SPIR-V files the renderer loads (needs the Vulkan SDK)
+rem Run as a pre-build step of the project, so the .spv files always match the shader sources
+cd /d "%~dp0"
+
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V shader.vert -o vert.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V shader.frag -o frag.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V shader_bindless.frag -o frag_bindless.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V meshlet_cull.comp -o meshlet_cull.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V draw_cull.comp -o draw_cull.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V -DOCCLUSION_CULLING draw_cull.comp -o draw_cull_occlusion.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V shader_indirect.vert -o vert_indirect.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V shader_indirect.frag -o frag_indirect.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V hiz_reduce.comp -o hiz_reduce.spv || exit /b 1
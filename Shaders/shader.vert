@@ -1,8 +1,8 @@
 #version 450 		// Use GLSL 4.5
 
-layout(location = 0) in vec3 pos;
-layout(location = 1) in vec3 col;
-layout(location = 2) in vec2 tex;
+layout(location = 0) in vec3 pos;		// 0-1 across mesh bounds (UNORM16)
+layout(location = 1) in vec2 tex;		// 0-1 across mesh UV range (UNORM16)
+layout(location = 2) in mat4 instanceModel;	// Per instance: where this copy of the model is (locations 2-5)
 
 layout(set = 0, binding = 0) uniform UboViewProjection {
 	mat4 projection;
@@ -15,15 +15,16 @@ layout(set = 0, binding = 1) uniform UboModel {
 } uboModel;
 
 layout(push_constant) uniform PushModel {
-	mat4 model;
+	mat4 model;					// Mesh's node within the model, including its position dequantisation
+	vec4 texTransform;			// UV dequantisation (xy = offset, zw = scale)
 } pushModel;
 
 layout(location = 0) out vec3 fragCol;
 layout(location = 1) out vec2 fragTex;
 
 void main() {
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.0);
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * instanceModel * pushModel.model * vec4(pos, 1.0);
 	
-	fragCol = col;
-	fragTex = tex;
+	fragCol = vec3(1.0);
+	fragTex = pushModel.texTransform.xy + tex * pushModel.texTransform.zw;
 }
\ No newline at end of file
@@ -0,0 +1,19 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require	// Needed for unsized (runtime) descriptor arrays
+
+layout(location = 0) in vec3 fragCol;
+layout(location = 1) in vec2 fragTex;
+
+// Every texture, indexed by texture id (only the entries in use are valid)
+layout(set = 1, binding = 0) uniform sampler2D textureSamplers[];
+
+// Texture of this draw (follows the model matrix and texture transform pushed to the vertex shader)
+layout(push_constant) uniform PushTexture {
+	layout(offset = 80) uint textureId;
+} pushTexture;
+
+layout(location = 0) out vec4 outColour; 	// Final output colour (must also have location
+
+void main() {
+	outColour = texture(textureSamplers[pushTexture.textureId], fragTex);
+}
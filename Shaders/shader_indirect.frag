@@ -0,0 +1,15 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require	// Needed for unsized (runtime) descriptor arrays
+
+layout(location = 0) in vec3 fragCol;
+layout(location = 1) in vec2 fragTex;
+layout(location = 2) flat in uint fragTextureId;		// Texture of the draw (from its draw record, see shader_indirect.vert)
+
+// Every texture, indexed by texture id (only the entries in use are valid)
+layout(set = 1, binding = 0) uniform sampler2D textureSamplers[];
+
+layout(location = 0) out vec4 outColour; 	// Final output colour (must also have location
+
+void main() {
+	outColour = texture(textureSamplers[fragTextureId], fragTex);
+}
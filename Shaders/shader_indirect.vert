@@ -0,0 +1,42 @@
+#version 450 		// Use GLSL 4.5
+
+layout(location = 0) in vec3 pos;		// 0-1 across mesh bounds (UNORM16)
+layout(location = 1) in vec2 tex;		// 0-1 across mesh UV range (UNORM16)
+
+layout(set = 0, binding = 0) uniform UboViewProjection {
+	mat4 projection;
+	mat4 view;
+} uboViewProjection;
+
+// Every draw of the scene (see DrawCuller), this one is found through firstInstance
+struct Draw {
+	mat4 model;					// Instance, mesh's node and position dequantisation in one
+	vec4 texTransform;			// UV dequantisation (xy = offset, zw = scale)
+	vec4 sphere;
+	uint lodOffset;
+	uint lodCount;
+	uint batch;
+	uint textureId;
+	float lodScale;
+	uint firstCommand;
+	uint padding0;
+	uint padding1;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Draws {
+	Draw draws[];
+};
+
+layout(location = 0) out vec3 fragCol;
+layout(location = 1) out vec2 fragTex;
+layout(location = 2) flat out uint fragTextureId;
+
+void main() {
+	Draw draw = draws[gl_InstanceIndex];
+
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * draw.model * vec4(pos, 1.0);
+
+	fragCol = vec3(1.0);
+	fragTex = draw.texTransform.xy + tex * draw.texTransform.zw;
+	fragTextureId = draw.textureId;
+}
@@ -0,0 +1,546 @@
+#include "StagingRing.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+
+#include "Utilities.h"
+
+// Offset alignment of every chunk in the ring (covers texel size and the 4 byte rule for buffer to image copies)
+const VkDeviceSize STAGING_RING_ALIGNMENT = 16;
+
+StagingRing::StagingRing()
+{
+}
+
+void StagingRing::create(DeviceAllocator * newAllocator, VkDevice newDevice,
+	VkQueue newTransferQueue, VkCommandPool newTransferCommandPool, uint32_t newTransferFamily,
+	VkQueue newGraphicsQueue, VkCommandPool newGraphicsCommandPool, uint32_t newGraphicsFamily,
+	VkExtent3D newImageTransferGranularity, VkDeviceSize newRingSize)
+{
+	allocator = newAllocator;
+	device = newDevice;
+	transferQueue = newTransferQueue;
+	transferCommandPool = newTransferCommandPool;
+	transferFamily = newTransferFamily;
+	graphicsQueue = newGraphicsQueue;
+	graphicsCommandPool = newGraphicsCommandPool;
+	graphicsFamily = newGraphicsFamily;
+	imageTransferGranularity = newImageTransferGranularity;
+	ringSize = newRingSize;
+
+	// Single staging buffer for the lifetime of the renderer, mapped once by the allocator
+	createBuffer(allocator, device, ringSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&ringBuffer, &ringBufferMemory);
+}
+
+VkCommandBuffer StagingRing::getCommandBuffer()
+{
+	// Start a new command buffer if the last one has been submitted
+	if (currentCommandBuffer == VK_NULL_HANDLE)
+	{
+		currentCommandBuffer = beginCommandBuffer(device, transferCommandPool);
+	}
+
+	return currentCommandBuffer;
+}
+
+void StagingRing::uploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void * data, VkDeviceSize size, bool concurrent)
+{
+	const char * srcData = static_cast<const char *>(data);
+	PendingBufferRelease release = { dstBuffer, dstOffset, size };
+
+	// Never take more than half the ring at once, so the next chunk can be filled while the last is copied
+	VkDeviceSize maxChunkSize = ringSize / 2;
+
+	while (size > 0)
+	{
+		VkDeviceSize chunkSize = std::min(size, maxChunkSize);
+		VkDeviceSize ringOffset = reserve(chunkSize, STAGING_RING_ALIGNMENT);
+
+		// Copy chunk into ring (already mapped, so no map/unmap)
+		memcpy(static_cast<char *>(ringBufferMemory.mapped) + ringOffset, srcData, static_cast<size_t>(chunkSize));
+
+		// Region of data to copy from and to
+		VkBufferCopy bufferCopyRegion = {};
+		bufferCopyRegion.srcOffset = ringOffset;
+		bufferCopyRegion.dstOffset = dstOffset;
+		bufferCopyRegion.size = chunkSize;
+
+		vkCmdCopyBuffer(getCommandBuffer(), ringBuffer, dstBuffer, 1, &bufferCopyRegion);
+
+		srcData += chunkSize;
+		dstOffset += chunkSize;
+		size -= chunkSize;
+	}
+
+	// Range is complete, so it can be handed to the graphics queue with the next submit (a concurrent buffer is only
+	// made visible to it, by the semaphore the graphics queue waits on)
+	if (transferFamily != graphicsFamily && !concurrent)
+	{
+		pendingBufferReleases.push_back(release);
+	}
+}
+
+void StagingRing::uploadToImage(VkImage dstImage, uint32_t width, uint32_t height, VkFormat format, const void * data, uint32_t mipLevel)
+{
+	const char * srcData = static_cast<const char *>(data);
+
+	// Data is laid out in rows of texel blocks (rows of single texels for uncompressed formats)
+	uint32_t blockWidth, blockHeight, blockSize;
+	if (!getFormatBlockInfo(format, &blockWidth, &blockHeight, &blockSize))
+	{
+		throw std::runtime_error("Unsupported image format for the Staging Ring!");
+	}
+	uint32_t blocksWide = (width + blockWidth - 1) / blockWidth;
+	uint32_t blockRows = (height + blockHeight - 1) / blockHeight;
+
+	// Images are split on whole block rows, so each chunk is still a valid rectangle of the image
+	VkDeviceSize rowSize = static_cast<VkDeviceSize>(blocksWide) * blockSize;
+	if (rowSize > ringSize / 2)
+	{
+		throw std::runtime_error("Image row is too large for the Staging Ring!");
+	}
+	uint32_t maxChunkRows = static_cast<uint32_t>((ringSize / 2) / rowSize);
+
+	// Transfer queues may only copy image regions in multiples of their granularity (counted in blocks for compressed formats)
+	if (imageTransferGranularity.height == 0)
+	{
+		maxChunkRows = blockRows;		// Whole image in one go
+	}
+	else if (maxChunkRows > imageTransferGranularity.height)
+	{
+		maxChunkRows -= maxChunkRows % imageTransferGranularity.height;
+	}
+
+	uint32_t row = 0;
+	while (row < blockRows)
+	{
+		uint32_t chunkRows = std::min(blockRows - row, maxChunkRows);
+		VkDeviceSize chunkSize = rowSize * chunkRows;
+		VkDeviceSize ringOffset = reserve(chunkSize, STAGING_RING_ALIGNMENT);		// Alignment is a multiple of every block size
+
+		memcpy(static_cast<char *>(ringBufferMemory.mapped) + ringOffset, srcData, static_cast<size_t>(chunkSize));
+
+		// Last chunk may end part way through a block, at the edge of the image
+		uint32_t firstTexelRow = row * blockHeight;
+		uint32_t chunkTexelRows = std::min(chunkRows * blockHeight, height - firstTexelRow);
+
+		VkBufferImageCopy imageRegion = {};
+		imageRegion.bufferOffset = ringOffset;									// Offset into ring
+		imageRegion.bufferRowLength = 0;										// Rows are tightly packed
+		imageRegion.bufferImageHeight = 0;
+		imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageRegion.imageSubresource.mipLevel = mipLevel;
+		imageRegion.imageSubresource.baseArrayLayer = 0;
+		imageRegion.imageSubresource.layerCount = 1;
+		imageRegion.imageOffset = { 0, static_cast<int32_t>(firstTexelRow), 0 };	// Start at first row of this chunk
+		imageRegion.imageExtent = { width, chunkTexelRows, 1 };
+
+		// Image must already be in TRANSFER_DST_OPTIMAL layout (recorded earlier in submission order)
+		vkCmdCopyBufferToImage(getCommandBuffer(), ringBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion);
+
+		srcData += chunkSize;
+		row += chunkRows;
+	}
+}
+
+void StagingRing::releaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+{
+	// Same queue family: just transition the image in the current command buffer
+	if (transferFamily == graphicsFamily)
+	{
+		recordImageLayoutTransition(getCommandBuffer(), image, oldLayout, newLayout, mipLevels);
+		return;
+	}
+
+	// Otherwise transition happens as part of the ownership transfer on submit
+	VkImageMemoryBarrier imageMemoryBarrier = {};
+	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageMemoryBarrier.oldLayout = oldLayout;
+	imageMemoryBarrier.newLayout = newLayout;
+	imageMemoryBarrier.srcQueueFamilyIndex = transferFamily;				// Queue family releasing the image
+	imageMemoryBarrier.dstQueueFamilyIndex = graphicsFamily;				// Queue family acquiring the image
+	imageMemoryBarrier.image = image;
+	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+	imageMemoryBarrier.subresourceRange.levelCount = mipLevels;
+	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+	imageMemoryBarrier.subresourceRange.layerCount = 1;
+
+	pendingImageReleases.push_back(imageMemoryBarrier);
+}
+
+void StagingRing::generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	// Level 0 is uploaded and every level is in TRANSFER_DST_OPTIMAL. Blits need a graphics queue
+	if (transferFamily == graphicsFamily)
+	{
+		recordGenerateMipmaps(getCommandBuffer(), image, width, height, mipLevels);
+		return;
+	}
+
+	// Hand the image over still in TRANSFER_DST_OPTIMAL, and blit after it is acquired on the graphics queue
+	releaseImage(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+
+	PendingMipmapGeneration mipmapGeneration = {};
+	mipmapGeneration.image = image;
+	mipmapGeneration.width = width;
+	mipmapGeneration.height = height;
+	mipmapGeneration.mipLevels = mipLevels;
+	pendingMipmapGenerations.push_back(mipmapGeneration);
+}
+
+uint64_t StagingRing::submit()
+{
+	// Nothing recorded since last submit, so everything so far is covered by the last submit
+	if (currentCommandBuffer == VK_NULL_HANDLE)
+	{
+		return submitCount;
+	}
+
+	VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+
+	if (transferFamily == graphicsFamily)
+	{
+		// Make the transfer writes available to any later reads on this queue (vertex/index fetch and shader reads)
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(currentCommandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+	else
+	{
+		// Release everything written on the transfer queue, and acquire it on the graphics queue
+		acquireCommandBuffer = beginCommandBuffer(device, graphicsCommandPool);
+		recordOwnershipTransfer(acquireCommandBuffer);
+		vkEndCommandBuffer(acquireCommandBuffer);
+
+		if (!freeSemaphores.empty())
+		{
+			semaphore = freeSemaphores.back();
+			freeSemaphores.pop_back();
+		}
+		else
+		{
+			VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+			semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+			VkResult result = vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphore);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create a Staging Ring Semaphore!");
+			}
+		}
+	}
+
+	vkEndCommandBuffer(currentCommandBuffer);
+
+	// Re-use a fence from a finished submit if possible
+	VkFence fence;
+	if (!freeFences.empty())
+	{
+		fence = freeFences.back();
+		freeFences.pop_back();
+	}
+	else
+	{
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		VkResult result = vkCreateFence(device, &fenceCreateInfo, nullptr, &fence);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a Staging Ring Fence!");
+		}
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &currentCommandBuffer;
+
+	// Submit without waiting, fence (on the last submit) tells us when the ring space can be re-used
+	if (acquireCommandBuffer == VK_NULL_HANDLE)
+	{
+		VkResult result = vkQueueSubmit(transferQueue, 1, &submitInfo, fence);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit Staging Ring Command Buffer!");
+		}
+	}
+	else
+	{
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+
+		VkResult result = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit Staging Ring Command Buffer!");
+		}
+
+		// Graphics queue waits for the copies, then acquires ownership
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+		VkSubmitInfo acquireSubmitInfo = {};
+		acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireSubmitInfo.waitSemaphoreCount = 1;
+		acquireSubmitInfo.pWaitSemaphores = &semaphore;
+		acquireSubmitInfo.pWaitDstStageMask = &waitStage;
+		acquireSubmitInfo.commandBufferCount = 1;
+		acquireSubmitInfo.pCommandBuffers = &acquireCommandBuffer;
+
+		result = vkQueueSubmit(graphicsQueue, 1, &acquireSubmitInfo, fence);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit Staging Ring Acquire Command Buffer!");
+		}
+	}
+
+	InFlightSubmit inFlightSubmit = {};
+	inFlightSubmit.submitId = ++submitCount;
+	inFlightSubmit.fence = fence;
+	inFlightSubmit.semaphore = semaphore;
+	inFlightSubmit.commandBuffer = currentCommandBuffer;
+	inFlightSubmit.acquireCommandBuffer = acquireCommandBuffer;
+	inFlightSubmit.head = head;
+	inFlightSubmit.totalAllocated = totalAllocated;
+	inFlight.push_back(inFlightSubmit);
+
+	currentCommandBuffer = VK_NULL_HANDLE;
+
+	return submitCount;
+}
+
+bool StagingRing::isSubmitComplete(uint64_t submitId)
+{
+	// Poll fences without blocking
+	reclaim(false);
+
+	return submitId <= completedSubmitCount;
+}
+
+void StagingRing::waitForSubmit(uint64_t submitId)
+{
+	while (completedSubmitCount < submitId && !inFlight.empty())
+	{
+		reclaim(true);
+	}
+}
+
+void StagingRing::waitIdle()
+{
+	submit();
+
+	while (!inFlight.empty())
+	{
+		reclaim(true);
+	}
+}
+
+void StagingRing::destroy()
+{
+	waitIdle();
+
+	for (VkFence fence : freeFences)
+	{
+		vkDestroyFence(device, fence, nullptr);
+	}
+	freeFences.clear();
+
+	for (VkSemaphore semaphore : freeSemaphores)
+	{
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+	freeSemaphores.clear();
+
+	vkDestroyBuffer(device, ringBuffer, nullptr);
+	allocator->free(ringBufferMemory);
+}
+
+StagingRing::~StagingRing()
+{
+}
+
+bool StagingRing::tryReserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * offset)
+{
+	VkDeviceSize usedSize = totalAllocated - totalReleased;
+
+	// Empty ring can always start again from the beginning
+	if (usedSize == 0)
+	{
+		head = 0;
+		tail = 0;
+	}
+
+	VkDeviceSize alignedHead = (head + alignment - 1) / alignment * alignment;
+
+	if (usedSize == 0 || head > tail)
+	{
+		// Free space is [head, end of ring) followed by [0, tail)
+		if (alignedHead + size <= ringSize)
+		{
+			totalAllocated += alignedHead + size - head;
+			*offset = alignedHead;
+			head = alignedHead + size;
+			return true;
+		}
+
+		// Not enough room before the end, so wrap (space left at the end is wasted until reclaimed)
+		if (size <= tail)
+		{
+			totalAllocated += (ringSize - head) + size;
+			*offset = 0;
+			head = size;
+			return true;
+		}
+
+		return false;
+	}
+
+	// Head has wrapped behind tail: free space is [head, tail) (head == tail means full)
+	if (alignedHead + size <= tail)
+	{
+		totalAllocated += alignedHead + size - head;
+		*offset = alignedHead;
+		head = alignedHead + size;
+		return true;
+	}
+
+	return false;
+}
+
+VkDeviceSize StagingRing::reserve(VkDeviceSize size, VkDeviceSize alignment)
+{
+	if (size > ringSize)
+	{
+		throw std::runtime_error("Staging Ring reservation is larger than the ring!");
+	}
+
+	// Pick up any space freed by finished submits
+	reclaim(false);
+
+	VkDeviceSize offset;
+	while (!tryReserve(size, alignment, &offset))
+	{
+		if (currentCommandBuffer != VK_NULL_HANDLE)
+		{
+			// Space we need is held by copies not yet submitted, so send them to the GPU first
+			submit();
+		}
+		else
+		{
+			// Wait for the oldest submit to finish and take its space back
+			reclaim(true);
+		}
+	}
+
+	return offset;
+}
+
+void StagingRing::reclaim(bool waitForOldest)
+{
+	if (waitForOldest && !inFlight.empty())
+	{
+		vkWaitForFences(device, 1, &inFlight.front().fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+
+	// Submits finish in order, so release from the front until one is still running
+	while (!inFlight.empty() && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS)
+	{
+		InFlightSubmit &finished = inFlight.front();
+
+		tail = finished.head;
+		totalReleased = finished.totalAllocated;
+		completedSubmitCount = finished.submitId;
+
+		vkFreeCommandBuffers(device, transferCommandPool, 1, &finished.commandBuffer);
+		vkResetFences(device, 1, &finished.fence);
+		freeFences.push_back(finished.fence);
+
+		if (finished.acquireCommandBuffer != VK_NULL_HANDLE)
+		{
+			vkFreeCommandBuffers(device, graphicsCommandPool, 1, &finished.acquireCommandBuffer);
+			freeSemaphores.push_back(finished.semaphore);
+		}
+
+		inFlight.pop_front();
+	}
+}
+
+void StagingRing::recordOwnershipTransfer(VkCommandBuffer acquireCommandBuffer)
+{
+	// Release and acquire barriers must match exactly, apart from access masks
+	std::vector<VkBufferMemoryBarrier> bufferBarriers(pendingBufferReleases.size());
+	for (size_t i = 0; i < pendingBufferReleases.size(); i++)
+	{
+		bufferBarriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		bufferBarriers[i].srcQueueFamilyIndex = transferFamily;
+		bufferBarriers[i].dstQueueFamilyIndex = graphicsFamily;
+		bufferBarriers[i].buffer = pendingBufferReleases[i].buffer;
+		bufferBarriers[i].offset = pendingBufferReleases[i].offset;
+		bufferBarriers[i].size = pendingBufferReleases[i].size;
+	}
+	std::vector<VkImageMemoryBarrier> imageBarriers = pendingImageReleases;
+
+	// RELEASE: make transfer writes available, and give up ownership (dst side ignored by the transfer queue)
+	for (auto &barrier : bufferBarriers)
+	{
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+	}
+	for (auto &barrier : imageBarriers)
+	{
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+	}
+
+	vkCmdPipelineBarrier(currentCommandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+		0, nullptr,
+		static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+		static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+	// ACQUIRE: take ownership on the graphics queue and make the data visible to vertex/index fetch and shaders (including meshlet culling)
+	for (auto &barrier : bufferBarriers)
+	{
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	}
+	for (auto &barrier : imageBarriers)
+	{
+		barrier.srcAccessMask = 0;
+
+		// Images still in TRANSFER_DST_OPTIMAL are about to have their mip chain blitted
+		barrier.dstAccessMask = barrier.newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+			? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+			: VK_ACCESS_SHADER_READ_BIT;
+	}
+
+	vkCmdPipelineBarrier(acquireCommandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		0, nullptr,
+		static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+		static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+	// Now graphics queue owns the images, their mip chains can be generated
+	for (const auto &mipmapGeneration : pendingMipmapGenerations)
+	{
+		recordGenerateMipmaps(acquireCommandBuffer, mipmapGeneration.image,
+			mipmapGeneration.width, mipmapGeneration.height, mipmapGeneration.mipLevels);
+	}
+
+	pendingBufferReleases.clear();
+	pendingImageReleases.clear();
+	pendingMipmapGenerations.clear();
+}
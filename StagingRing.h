@@ -0,0 +1,110 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <deque>
+
+#include "DeviceAllocator.h"
+
+// Size of the persistently mapped staging buffer every upload goes through
+const VkDeviceSize STAGING_RING_SIZE = 32 * 1024 * 1024;
+
+// One long-lived, persistently mapped HOST_VISIBLE staging buffer used as a ring.
+// Data is copied into the ring and copy commands are recorded into the ring's current command buffer.
+// Each submission is tracked by a fence, and the part of the ring it used is reclaimed once that fence signals.
+// Uploads larger than the free space are split into chunks, submitting and reclaiming as the ring wraps.
+// Submissions are numbered in order, so callers (see UploadBatch) can poll or wait on a submit id.
+// Copies run on the transfer queue. If that is a different family to graphics, uploaded buffers and images are
+// released by the transfer queue and acquired by a small graphics queue command buffer that waits on a semaphore.
+class StagingRing
+{
+public:
+	StagingRing();
+
+	void create(DeviceAllocator * newAllocator, VkDevice newDevice,
+		VkQueue newTransferQueue, VkCommandPool newTransferCommandPool, uint32_t newTransferFamily,
+		VkQueue newGraphicsQueue, VkCommandPool newGraphicsCommandPool, uint32_t newGraphicsFamily,
+		VkExtent3D newImageTransferGranularity, VkDeviceSize newRingSize = STAGING_RING_SIZE);
+
+	VkCommandBuffer getCommandBuffer();
+
+	void uploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void * data, VkDeviceSize size, bool concurrent = false);
+	void uploadToImage(VkImage dstImage, uint32_t width, uint32_t height, VkFormat format, const void * data, uint32_t mipLevel = 0);
+	void releaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
+	void generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+	uint64_t submit();
+	bool isSubmitComplete(uint64_t submitId);
+	void waitForSubmit(uint64_t submitId);
+	void waitIdle();
+
+	void destroy();
+
+	~StagingRing();
+
+private:
+	// A submitted command buffer and how far into the ring it had allocated
+	struct InFlightSubmit {
+		uint64_t submitId;
+		VkFence fence;
+		VkSemaphore semaphore;					// Transfer -> graphics handover (VK_NULL_HANDLE if same family)
+		VkCommandBuffer commandBuffer;			// Copies (transfer queue)
+		VkCommandBuffer acquireCommandBuffer;	// Ownership acquire (graphics queue, VK_NULL_HANDLE if same family)
+		VkDeviceSize head;				// Ring head at time of submit (tail moves here when fence signals)
+		VkDeviceSize totalAllocated;	// Running allocation total at time of submit
+	};
+
+	DeviceAllocator * allocator;
+	VkDevice device;
+	VkQueue transferQueue;
+	VkCommandPool transferCommandPool;
+	uint32_t transferFamily;
+	VkQueue graphicsQueue;
+	VkCommandPool graphicsCommandPool;
+	uint32_t graphicsFamily;
+	VkExtent3D imageTransferGranularity;	// Granularity of image copies on the transfer queue (0 = whole images only)
+
+	VkBuffer ringBuffer = VK_NULL_HANDLE;
+	DeviceAllocation ringBufferMemory;
+	VkDeviceSize ringSize = 0;
+
+	// Ring state: [tail, head) is in use by recorded or in-flight copies (wrapping past end of buffer)
+	VkDeviceSize head = 0;
+	VkDeviceSize tail = 0;
+	VkDeviceSize totalAllocated = 0;	// Bytes ever handed out (including wrap/alignment padding)
+	VkDeviceSize totalReleased = 0;		// Bytes ever reclaimed
+
+	uint64_t submitCount = 0;			// Id of last submit
+	uint64_t completedSubmitCount = 0;	// Id of last submit known to have finished
+
+	VkCommandBuffer currentCommandBuffer = VK_NULL_HANDLE;
+	std::deque<InFlightSubmit> inFlight;
+	std::vector<VkFence> freeFences;
+	std::vector<VkSemaphore> freeSemaphores;
+
+	// Exclusive buffers written since the last submit, to be handed to the graphics family on submit (buffers shared
+	// concurrently by both families, such as the GeometryArena's pages, need no handover)
+	struct PendingBufferRelease {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+	std::vector<PendingBufferRelease> pendingBufferReleases;
+	std::vector<VkImageMemoryBarrier> pendingImageReleases;
+
+	// Images whose mip chain is blitted on the graphics queue once acquired (blits aren't possible on transfer queues)
+	struct PendingMipmapGeneration {
+		VkImage image;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+	};
+	std::vector<PendingMipmapGeneration> pendingMipmapGenerations;
+
+	bool tryReserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * offset);
+	VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize alignment);
+	void reclaim(bool waitForOldest);
+	void recordOwnershipTransfer(VkCommandBuffer acquireCommandBuffer);
+};
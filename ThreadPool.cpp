@@ -0,0 +1,157 @@
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <algorithm>
+
+ThreadPool::ThreadPool()
+{
+}
+
+void ThreadPool::create(size_t threadCount)
+{
+	stopping = false;
+
+	// Always have at least one worker, otherwise queued tasks would never run
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+
+	for (size_t i = 0; i < threadCount; i++)
+	{
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+std::future<void> ThreadPool::enqueue(std::function<void()> task)
+{
+	// Packaged task carries any exception thrown by the task back to whoever waits on the future
+	std::packaged_task<void()> packagedTask(task);
+	std::future<void> future = packagedTask.get_future();
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		tasks.push(std::move(packagedTask));
+	}
+	queueCondition.notify_one();
+
+	return future;
+}
+
+void ThreadPool::parallelFor(size_t count, std::function<void(size_t)> body)
+{
+	// Shared with the helper tasks, which may only start after everything is done (and then find nothing left)
+	struct ParallelJob {
+		std::atomic<size_t> next;
+		size_t count;
+		std::function<void(size_t)> body;
+
+		std::mutex mutex;
+		std::condition_variable finished;
+		size_t completed = 0;
+		std::exception_ptr error;		// First exception thrown by the body
+	};
+	std::shared_ptr<ParallelJob> job = std::make_shared<ParallelJob>();
+	job->next = 0;
+	job->count = count;
+	job->body = body;
+
+	// Take indices until there are none left
+	auto runJob = [](ParallelJob * job) {
+		size_t done = 0;
+		for (size_t i = job->next++; i < job->count; i = job->next++)
+		{
+			try
+			{
+				job->body(i);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(job->mutex);
+				if (!job->error)
+				{
+					job->error = std::current_exception();
+				}
+			}
+			done++;
+		}
+
+		if (done > 0)
+		{
+			std::lock_guard<std::mutex> lock(job->mutex);
+			job->completed += done;
+			if (job->completed == job->count)
+			{
+				job->finished.notify_all();
+			}
+		}
+	};
+
+	// Calling thread works too, and only waits for indices to finish (not for helpers to start), so this
+	// can't deadlock when called from a task while every worker is busy
+	size_t helperCount = count > 1 ? std::min(workers.size(), count - 1) : 0;
+	for (size_t i = 0; i < helperCount; i++)
+	{
+		enqueue([job, runJob]() { runJob(job.get()); });
+	}
+
+	runJob(job.get());
+
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->finished.wait(lock, [&job] { return job->completed == job->count; });
+
+	if (job->error)
+	{
+		std::rethrow_exception(job->error);
+	}
+}
+
+size_t ThreadPool::getThreadCount()
+{
+	return workers.size();
+}
+
+void ThreadPool::destroy()
+{
+	// Let workers finish everything already queued, then stop
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueCondition.notify_all();
+
+	for (auto &worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
+
+ThreadPool::~ThreadPool()
+{
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::packaged_task<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+			if (tasks.empty())
+			{
+				return;		// Stopping and nothing left to do
+			}
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+
+		task();
+	}
+}
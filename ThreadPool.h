@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+
+// Fixed set of worker threads that run queued tasks in order of submission.
+// Used for CPU-side asset work (file import, decode, conversion) so it never runs on the render thread.
+class ThreadPool
+{
+public:
+	ThreadPool();
+
+	void create(size_t threadCount);
+
+	std::future<void> enqueue(std::function<void()> task);
+	void parallelFor(size_t count, std::function<void(size_t)> body);
+
+	size_t getThreadCount();
+
+	void destroy();
+
+	~ThreadPool();
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::packaged_task<void()>> tasks;
+
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	bool stopping = false;
+
+	void workerLoop();
+};
@@ -0,0 +1,141 @@
+#include "TransformHierarchy.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define TRANSFORM_HIERARCHY_SSE
+#endif
+
+// world = parent * local, a column at a time (same as glm's SSE path, without forcing glm's intrinsics
+// on everywhere, which would change how every glm type in the project is built)
+static void multiplyTransforms(const glm::mat4 & parent, const glm::mat4 & local, glm::mat4 * world)
+{
+#ifdef TRANSFORM_HIERARCHY_SSE
+	__m128 parentColumns[4];
+	for (int i = 0; i < 4; i++)
+	{
+		parentColumns[i] = _mm_loadu_ps(&parent[i][0]);
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		__m128 column = _mm_mul_ps(parentColumns[0], _mm_set1_ps(local[i][0]));
+		column = _mm_add_ps(column, _mm_mul_ps(parentColumns[1], _mm_set1_ps(local[i][1])));
+		column = _mm_add_ps(column, _mm_mul_ps(parentColumns[2], _mm_set1_ps(local[i][2])));
+		column = _mm_add_ps(column, _mm_mul_ps(parentColumns[3], _mm_set1_ps(local[i][3])));
+		_mm_storeu_ps(&(*world)[i][0], column);
+	}
+#else
+	*world = parent * local;
+#endif
+}
+
+TransformHierarchy::TransformHierarchy()
+{
+	firstDirty = 0;
+}
+
+TransformHierarchy::TransformHierarchy(const std::vector<TransformNode> & nodes)
+{
+	parents.resize(nodes.size());
+	localTransforms.resize(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		if (nodes[i].parent >= static_cast<int32_t>(i))
+		{
+			throw std::runtime_error("Transform hierarchy nodes must come after their parent!");
+		}
+
+		parents[i] = nodes[i].parent;
+		localTransforms[i] = nodes[i].local;
+	}
+
+	// Depth first order, so a subtree ends where the last of its descendants' subtrees does
+	subtreeEnds.resize(nodes.size());
+	for (size_t i = nodes.size(); i > 0; i--)
+	{
+		subtreeEnds[i - 1] = std::max(subtreeEnds[i - 1], static_cast<uint32_t>(i));
+		if (parents[i - 1] >= 0)
+		{
+			subtreeEnds[parents[i - 1]] = std::max(subtreeEnds[parents[i - 1]], subtreeEnds[i - 1]);
+		}
+	}
+
+	// Everything starts dirty
+	worldTransforms.resize(nodes.size());
+	dirty.assign(nodes.size(), 1);
+	firstDirty = 0;
+}
+
+size_t TransformHierarchy::getNodeCount()
+{
+	return parents.size();
+}
+
+void TransformHierarchy::setLocalTransform(size_t node, const glm::mat4 & newLocalTransform)
+{
+	if (node >= localTransforms.size())
+	{
+		throw std::runtime_error("Attempted to access invalid transform node");
+	}
+
+	localTransforms[node] = newLocalTransform;
+	markDirty(node);
+}
+
+const glm::mat4 & TransformHierarchy::getLocalTransform(size_t node)
+{
+	if (node >= localTransforms.size())
+	{
+		throw std::runtime_error("Attempted to access invalid transform node");
+	}
+
+	return localTransforms[node];
+}
+
+const glm::mat4 & TransformHierarchy::getWorldTransform(size_t node)
+{
+	if (node >= worldTransforms.size())
+	{
+		throw std::runtime_error("Attempted to access invalid transform node");
+	}
+
+	return worldTransforms[node];
+}
+
+void TransformHierarchy::update()
+{
+	// Root nodes are relative to the model (its placement is applied per instance)
+	const glm::mat4 modelSpace(1.0f);
+
+	// Walk forward from the first dirty node, recomputing each dirty subtree in one go and skipping clean nodes
+	size_t node = firstDirty;
+	while (node < parents.size())
+	{
+		if (!dirty[node])
+		{
+			node++;
+			continue;
+		}
+
+		// Parents come first, so every world transform used here is already up to date
+		size_t subtreeEnd = subtreeEnds[node];
+		for (size_t i = node; i < subtreeEnd; i++)
+		{
+			const glm::mat4 &parentWorld = parents[i] >= 0 ? worldTransforms[parents[i]] : modelSpace;
+			multiplyTransforms(parentWorld, localTransforms[i], &worldTransforms[i]);
+			dirty[i] = 0;
+		}
+		node = subtreeEnd;
+	}
+
+	firstDirty = parents.size();
+}
+
+void TransformHierarchy::markDirty(size_t node)
+{
+	dirty[node] = 1;
+	firstDirty = std::min(firstDirty, node);
+}
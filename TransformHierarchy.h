@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+// One node of a model's node tree, as imported (parent is -1 for a root)
+struct TransformNode {
+	int32_t parent;
+	glm::mat4 local;				// Transform relative to the parent
+};
+
+// A model's node tree as flat arrays of local and world transforms, in depth first (pre-order) order, so every
+// parent comes before its children and each subtree is one contiguous run of nodes. Changing a node's local
+// transform only marks it dirty; update() then recomputes just the dirty subtrees.
+class TransformHierarchy
+{
+public:
+	TransformHierarchy();
+	TransformHierarchy(const std::vector<TransformNode> & nodes);
+
+	size_t getNodeCount();
+
+	void setLocalTransform(size_t node, const glm::mat4 & newLocalTransform);
+	const glm::mat4 & getLocalTransform(size_t node);
+	const glm::mat4 & getWorldTransform(size_t node);		// As of the last update()
+
+	void update();
+
+private:
+	std::vector<int32_t> parents;
+	std::vector<uint32_t> subtreeEnds;				// One past the last node of each node's subtree
+	std::vector<glm::mat4> localTransforms;
+	std::vector<glm::mat4> worldTransforms;
+	std::vector<uint8_t> dirty;
+
+	size_t firstDirty;								// Nothing before this needs updating (node count if nothing does)
+
+	void markDirty(size_t node);
+};
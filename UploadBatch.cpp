@@ -0,0 +1,77 @@
+#include "UploadBatch.h"
+
+#include "Utilities.h"
+
+UploadBatch::UploadBatch()
+{
+}
+
+UploadBatch::UploadBatch(StagingRing * newStagingRing)
+{
+	stagingRing = newStagingRing;
+}
+
+VkCommandBuffer UploadBatch::getCommandBuffer()
+{
+	// Always ask the ring, as it may have flushed the previous command buffer when it ran out of space
+	return stagingRing->getCommandBuffer();
+}
+
+void UploadBatch::uploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void * data, VkDeviceSize size, bool concurrent)
+{
+	stagingRing->uploadToBuffer(dstBuffer, dstOffset, data, size, concurrent);
+}
+
+void UploadBatch::uploadToImage(VkImage dstImage, uint32_t width, uint32_t height, VkFormat format, const void * data, uint32_t mipLevel)
+{
+	stagingRing->uploadToImage(dstImage, width, height, format, data, mipLevel);
+}
+
+void UploadBatch::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+{
+	recordImageLayoutTransition(getCommandBuffer(), image, oldLayout, newLayout, mipLevels);
+}
+
+void UploadBatch::releaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+{
+	// Final transition of an uploaded image (also hands it to the graphics queue if uploads use a transfer queue)
+	stagingRing->releaseImage(image, oldLayout, newLayout, mipLevels);
+}
+
+void UploadBatch::generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	// Fills levels 1+ from level 0 and leaves the whole image shader readable (and owned by the graphics queue)
+	stagingRing->generateMipmaps(image, width, height, mipLevels);
+}
+
+void UploadBatch::submit()
+{
+	// One submit (and fence) for everything recorded in this batch
+	submitId = stagingRing->submit();
+	submitted = true;
+}
+
+bool UploadBatch::isComplete()
+{
+	// A batch that hasn't been submitted yet (or an empty placeholder batch) is never complete
+	if (!submitted)
+	{
+		return false;
+	}
+
+	return stagingRing->isSubmitComplete(submitId);
+}
+
+void UploadBatch::wait()
+{
+	if (!submitted)
+	{
+		return;
+	}
+
+	stagingRing->waitForSubmit(submitId);
+}
+
+UploadBatch::~UploadBatch()
+{
+}
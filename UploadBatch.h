@@ -0,0 +1,36 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "StagingRing.h"
+
+// Collects every copy and barrier for one load (e.g. one createMeshModel call) into the staging ring's
+// command buffer, submits it once with a fence, and lets the caller poll or wait for it to finish.
+// If the ring fills up part way through, the ring flushes early and the batch completes with its last submit.
+// Only one batch should be recording at a time, as they share the ring's command buffer.
+class UploadBatch
+{
+public:
+	UploadBatch();
+	UploadBatch(StagingRing * newStagingRing);
+
+	VkCommandBuffer getCommandBuffer();
+
+	void uploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void * data, VkDeviceSize size, bool concurrent = false);
+	void uploadToImage(VkImage dstImage, uint32_t width, uint32_t height, VkFormat format, const void * data, uint32_t mipLevel = 0);
+	void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
+	void releaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
+	void generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+	void submit();
+	bool isComplete();
+	void wait();
+
+	~UploadBatch();
+
+private:
+	StagingRing * stagingRing = nullptr;
+	uint64_t submitId = 0;		// Ring submit that finishes this batch
+	bool submitted = false;
+};
@@ -1,31 +1,46 @@
 #pragma once
 
 #include <fstream>
+#include <algorithm>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
 #include <glm/glm.hpp>
 
+#include "DeviceAllocator.h"
+
 const int MAX_OBJECTS = 20;
 const int MAX_FRAME_DRAWS = 2;
+const uint32_t MAX_BINDLESS_TEXTURES = 4096;		// Size of bindless texture table (clamped to device limits)
+const size_t MIN_INSTANCE_BUFFER_INSTANCES = 256;	// Starting size of each instance buffer (doubled whenever it runs out)
+const uint32_t MAX_DISPATCH_GROUPS = 65535;			// Most workgroups in one dimension of a dispatch that every device allows
+const int TEXTURE_PENDING = -1;						// Texture cache entry of a texture the render thread is still creating
 
 const std::vector<const char *> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
-// Vertex data representation
+// Vertex data representation (full precision, used while importing and processing meshes)
 struct Vertex
 {
 	glm::vec3 pos; // Vertex Position (x, y, z)
-	glm::vec3 col; // Vertex Colour (r, g, b)
 	glm::vec2 tex; // Texture Coords (u, v)
 };
 
+// Vertex as stored on the GPU (12 bytes). Values are UNORM16 across the mesh's bounds, and are
+// dequantised by the transform each mesh pushes with its draw (see Model)
+struct PackedVertex
+{
+	uint16_t pos[4]; // Vertex Position (x, y, z, unused) across mesh bounding box
+	uint16_t tex[2]; // Texture Coords (u, v) across mesh UV range
+};
+
 // Indices (locations) of Queue Families (if they exist at all)
 struct QueueFamilyIndices {
 	int graphicsFamily = -1;			// Location of Graphics Queue Family
 	int presentationFamily = -1;		// Location of Presentation Queue Family
+	int transferFamily = -1;			// Location of Transfer Queue Family (transfer-only if the device has one, otherwise graphics)
 
 	// Check if queue families are valid
 	bool isValid()
@@ -45,6 +60,14 @@ struct SwapchainImage {
 	VkImageView imageView;
 };
 
+// One mip level of a pre-built (e.g. block-compressed) texture, held in a single data buffer
+struct TextureLevel {
+	VkDeviceSize offset;		// Offset of level in texture data
+	VkDeviceSize size;			// Size of level in bytes
+	uint32_t width;				// Level size in texels
+	uint32_t height;
+};
+
 static std::vector<char> readFile(const std::string &filename)
 {
 	// Open stream from given file
@@ -89,10 +112,13 @@ static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t al
 			return i;
 		}
 	}
+
+	throw std::runtime_error("Failed to find a suitable memory type!");
 }
 
-static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
-	VkMemoryPropertyFlags bufferProperties, VkBuffer * buffer, VkDeviceMemory * bufferMemory)
+static void createBuffer(DeviceAllocator * allocator, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
+	VkMemoryPropertyFlags bufferProperties, VkBuffer * buffer, DeviceAllocation * bufferAllocation,
+	const std::vector<uint32_t> & sharingFamilies = {})
 {
 	// CREATE VERTEX BUFFER
 	// Information to create a buffer (doesn't include assigning memory)
@@ -102,6 +128,14 @@ static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDev
 	bufferInfo.usage = bufferUsage;								// Multiple types of buffer possible
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;			// Similar to Swap Chain images, can share vertex buffers
 
+	// Used by several queue families at once (no ownership transfers)
+	if (sharingFamilies.size() > 1)
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+		bufferInfo.pQueueFamilyIndices = sharingFamilies.data();
+	}
+
 	VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, buffer);
 	if (result != VK_SUCCESS)
 	{
@@ -113,21 +147,49 @@ static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDev
 	vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
 
 	// ALLOCATE MEMORY TO BUFFER
-	VkMemoryAllocateInfo memoryAllocInfo = {};
-	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocInfo.allocationSize = memRequirements.size;
-	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits,		// Index of memory type on Physical Device that has required bit flags
-		bufferProperties);																						// VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT	: CPU can interact with memory
-																												// VK_MEMORY_PROPERTY_HOST_COHERENT_BIT	: Allows placement of data straight into buffer after mapping (otherwise would have to specify manually)
-																												// Allocate memory to VkDeviceMemory
-	result = vkAllocateMemory(device, &memoryAllocInfo, nullptr, bufferMemory);
+	// Sub-allocate from one of the allocator's memory blocks that has the required bit flags
+	*bufferAllocation = allocator->allocate(memRequirements, bufferProperties,	// VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT	: CPU can interact with memory
+		true);																	// VK_MEMORY_PROPERTY_HOST_COHERENT_BIT	: Allows placement of data straight into buffer after mapping (otherwise would have to specify manually)
+
+	// Bind given buffer to its region of the memory block
+	vkBindBufferMemory(device, *buffer, bufferAllocation->memory, bufferAllocation->offset);
+}
+
+static bool createDirectUploadBuffer(DeviceAllocator * allocator, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
+	VkBuffer * buffer, DeviceAllocation * bufferAllocation)
+{
+	// No memory that is both device local and host visible (or not enough of it), so caller has to stage
+	if (!allocator->hasDirectUploadMemory())
+	{
+		return false;
+	}
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = bufferSize;
+	bufferInfo.usage = bufferUsage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, buffer);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to allocate Vertex Buffer Memory!");
+		throw std::runtime_error("Failed to create a Buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
+
+	// Try DEVICE_LOCAL | HOST_VISIBLE memory, which the CPU can write and the GPU reads at full speed
+	if (!allocator->allocateDirectUpload(memRequirements, true, bufferAllocation))
+	{
+		vkDestroyBuffer(device, *buffer, nullptr);
+		*buffer = VK_NULL_HANDLE;
+		return false;
 	}
 
-	// Allocate memory to given vertex buffer
-	vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
+	vkBindBufferMemory(device, *buffer, bufferAllocation->memory, bufferAllocation->offset);
+
+	return true;
 }
 
 static VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool commandPool)
@@ -156,71 +218,9 @@ static VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool command
 	return commandBuffer;
 }
 
-static void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkCommandBuffer commandBuffer)
-{
-	// End commands
-	vkEndCommandBuffer(commandBuffer);
-
-	// Queue submission information
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	// Submit transfer command to transfer queue and wait until it finishes
-	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(queue);
-
-	// Free temporary command buffer back to pool
-	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
-
-static void copyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize bufferSize)
-{
-	// Create buffer
-	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
-
-	// Region of data to copy from and to
-	VkBufferCopy bufferCopyRegion = {};
-	bufferCopyRegion.srcOffset = 0;
-	bufferCopyRegion.dstOffset = 0;
-	bufferCopyRegion.size = bufferSize;
-
-	// Command to copy src buffer to dst buffer
-	vkCmdCopyBuffer(transferCommandBuffer, srcBuffer, dstBuffer, 1, &bufferCopyRegion);
-
-	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
-}
-
-static void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkImage image, uint32_t width, uint32_t height)
+static void recordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+	uint32_t mipLevels = 1)
 {
-	// Create buffer
-	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
-
-	VkBufferImageCopy imageRegion = {};
-	imageRegion.bufferOffset = 0;											// Offset into data
-	imageRegion.bufferRowLength = 0;										// Row length of data to calculate data spacing
-	imageRegion.bufferImageHeight = 0;										// Image height to calculate data spacing
-	imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;	// Which aspect of image to copy
-	imageRegion.imageSubresource.mipLevel = 0;								// Mipmap level to copy
-	imageRegion.imageSubresource.baseArrayLayer = 0;						// Starting array layer (if array)
-	imageRegion.imageSubresource.layerCount = 1;							// Number of layers to copy starting at baseArrayLayer
-	imageRegion.imageOffset = { 0, 0, 0 };									// Offset into image (as opposed to raw data in bufferOffset)
-	imageRegion.imageExtent = { width, height, 1 };							// Size of region to copy as (x, y, z) values
-
-	// Copy buffer to given image
-	vkCmdCopyBufferToImage(transferCommandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion);
-
-	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
-}
-
-static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-	// Create buffer
-	VkCommandBuffer commandBuffer = beginCommandBuffer(device, commandPool);
-
 	VkImageMemoryBarrier imageMemoryBarrier = {};
 	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	imageMemoryBarrier.oldLayout = oldLayout;									// Layout to transition from
@@ -230,7 +230,7 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 	imageMemoryBarrier.image = image;											// Image being accessed and modified as part of barrier
 	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;	// Aspect of image being altered
 	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;						// First mip level to start alterations on
-	imageMemoryBarrier.subresourceRange.levelCount = 1;							// Number of mip levels to alter starting from baseMipLevel
+	imageMemoryBarrier.subresourceRange.levelCount = mipLevels;					// Number of mip levels to alter starting from baseMipLevel
 	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;						// First layer to start alterations on
 	imageMemoryBarrier.subresourceRange.layerCount = 1;							// Number of layers to alter starting from baseArrayLayer
 
@@ -264,6 +264,186 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 		0, nullptr,				// Buffer Memory Barrier count + data
 		1, &imageMemoryBarrier	// Image Memory Barrier count + data
 	);
+}
+
+static uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+{
+	// Halve the largest side until it reaches 1 (1 level for the full image + 1 per halving)
+	uint32_t mipLevels = 1;
+	uint32_t largestSide = std::max(width, height);
+	while (largestSide > 1)
+	{
+		largestSide /= 2;
+		mipLevels++;
+	}
 
-	endAndSubmitCommandBuffer(device, commandPool, queue, commandBuffer);
-}
\ No newline at end of file
+	return mipLevels;
+}
+
+static bool getFormatBlockInfo(VkFormat format, uint32_t * blockWidth, uint32_t * blockHeight, uint32_t * blockSize)
+{
+	// Size of one texel block (in texels) and its size in bytes. Uncompressed formats have 1x1 blocks
+	*blockWidth = 4;
+	*blockHeight = 4;
+
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		*blockWidth = 1;
+		*blockHeight = 1;
+		*blockSize = 4;
+		return true;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+		*blockSize = 8;
+		return true;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+		*blockSize = 16;
+		return true;
+	case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+		*blockWidth = 5;
+		*blockHeight = 5;
+		*blockSize = 16;
+		return true;
+	case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+		*blockWidth = 6;
+		*blockHeight = 6;
+		*blockSize = 16;
+		return true;
+	case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+		*blockWidth = 8;
+		*blockHeight = 8;
+		*blockSize = 16;
+		return true;
+	default:
+		return false;		// Not a texture format we know how to upload
+	}
+}
+
+static void recordGenerateMipmaps(VkCommandBuffer commandBuffer, VkImage image, int32_t width, int32_t height, uint32_t mipLevels)
+{
+	// Every level starts in TRANSFER_DST_OPTIMAL with level 0 holding the image.
+	// Each level is blitted down from the one above, then moved to shader read once nothing else reads it.
+	VkImageMemoryBarrier imageMemoryBarrier = {};
+	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.image = image;
+	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageMemoryBarrier.subresourceRange.levelCount = 1;							// One level at a time
+	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+	imageMemoryBarrier.subresourceRange.layerCount = 1;
+
+	int32_t mipWidth = width;
+	int32_t mipHeight = height;
+
+	for (uint32_t i = 1; i < mipLevels; i++)
+	{
+		// Level above has been written, so make it the blit source
+		imageMemoryBarrier.subresourceRange.baseMipLevel = i - 1;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+
+		int32_t nextWidth = mipWidth > 1 ? mipWidth / 2 : 1;
+		int32_t nextHeight = mipHeight > 1 ? mipHeight / 2 : 1;
+
+		// Linear filtered blit of the whole level above into this level
+		VkImageBlit blit = {};
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = i - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = 1;
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = i;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = 1;
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+
+		vkCmdBlitImage(commandBuffer,
+			image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &blit, VK_FILTER_LINEAR);
+
+		// Level above is finished with, so it can go to shader read
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+
+		mipWidth = nextWidth;
+		mipHeight = nextHeight;
+	}
+
+	// Last level was only ever written to
+	imageMemoryBarrier.subresourceRange.baseMipLevel = mipLevels - 1;
+	imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+}
+
+static void generateMipLevel(const unsigned char * srcPixels, uint32_t srcWidth, uint32_t srcHeight, unsigned char * dstPixels)
+{
+	// CPU fallback for formats that can't be blitted: 2x2 box filter of RGBA8 pixels
+	// (odd sizes clamp the second sample to the last row/column)
+	uint32_t dstWidth = std::max(srcWidth / 2, 1u);
+	uint32_t dstHeight = std::max(srcHeight / 2, 1u);
+
+	for (uint32_t y = 0; y < dstHeight; y++)
+	{
+		uint32_t y0 = std::min(y * 2, srcHeight - 1);
+		uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+
+		for (uint32_t x = 0; x < dstWidth; x++)
+		{
+			uint32_t x0 = std::min(x * 2, srcWidth - 1);
+			uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				uint32_t sum = srcPixels[(y0 * srcWidth + x0) * 4 + c] + srcPixels[(y0 * srcWidth + x1) * 4 + c]
+					+ srcPixels[(y1 * srcWidth + x0) * 4 + c] + srcPixels[(y1 * srcWidth + x1) * 4 + c];
+				dstPixels[(y * dstWidth + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+			}
+		}
+	}
+}
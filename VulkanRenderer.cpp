@@ -15,18 +15,26 @@ int VulkanRenderer::init(GLFWwindow * newWindow)
 		createSurface();
 		getPhysicalDevice();
 		createLogicalDevice();
+		allocator.create(mainDevice.physicalDevice, mainDevice.logicalDevice);
+		QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+		geometryArena.create(&allocator, mainDevice.logicalDevice, queueFamilyIndices.transferFamily, queueFamilyIndices.graphicsFamily);
 		createSwapChain();
 		createRenderPass();
+		createOcclusionRenderPasses();
 		createDescriptorSetLayout();
+		createDrawCuller();
 		createPushConstantRange();
 		createGraphicsPipeline();
 		createDepthBufferImage();
+		createDepthPyramid();
 		createFramebuffers();
 		createCommandPool();
+		createStagingRing();
 		createCommandBuffers();
 		createTextureSampler();
 		//allocateDynamicBufferTransferSpace();
 		createUniformBuffers();
+		createMeshletCuller();
 		createDescriptorPool();
 		createDescriptorSets();
 		createSynchronisation();
@@ -37,7 +45,14 @@ int VulkanRenderer::init(GLFWwindow * newWindow)
 		uboViewProjection.projection[1][1] *= -1;
 
 		// create default "no texture" fallback
-		createTexture("plain.png");
+		UploadBatch defaultTextureUpload(&stagingRing);
+		TextureData defaultTexture = loadTextureData("plain.png");
+		acquireTexture(&defaultTexture, &defaultTextureUpload);		// Renderer keeps this reference, so texture 0 is never released
+		defaultTextureUpload.submit();
+
+		// Leave one core for the render thread
+		unsigned int coreCount = std::thread::hardware_concurrency();
+		loaderPool.create(coreCount > 1 ? coreCount - 1 : 1);
 	}
 	catch (const std::runtime_error &e) {
 		printf("ERROR: %s\n", e.what());
@@ -47,11 +62,84 @@ int VulkanRenderer::init(GLFWwindow * newWindow)
 	return 0;
 }
 
+bool VulkanRenderer::isMeshModelReady(int modelId)
+{
+	if (modelId >= modelResident.size()) return false;
+
+	return modelResident[modelId];
+}
+
 void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel)
 {
 	if (modelId >= modelList.size()) return;
 
 	modelList[modelId].setModel(newModel);
+
+	// Just the model's own records (instance 0) need rewriting, unless the draw list is being rebuilt anyway
+	if (!drawListChanged && modelId < modelDraws.size())
+	{
+		modelDraws[modelId].movedSlots.push_back(0);
+	}
+}
+
+void VulkanRenderer::updateModelNode(int modelId, size_t node, glm::mat4 newTransform)
+{
+	if (modelId >= modelList.size() || node >= modelList[modelId].getNodeCount()) return;
+
+	modelList[modelId].setNodeTransform(node, newTransform);
+
+	if (!drawListChanged && modelId < modelDraws.size())
+	{
+		modelDraws[modelId].nodesMoved = true;
+	}
+}
+
+int VulkanRenderer::createInstance(int modelId)
+{
+	if (modelId >= modelList.size())
+	{
+		throw std::runtime_error("Attempted to instance invalid model id");
+	}
+
+	// Works while the model is still loading too (instances are kept when it arrives)
+	drawListChanged = true;
+	return static_cast<int>(modelList[modelId].addInstance(glm::mat4(1.0f)));
+}
+
+void VulkanRenderer::updateInstance(int modelId, int instanceId, glm::mat4 newTransform)
+{
+	if (modelId >= modelList.size())
+	{
+		throw std::runtime_error("Attempted to access invalid model id");
+	}
+
+	modelList[modelId].setInstance(static_cast<uint32_t>(instanceId), newTransform);
+
+	if (!drawListChanged && modelId < modelDraws.size())
+	{
+		modelDraws[modelId].movedSlots.push_back(modelList[modelId].getInstances().slots[instanceId]);
+	}
+}
+
+void VulkanRenderer::destroyInstance(int modelId, int instanceId)
+{
+	if (modelId >= modelList.size())
+	{
+		throw std::runtime_error("Attempted to access invalid model id");
+	}
+
+	modelList[modelId].removeInstance(static_cast<uint32_t>(instanceId));
+	drawListChanged = true;
+}
+
+VulkanRenderer::CullingStats VulkanRenderer::getCullingStats()
+{
+	return cullingStats;
+}
+
+VulkanRenderer::DrawStats VulkanRenderer::getDrawStats()
+{
+	return drawStats;
 }
 
 void VulkanRenderer::draw()
@@ -65,7 +153,11 @@ void VulkanRenderer::draw()
 	// Get index of next image to be drawn to, and signal semaphore when ready to be drawn to
 	uint32_t imageIndex;
 	vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
-	
+
+	// Upload any models finished loading in the background, and find out which uploads are done
+	updateModelLoads();
+
+	prepareDraws(imageIndex);
 	recordCommands(imageIndex);
 	updateUniformBuffers(imageIndex);
 
@@ -119,10 +211,44 @@ void VulkanRenderer::cleanup()
 
 	//_aligned_free(modelTransferSpace);
 
+	// Let loader threads finish what they are doing, and drop any model data that never got uploaded
+	for (auto &pendingLoad : pendingModelLoads)
+	{
+		pendingLoad.loaded.wait();
+		for (auto &textureDecode : pendingLoad.textureDecodes)
+		{
+			textureDecode.decoded.wait();
+		}
+		freeModelData(pendingLoad.modelData.get());
+	}
+	pendingModelLoads.clear();
+	loaderPool.destroy();
+
+	// Release staging ring (waits for any upload still in flight and frees its command buffers)
+	stagingRing.destroy();
+
+	// Frees every mesh's culling descriptor sets along with its pool
+	meshletCuller.destroy();
+	drawCuller.destroy();
+	depthPyramid.destroy();
+
 	for (size_t i = 0; i < modelList.size(); i++) {
 		modelList[i].destroyMeshModel();
 	}
 
+	// Geometry shared by the models (their textures go with the rest below)
+	for (auto &geometry : geometries) {
+		if (!geometry) {
+			continue;
+		}
+
+		for (auto &meshGeometry : geometry->meshes) {
+			meshGeometry.destroyBuffers();
+		}
+	}
+	geometries.clear();
+	geometryArena.destroy();
+
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, samplerDescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, samplerSetLayout, nullptr);
 
@@ -130,21 +256,29 @@ void VulkanRenderer::cleanup()
 
 	for (size_t i = 0; i < textureImages.size(); i++)
 	{
+		// Skip slots of released textures
+		if (textureImages[i] == VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
 		vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[i], nullptr);
 		vkDestroyImage(mainDevice.logicalDevice, textureImages[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, textureImageMemory[i], nullptr);
+		allocator.free(textureImageMemory[i]);
 	}
 
 	vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView, nullptr);
 	vkDestroyImage(mainDevice.logicalDevice, depthBufferImage, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory, nullptr);
+	allocator.free(depthBufferImageMemory);
 
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
 	for (size_t i = 0; i < swapChainImages.size(); i++)
 	{
 		vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffer[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory[i], nullptr);
+		allocator.free(vpUniformBufferMemory[i]);
+		vkDestroyBuffer(mainDevice.logicalDevice, instanceBuffers[i], nullptr);
+		allocator.free(instanceBufferMemory[i]);
 		//vkDestroyBuffer(mainDevice.logicalDevice, modelDUniformBuffer[i], nullptr);
 		//vkFreeMemory(mainDevice.logicalDevice, modelDUniformBufferMemory[i], nullptr);
 	}
@@ -154,20 +288,32 @@ void VulkanRenderer::cleanup()
 		vkDestroySemaphore(mainDevice.logicalDevice, imageAvailable[i], nullptr);
 		vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
 	}
+	vkDestroyCommandPool(mainDevice.logicalDevice, transferCommandPool, nullptr);
 	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
 	for (auto framebuffer : swapChainFramebuffers)
 	{
 		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
 	}
+	if (gpuDrivenCulling)
+	{
+		vkDestroyPipeline(mainDevice.logicalDevice, indirectPipeline, nullptr);
+		vkDestroyPipelineLayout(mainDevice.logicalDevice, indirectPipelineLayout, nullptr);
+	}
 	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
 	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
+	if (occlusionCulling)
+	{
+		vkDestroyRenderPass(mainDevice.logicalDevice, firstPhaseRenderPass, nullptr);
+		vkDestroyRenderPass(mainDevice.logicalDevice, secondPhaseRenderPass, nullptr);
+	}
 	for (auto image : swapChainImages)
 	{
 		vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
 	}
 	vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
 	vkDestroySurfaceKHR(instance, surface, nullptr);
+	allocator.destroy();
 	vkDestroyDevice(mainDevice.logicalDevice, nullptr);
 
 	vkDestroyInstance(instance, nullptr);
@@ -188,7 +334,20 @@ void VulkanRenderer::createInstance()
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);		// Custom version of the application
 	appInfo.pEngineName = "No Engine";							// Custom engine name
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);			// Custom engine version
-	appInfo.apiVersion = VK_API_VERSION_1_0;					// The Vulkan Version
+
+	// Ask for Vulkan 1.1 where the loader has it (needed to query descriptor indexing support), otherwise 1.0
+	PFN_vkEnumerateInstanceVersion enumerateInstanceVersion =
+		reinterpret_cast<PFN_vkEnumerateInstanceVersion>(vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion"));
+	if (enumerateInstanceVersion != nullptr)
+	{
+		uint32_t loaderVersion = VK_API_VERSION_1_0;
+		enumerateInstanceVersion(&loaderVersion);
+		if (loaderVersion >= VK_API_VERSION_1_1)
+		{
+			instanceApiVersion = VK_API_VERSION_1_1;
+		}
+	}
+	appInfo.apiVersion = instanceApiVersion;					// The Vulkan Version
 
 	// Creation information for a VkInstance (Vulkan Instance)
 	VkInstanceCreateInfo createInfo = {};
@@ -240,7 +399,7 @@ void VulkanRenderer::createLogicalDevice()
 
 	// Vector for queue creation information, and set for family indices
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.presentationFamily };
+	std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.presentationFamily, indices.transferFamily };
 
 	// Queues the logical device needs to create and info to do so
 	for (int queueFamilyIndex : queueFamilyIndices)
@@ -260,12 +419,48 @@ void VulkanRenderer::createLogicalDevice()
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());		// Number of Queue Create Infos
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();								// List of queue create infos so device can create required queues
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());	// Number of enabled logical device extensions
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();							// List of enabled logical device extensions
+
+	// Use bindless textures if the device has descriptor indexing (needs its extension and features enabling)
+	std::vector<const char *> enabledExtensions = deviceExtensions;
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	bindlessTextures = checkBindlessTextureSupport(mainDevice.physicalDevice, &indexingFeatures);
+	if (bindlessTextures)
+	{
+		enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		deviceCreateInfo.pNext = &indexingFeatures;
+	}
+
+	// Cull meshlets on the GPU if the culling shader is there
+	meshletCulling = checkMeshletCullingSupport(mainDevice.physicalDevice);
+
+	// GPU driven culling reads each draw's texture from the bindless array, and draws a batch with one multi draw
+	bool drawIndirectCount = false;
+	gpuDrivenCulling = bindlessTextures && checkGpuDrivenCullingSupport(mainDevice.physicalDevice, &drawIndirectCount);
+	if (gpuDrivenCulling && drawIndirectCount)
+	{
+		enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
+	// Occlusion culling builds on it, sampling the depth buffer
+	occlusionCulling = gpuDrivenCulling && checkOcclusionCullingSupport(mainDevice.physicalDevice);
+
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());	// Number of enabled logical device extensions
+	deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();						// List of enabled logical device extensions
 
 	// Physical Device Features the Logical Device will be using
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;		// Enable Anisotropy
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;				// Enable whichever compressed texture
+	deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;			// formats the device has (checked per
+	deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;	// format when a KTX2 file is loaded)
+	deviceFeatures.multiDrawIndirect = gpuDrivenCulling;			// GPU driven culling: many draws per indirect draw,
+	deviceFeatures.drawIndirectFirstInstance = gpuDrivenCulling;	// each telling the vertex shader its draw through firstInstance
+	deviceFeatures.drawIndirectFirstInstance |= meshletCulling;		// (meshlet culled draws start at their mesh's instance too)
 
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;			// Physical Device features Logical Device will use
 	
@@ -281,6 +476,14 @@ void VulkanRenderer::createLogicalDevice()
 	// From given logical device, of given Queue Family, of given Queue Index (0 since only one queue), place reference in given VkQueue
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentationFamily, 0, &presentationQueue);
+	vkGetDeviceQueue(mainDevice.logicalDevice, indices.transferFamily, 0, &transferQueue);
+
+	// Without a count, every batch draws all of its command slots (unused ones draw nothing)
+	if (gpuDrivenCulling && drawIndirectCount)
+	{
+		drawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+			vkGetDeviceProcAddr(mainDevice.logicalDevice, "vkCmdDrawIndexedIndirectCountKHR"));
+	}
 }
 
 void VulkanRenderer::createSurface()
@@ -480,6 +683,127 @@ void VulkanRenderer::createRenderPass()
 	}
 }
 
+void VulkanRenderer::createOcclusionRenderPasses()
+{
+	if (!occlusionCulling)
+	{
+		return;
+	}
+
+	// Same attachments and subpass as renderPass (so its framebuffers and pipelines work with both), split in two:
+	// the first phase clears and keeps its depth for the depth pyramid, the second carries on from it and presents
+	VkAttachmentDescription colourAttachment = {};
+	colourAttachment.format = swapChainImageFormat;
+	colourAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colourAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colourAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	VkAttachmentDescription depthAttachment = {};
+	depthAttachment.format = chooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	VkAttachmentReference colourAttachmentReference = {};
+	colourAttachmentReference.attachment = 0;
+	colourAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depthAttachmentReference = {};
+	depthAttachmentReference.attachment = 1;
+	depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colourAttachmentReference;
+	subpass.pDepthStencilAttachment = &depthAttachmentReference;
+
+	std::array<VkSubpassDependency, 2> subpassDependencies = {};
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+
+	std::array<VkAttachmentDescription, 2> renderPassAttachments;
+
+	VkRenderPassCreateInfo renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(renderPassAttachments.size());
+	renderPassCreateInfo.pAttachments = renderPassAttachments.data();
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpass;
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
+	renderPassCreateInfo.pDependencies = subpassDependencies.data();
+
+	// FIRST PHASE
+	// Colour stays an attachment for the second phase, depth becomes readable by the depth pyramid build
+	colourAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colourAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colourAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colourAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	renderPassAttachments = { colourAttachment, depthAttachment };
+
+	// Clearing depth must wait for the last pyramid build to finish reading it
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Depth is read by the pyramid build, colour drawn on by the second phase
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	VkResult result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &firstPhaseRenderPass);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Render Pass!");
+	}
+
+	// SECOND PHASE
+	// Keeps drawing on the first phase's colour and depth, and presents as renderPass does. The finished depth is kept
+	// for the pyramid to be rebuilt from, so next frame's first phase is culled against everything drawn this frame
+	colourAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	colourAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colourAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colourAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	renderPassAttachments = { colourAttachment, depthAttachment };
+
+	// Writing depth again must wait for the pyramid build to finish reading it
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Depth is read by the pyramid rebuild, colour by presentation
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &secondPhaseRenderPass);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Render Pass!");
+	}
+}
+
 void VulkanRenderer::createDescriptorSetLayout()
 {
 	// UNIFORM VALUES DESCRIPTOR SET LAYOUT
@@ -515,11 +839,11 @@ void VulkanRenderer::createDescriptorSetLayout()
 	}
 
 	// CREATE TEXTURE SAMPLER DESCRIPTOR SET LAYOUT
-	// Texture binding info
+	// Texture binding info (one texture per set, or an array of every texture if bindless)
 	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
 	samplerLayoutBinding.binding = 0;
 	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.descriptorCount = 1;
+	samplerLayoutBinding.descriptorCount = bindlessTextures ? bindlessTextureCount : 1;
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	samplerLayoutBinding.pImmutableSamplers = nullptr;
 
@@ -529,6 +853,21 @@ void VulkanRenderer::createDescriptorSetLayout()
 	textureLayoutCreateInfo.bindingCount = 1;
 	textureLayoutCreateInfo.pBindings = &samplerLayoutBinding;
 
+	// Bindless array: unused elements don't need to be valid, and textures are added/removed while the set is in use
+	VkDescriptorBindingFlagsEXT bindlessBindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+		VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo = {};
+	bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	bindingFlagsCreateInfo.bindingCount = 1;
+	bindingFlagsCreateInfo.pBindingFlags = &bindlessBindingFlags;
+
+	if (bindlessTextures)
+	{
+		textureLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+		textureLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	}
+
 	// Create Descriptor Set Layout
 	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &textureLayoutCreateInfo, nullptr, &samplerSetLayout);
 	if (result != VK_SUCCESS)
@@ -543,13 +882,18 @@ void VulkanRenderer::createPushConstantRange()
 	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;	// Shader stage push constant will go to
 	pushConstantRange.offset = 0;								// Offset into given data to pass to push constant
 	pushConstantRange.size = sizeof(Model);						// Size of data being passed
+
+	// Bindless textures: fragment shader gets the texture id of each draw straight after the model matrix
+	textureIdPushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	textureIdPushConstantRange.offset = sizeof(Model);
+	textureIdPushConstantRange.size = sizeof(uint32_t);
 }
 
 void VulkanRenderer::createGraphicsPipeline()
 {
 	// Read in SPIR-V code of shaders
 	auto vertexShaderCode = readFile("Shaders/vert.spv");
-	auto fragmentShaderCode = readFile("Shaders/frag.spv");
+	auto fragmentShaderCode = readFile(bindlessTextures ? "Shaders/frag_bindless.spv" : "Shaders/frag.spv");
 
 	// Create Shader Modules
 	VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
@@ -575,39 +919,47 @@ void VulkanRenderer::createGraphicsPipeline()
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
 
 	// How the data for a single vertex (including info such as position, colour, texture coords, normals, etc) is as a whole
-	VkVertexInputBindingDescription bindingDescription = {};
-	bindingDescription.binding = 0;									// Can bind multiple streams of data, this defines which one
-	bindingDescription.stride = sizeof(Vertex);						// Size of a single vertex object
-	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;		// How to move between data after each vertex.
-																	// VK_VERTEX_INPUT_RATE_INDEX		: Move on to the next vertex
-																	// VK_VERTEX_INPUT_RATE_INSTANCE	: Move to a vertex for the next instance
+	std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = {};
+	bindingDescriptions[0].binding = 0;									// Can bind multiple streams of data, this defines which one
+	bindingDescriptions[0].stride = sizeof(PackedVertex);				// Size of a single vertex object
+	bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;		// How to move between data after each vertex.
+																		// VK_VERTEX_INPUT_RATE_INDEX		: Move on to the next vertex
+																		// VK_VERTEX_INPUT_RATE_INSTANCE	: Move to a vertex for the next instance
+
+	// Instance transforms, one per instance of the model being drawn
+	bindingDescriptions[1].binding = 1;
+	bindingDescriptions[1].stride = sizeof(glm::mat4);
+	bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
 	// How the data for an attribute is defined within a vertex
-	std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions;
-
-	// Position Attribute
-	attributeDescriptions[0].binding = 0;							// Which binding the data is at (should be same as above)
-	attributeDescriptions[0].location = 0;							// Location in shader where data will be read from
-	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;	// Format the data will take (also helps define size of data)
-	attributeDescriptions[0].offset = offsetof(Vertex, pos);		// Where this attribute is defined in the data for a single vertex
-
-	// Colour Attribute
-	attributeDescriptions[1].binding = 0;							
-	attributeDescriptions[1].location = 1;							
-	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;	
-	attributeDescriptions[1].offset = offsetof(Vertex, col);
-
-	// Texture Attribute
-	attributeDescriptions[2].binding = 0;
-	attributeDescriptions[2].location = 2;
-	attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	attributeDescriptions[2].offset = offsetof(Vertex, tex);
+	std::array<VkVertexInputAttributeDescription, 6> attributeDescriptions;
+
+	// Position Attribute (UNORM16 across the mesh bounds, dequantised by the pushed model matrix)
+	attributeDescriptions[0].binding = 0;								// Which binding the data is at (should be same as above)
+	attributeDescriptions[0].location = 0;								// Location in shader where data will be read from
+	attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;	// Format the data will take (also helps define size of data)
+	attributeDescriptions[0].offset = offsetof(PackedVertex, pos);		// Where this attribute is defined in the data for a single vertex
+
+	// Texture Attribute (UNORM16 across the mesh UV range, dequantised by the pushed texture transform)
+	attributeDescriptions[1].binding = 0;
+	attributeDescriptions[1].location = 1;
+	attributeDescriptions[1].format = VK_FORMAT_R16G16_UNORM;
+	attributeDescriptions[1].offset = offsetof(PackedVertex, tex);
+
+	// Instance Transform Attribute (a mat4 takes one location per column)
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		attributeDescriptions[2 + i].binding = 1;
+		attributeDescriptions[2 + i].location = 2 + i;
+		attributeDescriptions[2 + i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[2 + i].offset = sizeof(glm::vec4) * i;
+	}
 
 	// -- VERTEX INPUT --
 	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
 	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
-	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;											// List of Vertex Binding Descriptions (data spacing/stride information)
+	vertexInputCreateInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+	vertexInputCreateInfo.pVertexBindingDescriptions = bindingDescriptions.data();											// List of Vertex Binding Descriptions (data spacing/stride information)
 	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
 	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();								// List of Vertex Attribute Descriptions (data format and where to bind to/from)
 
@@ -709,8 +1061,14 @@ void VulkanRenderer::createGraphicsPipeline()
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
 	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	std::vector<VkPushConstantRange> pushConstantRanges = { pushConstantRange };
+	if (bindlessTextures)
+	{
+		pushConstantRanges.push_back(textureIdPushConstantRange);
+	}
+
+	pipelineLayoutCreateInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+	pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges.data();
 
 	// Create Pipeline Layout
 	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
@@ -761,6 +1119,47 @@ void VulkanRenderer::createGraphicsPipeline()
 	// Destroy Shader Modules, no longer needed after Pipeline created
 	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
 	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
+
+	if (!gpuDrivenCulling)
+	{
+		return;
+	}
+
+	// -- GPU DRIVEN CULLING PIPELINE --
+	// Same state, but each draw's transform, UV range and texture come from its draw record (set 2, see DrawCuller)
+	// rather than push constants and the instance buffer, so only the vertices are read as attributes
+	VkShaderModule indirectVertexShaderModule = createShaderModule(readFile("Shaders/vert_indirect.spv"));
+	VkShaderModule indirectFragmentShaderModule = createShaderModule(readFile("Shaders/frag_indirect.spv"));
+	shaderStages[0].module = indirectVertexShaderModule;
+	shaderStages[1].module = indirectFragmentShaderModule;
+
+	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = 2;
+
+	std::array<VkDescriptorSetLayout, 3> indirectSetLayouts = { descriptorSetLayout, samplerSetLayout, drawCuller.getSetLayout() };
+
+	VkPipelineLayoutCreateInfo indirectLayoutCreateInfo = {};
+	indirectLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	indirectLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(indirectSetLayouts.size());
+	indirectLayoutCreateInfo.pSetLayouts = indirectSetLayouts.data();
+
+	result = vkCreatePipelineLayout(mainDevice.logicalDevice, &indirectLayoutCreateInfo, nullptr, &indirectPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Pipeline Layout!");
+	}
+
+	pipelineCreateInfo.layout = indirectPipelineLayout;
+
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &indirectPipeline);
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, indirectFragmentShaderModule, nullptr);
+	vkDestroyShaderModule(mainDevice.logicalDevice, indirectVertexShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Graphics Pipeline!");
+	}
 }
 
 void VulkanRenderer::createDepthBufferImage()
@@ -771,14 +1170,31 @@ void VulkanRenderer::createDepthBufferImage()
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 
-	// Create Depth Buffer Image
+	// Create Depth Buffer Image (sampled too, by the depth pyramid build, with occlusion culling)
+	VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	if (occlusionCulling)
+	{
+		depthUsage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	}
 	depthBufferImage = createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory);
+		depthUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory);
 
 	// Create Depth Buffer Image View
 	depthBufferImageView = createImageView(depthBufferImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
 }
 
+void VulkanRenderer::createDepthPyramid()
+{
+	if (!occlusionCulling)
+	{
+		return;
+	}
+
+	// Built from the depth buffer each frame, and sampled by the draw culler
+	depthPyramid.create(&allocator, mainDevice.logicalDevice, depthBufferImageView, swapChainExtent);
+	drawCuller.setDepthPyramid(&depthPyramid);
+}
+
 void VulkanRenderer::createFramebuffers()
 {
 	// Resize framebuffer count to equal swap chain image count
@@ -825,6 +1241,60 @@ void VulkanRenderer::createCommandPool()
 	{
 		throw std::runtime_error("Failed to create a Command Pool!");
 	}
+
+	// Upload command buffers are short lived, and submitted to the transfer queue
+	VkCommandPoolCreateInfo transferPoolInfo = {};
+	transferPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	transferPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	transferPoolInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
+
+	// Create a Transfer Queue Family Command Pool
+	result = vkCreateCommandPool(mainDevice.logicalDevice, &transferPoolInfo, nullptr, &transferCommandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Transfer Command Pool!");
+	}
+}
+
+void VulkanRenderer::createStagingRing()
+{
+	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+
+	// Transfer queues can have a coarser image copy granularity than graphics queues
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(mainDevice.physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(mainDevice.physicalDevice, &queueFamilyCount, queueFamilyList.data());
+
+	VkExtent3D imageTransferGranularity = queueFamilyList[queueFamilyIndices.transferFamily].minImageTransferGranularity;
+
+	stagingRing.create(&allocator, mainDevice.logicalDevice,
+		transferQueue, transferCommandPool, queueFamilyIndices.transferFamily,
+		graphicsQueue, graphicsCommandPool, queueFamilyIndices.graphicsFamily,
+		imageTransferGranularity);
+}
+
+void VulkanRenderer::createMeshletCuller()
+{
+	if (!meshletCulling)
+	{
+		return;
+	}
+
+	// Culling reads the same ViewProjection uniform buffers as the vertex shader
+	meshletCuller.create(mainDevice.logicalDevice, vpUniformBuffer, sizeof(UboViewProjection));
+}
+
+void VulkanRenderer::createDrawCuller()
+{
+	if (!gpuDrivenCulling)
+	{
+		return;
+	}
+
+	// Before the graphics pipelines, as the indirect pipeline's vertex shader reads the draws from the culler's set
+	drawCuller.create(&allocator, mainDevice.logicalDevice, static_cast<uint32_t>(swapChainImages.size()), drawIndexedIndirectCount,
+		occlusionCulling);
 }
 
 void VulkanRenderer::createCommandBuffers()
@@ -888,7 +1358,7 @@ void VulkanRenderer::createTextureSampler()
 	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;		// Mipmap interpolation mode
 	samplerCreateInfo.mipLodBias = 0.0f;								// Level of Details bias for mip level
 	samplerCreateInfo.minLod = 0.0f;									// Minimum Level of Detail to pick mip level
-	samplerCreateInfo.maxLod = 0.0f;									// Maximum Level of Detail to pick mip level
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;						// Maximum Level of Detail to pick mip level (no clamp, each view limits to its own levels)
 	samplerCreateInfo.anisotropyEnable = VK_TRUE;						// Enable Anisotropy
 	samplerCreateInfo.maxAnisotropy = 16;								// Anisotropy sample level
 
@@ -916,12 +1386,46 @@ void VulkanRenderer::createUniformBuffers()
 	// Create Uniform buffers
 	for (size_t i = 0; i < swapChainImages.size(); i++)
 	{
-		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vpUniformBuffer[i], &vpUniformBufferMemory[i]);
+		// Prefer memory that is device local as well as host visible, so shaders don't read across the bus
+		if (!createDirectUploadBuffer(&allocator, mainDevice.logicalDevice, vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			&vpUniformBuffer[i], &vpUniformBufferMemory[i]))
+		{
+			createBuffer(&allocator, mainDevice.logicalDevice, vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vpUniformBuffer[i], &vpUniformBufferMemory[i]);
+		}
 
 		/*createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, modelBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &modelDUniformBuffer[i], &modelDUniformBufferMemory[i]);*/
 	}
+
+	// Instance transform buffers (grown as more instances are drawn)
+	instanceBuffers.assign(swapChainImages.size(), VK_NULL_HANDLE);
+	instanceBufferMemory.resize(swapChainImages.size());
+	instanceBufferCapacities.assign(swapChainImages.size(), 0);
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		createInstanceBuffer(static_cast<uint32_t>(i), MIN_INSTANCE_BUFFER_INSTANCES);
+	}
+}
+
+void VulkanRenderer::createInstanceBuffer(uint32_t imageIndex, size_t capacity)
+{
+	// Replaces the image's old buffer (its last frame has finished with it, same as its uniform buffer)
+	if (instanceBuffers[imageIndex] != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(mainDevice.logicalDevice, instanceBuffers[imageIndex], nullptr);
+		allocator.free(instanceBufferMemory[imageIndex]);
+	}
+
+	// Written by the CPU every frame, so host visible (device local too where there is memory for it)
+	VkDeviceSize bufferSize = sizeof(glm::mat4) * capacity;
+	if (!createDirectUploadBuffer(&allocator, mainDevice.logicalDevice, bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		&instanceBuffers[imageIndex], &instanceBufferMemory[imageIndex]))
+	{
+		createBuffer(&allocator, mainDevice.logicalDevice, bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &instanceBuffers[imageIndex], &instanceBufferMemory[imageIndex]);
+	}
+	instanceBufferCapacities[imageIndex] = capacity;
 }
 
 void VulkanRenderer::createDescriptorPool()
@@ -956,14 +1460,16 @@ void VulkanRenderer::createDescriptorPool()
 	}
 
 	// CREATE SAMPLER DESCRIPTOR POOL
-	// Texture sampler pool
+	// Texture sampler pool (a set per texture, or one set holding the whole bindless array)
 	VkDescriptorPoolSize samplerPoolSize = {};
 	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerPoolSize.descriptorCount = MAX_OBJECTS;
+	samplerPoolSize.descriptorCount = bindlessTextures ? bindlessTextureCount : MAX_OBJECTS;
 
 	VkDescriptorPoolCreateInfo samplerPoolCreateInfo = {};
 	samplerPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	samplerPoolCreateInfo.maxSets = MAX_OBJECTS;
+	samplerPoolCreateInfo.flags = bindlessTextures ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT
+		: VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;	// Sets are freed when their texture is released
+	samplerPoolCreateInfo.maxSets = bindlessTextures ? 1 : MAX_OBJECTS;
 	samplerPoolCreateInfo.poolSizeCount = 1;
 	samplerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
 
@@ -1038,15 +1544,28 @@ void VulkanRenderer::createDescriptorSets()
 		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 
 								0, nullptr);
 	}
+
+	// Single texture set holding the bindless array (textures are written in as they are created)
+	if (bindlessTextures)
+	{
+		VkDescriptorSetAllocateInfo bindlessAllocInfo = {};
+		bindlessAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		bindlessAllocInfo.descriptorPool = samplerDescriptorPool;
+		bindlessAllocInfo.descriptorSetCount = 1;
+		bindlessAllocInfo.pSetLayouts = &samplerSetLayout;
+
+		VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &bindlessAllocInfo, &bindlessDescriptorSet);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate the Bindless Texture Descriptor Set!");
+		}
+	}
 }
 
 void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
 {
-	// Copy VP data
-	void * data;
-	vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
-	memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-	vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex]);
+	// Copy VP data (uniform buffer memory stays mapped for its whole lifetime)
+	memcpy(vpUniformBufferMemory[imageIndex].mapped, &uboViewProjection, sizeof(UboViewProjection));
 
 	// Copy Model data
 	/*for (size_t i = 0; i < meshList.size(); i++)
@@ -1061,46 +1580,421 @@ void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
 	vkUnmapMemory(mainDevice.logicalDevice, modelDUniformBufferMemory[imageIndex]);*/
 }
 
-void VulkanRenderer::recordCommands(uint32_t currentImage)
+void VulkanRenderer::prepareDraws(uint32_t imageIndex)
 {
-	// Information about how to begin each command buffer
-	VkCommandBufferBeginInfo bufferBeginInfo = {};
-	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-
-	// Information about how to begin a render pass (only needed for graphical applications)
-	VkRenderPassBeginInfo renderPassBeginInfo = {};
-	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassBeginInfo.renderPass = renderPass;							// Render Pass to begin
-	renderPassBeginInfo.renderArea.offset = { 0, 0 };						// Start point of render pass in pixels
-	renderPassBeginInfo.renderArea.extent = swapChainExtent;				// Size of region to run render pass on (starting at offset)
-
-	std::array<VkClearValue, 2> clearValues = {};
-	clearValues[0].color = { 0.6f, 0.65f, 0.4f, 1.0f };
-	clearValues[1].depthStencil.depth = 1.0f;
-
-	renderPassBeginInfo.pClearValues = clearValues.data();					// List of clear values
-	renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-
-	renderPassBeginInfo.framebuffer = swapChainFramebuffers[currentImage];
-
-	// Start recording commands to command buffer!
-	VkResult result = vkBeginCommandBuffer(commandBuffers[currentImage], &bufferBeginInfo);
-	if (result != VK_SUCCESS)
+	// GPU culls and picks LODs itself, so only needs to know when the scene changes
+	if (gpuDrivenCulling && gpuDrivenCullingEnabled)
 	{
-		throw std::runtime_error("Failed to start recording a Command Buffer!");
+		prepareIndirectDraws();
+		return;
 	}
 
-		// Begin Render Pass
-		vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			// Bind Pipeline to be used in render pass
-			vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+	// For picking mesh LODs: where the camera is, and how many pixels a world space unit covers at distance 1
+	glm::vec3 cameraPos = glm::vec3(glm::inverse(uboViewProjection.view)[3]);
+	float pixelsPerUnit = std::abs(uboViewProjection.projection[1][1]) * swapChainExtent.height * 0.5f;
 
-			for (size_t j = 0; j < modelList.size(); j++)
-			{
-				MeshModel thisModel = modelList[j];
+	// Bounds of every instance of every resident mesh, one entry each (entries of a mesh's instances are consecutive)
+	frustumCuller.clear();
+	frustumCuller.setFrustum(uboViewProjection.projection * uboViewProjection.view);
+	for (size_t j = 0; j < modelList.size(); j++)
+	{
+		if (!modelResident[j])
+		{
+			continue;
+		}
 
-				glm::mat4 modelMatrix = thisModel.getModel();
+		// Transforms of any nodes moved since last frame
+		modelList[j].updateTransforms();
+		const std::vector<glm::mat4> &instanceTransforms = modelList[j].getInstanceTransforms();
+
+		for (size_t k = 0; k < modelList[j].getMeshCount(); k++)
+		{
+			Mesh * mesh = modelList[j].getMesh(k);
+			const glm::mat4 &meshTransform = modelList[j].getMeshTransform(k);
+			for (size_t i = 0; i < instanceTransforms.size(); i++)
+			{
+				frustumCuller.addBounds(instanceTransforms[i] * meshTransform, mesh->getBoundsMin(), mesh->getBoundsMax(), mesh->getBoundingSphere());
+			}
+		}
+	}
+	frustumCuller.cull();
+
+	cullingStats.visibleMeshes = frustumCuller.getVisibleCount();
+	cullingStats.culledMeshes = frustumCuller.getCulledCount();
+	cullingStats.occludedMeshes = 0;
+
+	if (cullingStats.visibleMeshes > instanceBufferCapacities[imageIndex])
+	{
+		size_t capacity = instanceBufferCapacities[imageIndex];
+		while (capacity < cullingStats.visibleMeshes)
+		{
+			capacity *= 2;
+		}
+		createInstanceBuffer(imageIndex, capacity);
+	}
+
+	// Walk the entries in the same order: each mesh with anything visible is drawn once, for just its visible instances
+	glm::mat4 * instanceData = static_cast<glm::mat4 *>(instanceBufferMemory[imageIndex].mapped);
+	uint32_t entry = 0;
+	uint32_t instanceCount = 0;
+	meshDraws.clear();
+	meshletCullDraws.clear();
+	drawSortKeys.clear();
+	drawSortOrder.clear();
+	for (size_t j = 0; j < modelList.size(); j++)
+	{
+		if (!modelResident[j])
+		{
+			continue;
+		}
+
+		const std::vector<glm::mat4> &instanceTransforms = modelList[j].getInstanceTransforms();
+
+		for (size_t k = 0; k < modelList[j].getMeshCount(); k++)
+		{
+			Mesh * mesh = modelList[j].getMesh(k);
+			const glm::mat4 &meshTransform = modelList[j].getMeshTransform(k);
+
+			MeshDraw meshDraw = { mesh, meshTransform, instanceCount, 0, false };
+			glm::vec4 centre = meshTransform * glm::vec4((mesh->getBoundsMin() + mesh->getBoundsMax()) * 0.5f, 1.0f);
+			size_t nearestInstance = 0;
+			float nearestDistance = std::numeric_limits<float>::max();
+			for (size_t i = 0; i < instanceTransforms.size(); i++, entry++)
+			{
+				if (!frustumCuller.isVisible(entry))
+				{
+					continue;
+				}
+
+				instanceData[instanceCount++] = instanceTransforms[i];
+				meshDraw.instanceCount++;
+
+				// Instances share one draw, so one LOD: whichever the nearest visible instance needs
+				glm::vec3 offset = glm::vec3(instanceTransforms[i] * centre) - cameraPos;
+				float distance = glm::dot(offset, offset);
+				if (distance < nearestDistance)
+				{
+					nearestInstance = i;
+					nearestDistance = distance;
+				}
+			}
+
+			if (meshDraw.instanceCount == 0)
+			{
+				continue;
+			}
+
+			// Pick the simplest LOD of the mesh that still looks right from here
+			mesh->selectLod(instanceTransforms[nearestInstance] * meshTransform, cameraPos, pixelsPerUnit);
+
+			// Meshlets are culled for one transform, so only for meshes drawn once
+			if (mesh->isMeshletCulled() && meshDraw.instanceCount == 1)
+			{
+				meshDraw.meshletCulled = true;
+				meshletCullDraws.push_back({ mesh, instanceTransforms[nearestInstance] * meshTransform, meshDraw.firstInstance });
+			}
+
+			// Sort key: one pipeline, then the mesh's texture, then its arena page and index type (or its own culled
+			// indices), then nearest visible instance's (squared) distance, so each group is drawn front to back
+			uint32_t geometryBuffer = DRAW_KEY_GEOMETRY_OTHER;
+			if (!meshDraw.meshletCulled)
+			{
+				geometryBuffer = mesh->getGeometry()->getArenaPage() * 2 + (mesh->getIndexType() == VK_INDEX_TYPE_UINT16 ? 1 : 0);
+			}
+			drawSortKeys.push_back(DrawSorter::makeKey(0, static_cast<uint32_t>(mesh->getTexId()), geometryBuffer, nearestDistance));
+			drawSortOrder.push_back(static_cast<uint32_t>(meshDraws.size()));
+
+			meshDraws.push_back(meshDraw);
+		}
+	}
+
+	// Record draws in key order, so textures and buffers change as rarely as possible
+	drawSorter.sort(&drawSortKeys, &drawSortOrder);
+	sortedMeshDraws.clear();
+	for (uint32_t drawIndex : drawSortOrder)
+	{
+		sortedMeshDraws.push_back(meshDraws[drawIndex]);
+	}
+	meshDraws.swap(sortedMeshDraws);
+}
+
+void VulkanRenderer::prepareIndirectDraws()
+{
+	meshDraws.clear();
+	meshletCullDraws.clear();
+
+	// Draws only moved, so just rewrite their records
+	if (!drawListChanged)
+	{
+		updateIndirectDraws();
+		return;
+	}
+	drawListChanged = false;
+
+	// A batch per geometry arena page and index type (draws of one batch share its buffers, so this is normally
+	// just one or two), and each mesh geometry's LODs in the LOD table
+	std::vector<IndirectLod> lods;
+	std::vector<IndirectBatch> batches;
+	std::vector<std::vector<IndirectDraw>> batchDraws;
+	std::map<std::pair<uint32_t, VkIndexType>, uint32_t> arenaBatches;
+	std::map<MeshGeometry *, uint32_t> geometryLodOffsets;
+
+	// Batch of every record and its place in the batch (drawIndices point here until the batches are laid out)
+	std::vector<std::pair<uint32_t, uint32_t>> drawPositions;
+	modelDraws.assign(modelList.size(), ModelDraws());
+
+	for (size_t j = 0; j < modelList.size(); j++)
+	{
+		if (!modelResident[j])
+		{
+			continue;
+		}
+
+		// Transforms of any nodes moved since the draws were last built
+		modelList[j].updateTransforms();
+		const std::vector<glm::mat4> &instanceTransforms = modelList[j].getInstanceTransforms();
+		size_t meshCount = modelList[j].getMeshCount();
+
+		// Each instance's meshes next to each other, so moving an instance rewrites neighbouring records
+		modelDraws[j].drawIndices.resize(instanceTransforms.size() * meshCount);
+		for (size_t i = 0; i < instanceTransforms.size() * meshCount; i++)
+		{
+			size_t instance = i / meshCount;
+			size_t k = i % meshCount;
+			Mesh * mesh = modelList[j].getMesh(k);
+			MeshGeometry * geometry = mesh->getGeometry();
+
+			std::pair<uint32_t, VkIndexType> arenaKey = { geometry->getArenaPage(), geometry->getIndexType() };
+			auto arenaBatch = arenaBatches.find(arenaKey);
+			if (arenaBatch == arenaBatches.end())
+			{
+				arenaBatch = arenaBatches.insert({ arenaKey, static_cast<uint32_t>(batches.size()) }).first;
+				batches.push_back({ geometry->getVertexBuffer(), geometry->getIndexBuffer(), geometry->getIndexType(), 0, 0 });
+				batchDraws.emplace_back();
+			}
+			uint32_t batch = arenaBatch->second;
+
+			// LODs as ranges of the arena's buffers
+			auto geometryLodOffset = geometryLodOffsets.find(geometry);
+			if (geometryLodOffset == geometryLodOffsets.end())
+			{
+				geometryLodOffset = geometryLodOffsets.insert({ geometry, static_cast<uint32_t>(lods.size()) }).first;
+				for (const auto &lod : geometry->getLods())
+				{
+					lods.push_back({ geometry->getFirstIndex() + lod.indexOffset, lod.indexCount, lod.error, geometry->getVertexOffset() });
+				}
+			}
+
+			IndirectDraw draw = {};
+			setIndirectDrawTransform(&draw, mesh, instanceTransforms[instance] * modelList[j].getMeshTransform(k));
+			draw.lodOffset = geometryLodOffset->second;
+			draw.lodCount = static_cast<uint32_t>(geometry->getLods().size());
+			draw.batch = batch;
+			draw.textureId = static_cast<uint32_t>(mesh->getTexId());
+			modelDraws[j].drawIndices[i] = static_cast<uint32_t>(drawPositions.size());
+			drawPositions.push_back({ batch, static_cast<uint32_t>(batchDraws[batch].size()) });
+			batchDraws[batch].push_back(draw);
+		}
+	}
+
+	// Each batch's draws one after another, so its commands can be packed into its own range
+	std::vector<IndirectDraw> draws;
+	for (size_t i = 0; i < batches.size(); i++)
+	{
+		batches[i].firstCommand = static_cast<uint32_t>(draws.size());
+		batches[i].drawCount = static_cast<uint32_t>(batchDraws[i].size());
+		for (auto &draw : batchDraws[i])
+		{
+			draw.firstCommand = batches[i].firstCommand;
+			draws.push_back(draw);
+		}
+	}
+
+	// Positions within batches to indices of the whole draw list
+	for (auto &models : modelDraws)
+	{
+		for (uint32_t &drawIndex : models.drawIndices)
+		{
+			drawIndex = batches[drawPositions[drawIndex].first].firstCommand + drawPositions[drawIndex].second;
+		}
+	}
+
+	drawCuller.setDraws(draws, lods, batches);
+}
+
+void VulkanRenderer::updateIndirectDraws()
+{
+	for (size_t j = 0; j < modelDraws.size(); j++)
+	{
+		ModelDraws &models = modelDraws[j];
+		if (!models.nodesMoved && models.movedSlots.empty())
+		{
+			continue;
+		}
+
+		// Not drawn (not resident yet), so nothing to rewrite
+		if (models.drawIndices.empty())
+		{
+			models.movedSlots.clear();
+			models.nodesMoved = false;
+			continue;
+		}
+
+		// Moved nodes move every instance's meshes
+		modelList[j].updateTransforms();
+		const std::vector<glm::mat4> &instanceTransforms = modelList[j].getInstanceTransforms();
+		size_t meshCount = modelList[j].getMeshCount();
+		if (models.nodesMoved)
+		{
+			models.movedSlots.clear();
+			for (size_t i = 0; i < instanceTransforms.size(); i++)
+			{
+				models.movedSlots.push_back(static_cast<uint32_t>(i));
+			}
+		}
+
+		// Same draws, batches and LODs, just new transforms
+		for (uint32_t slot : models.movedSlots)
+		{
+			for (size_t k = 0; k < meshCount; k++)
+			{
+				uint32_t drawIndex = models.drawIndices[slot * meshCount + k];
+				IndirectDraw draw = drawCuller.getDraw(drawIndex);
+				setIndirectDrawTransform(&draw, modelList[j].getMesh(k), instanceTransforms[slot] * modelList[j].getMeshTransform(k));
+				drawCuller.updateDraw(drawIndex, draw);
+			}
+		}
+
+		models.movedSlots.clear();
+		models.nodesMoved = false;
+	}
+}
+
+void VulkanRenderer::setIndirectDrawTransform(IndirectDraw * draw, Mesh * mesh, const glm::mat4 & meshTransform)
+{
+	// Mesh's transform with its dequantisation folded in, and its bounding sphere in world space
+	Model dequantisation = mesh->getModel();
+	glm::vec4 boundingSphere = mesh->getBoundingSphere();
+	float scale = glm::max(glm::length(glm::vec3(meshTransform[0])),
+		glm::max(glm::length(glm::vec3(meshTransform[1])), glm::length(glm::vec3(meshTransform[2]))));
+
+	draw->model = meshTransform * dequantisation.model;
+	draw->texTransform = dequantisation.texTransform;
+	draw->sphere = glm::vec4(glm::vec3(meshTransform * glm::vec4(glm::vec3(boundingSphere), 1.0f)), boundingSphere.w * scale);
+	draw->lodScale = scale;
+}
+
+void VulkanRenderer::recordCommands(uint32_t currentImage)
+{
+	// Information about how to begin each command buffer
+	VkCommandBufferBeginInfo bufferBeginInfo = {};
+	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	// Information about how to begin a render pass (only needed for graphical applications)
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = renderPass;							// Render Pass to begin
+	renderPassBeginInfo.renderArea.offset = { 0, 0 };						// Start point of render pass in pixels
+	renderPassBeginInfo.renderArea.extent = swapChainExtent;				// Size of region to run render pass on (starting at offset)
+
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color = { 0.6f, 0.65f, 0.4f, 1.0f };
+	clearValues[1].depthStencil.depth = 1.0f;
+
+	renderPassBeginInfo.pClearValues = clearValues.data();					// List of clear values
+	renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+
+	renderPassBeginInfo.framebuffer = swapChainFramebuffers[currentImage];
+
+	// Start recording commands to command buffer!
+	VkResult result = vkBeginCommandBuffer(commandBuffers[currentImage], &bufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to start recording a Command Buffer!");
+	}
+
+	// Cull the meshlets of meshes drawn at full detail (compute work, so before the render pass)
+	if (!meshletCullDraws.empty())
+	{
+		meshletCuller.recordCulling(commandBuffers[currentImage], currentImage, meshletCullDraws);
+	}
+
+	// Or cull every draw on the GPU, writing the indirect commands the render pass draws with
+	bool gpuDriven = gpuDrivenCulling && gpuDrivenCullingEnabled;
+	if (gpuDriven)
+	{
+		glm::vec3 cameraPos = glm::vec3(glm::inverse(uboViewProjection.view)[3]);
+		float pixelsPerUnit = std::abs(uboViewProjection.projection[1][1]) * swapChainExtent.height * 0.5f;
+		drawCuller.recordCulling(commandBuffers[currentImage], currentImage, uboViewProjection.projection * uboViewProjection.view,
+			cameraPos, pixelsPerUnit);
+
+		cullingStats.visibleMeshes = drawCuller.getVisibleCount();
+		cullingStats.culledMeshes = drawCuller.getCulledCount();
+		cullingStats.occludedMeshes = drawCuller.getOccludedCount();
+	}
+
+	// Occlusion culling: draw what wasn't hidden last frame, build the depth pyramid from it, then cull what was
+	// hidden against that, so anything that has come into view is drawn by the render pass below this frame
+	if (gpuDriven && occlusionCulling)
+	{
+		renderPassBeginInfo.renderPass = firstPhaseRenderPass;
+		vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			recordIndirectDraws(currentImage, 0);
+		vkCmdEndRenderPass(commandBuffers[currentImage]);
+
+		depthPyramid.recordBuild(commandBuffers[currentImage]);
+		drawCuller.recordOcclusionCulling(commandBuffers[currentImage], currentImage);
+
+		renderPassBeginInfo.renderPass = secondPhaseRenderPass;				// Loads the first phase's colour and depth
+	}
+
+		// Begin Render Pass
+		vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+			// GPU driven culling: the whole scene in one indirect draw per batch
+			if (gpuDriven)
+			{
+				recordIndirectDraws(currentImage, occlusionCulling ? 1 : 0);
+			}
+			else
+			{
+				// Bind Pipeline to be used in render pass
+				vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+				// Bindless textures: every texture is in one set, so bind descriptor sets once for the whole pass
+				if (bindlessTextures)
+				{
+					std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], bindlessDescriptorSet };
+					vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+						0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+				}
+			}
+
+			// Arena buffers bound so far (meshes normally all share one page, so they are bound once for the pass)
+			VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+			VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+			VkIndexType boundIndexType = VK_INDEX_TYPE_UINT32;
+
+			// Texture bound so far (draws are sorted by texture, so each is bound once per pass)
+			int boundTexId = -1;
+			drawStats = {};
+
+			// Visible instances' transforms, for the whole pass (each draw starts at its own with firstInstance)
+			if (!meshDraws.empty())
+			{
+				VkDeviceSize instanceOffset = 0;
+				vkCmdBindVertexBuffers(commandBuffers[currentImage], 1, 1, &instanceBuffers[currentImage], &instanceOffset);
+				drawStats.bufferBinds++;
+			}
+
+			// Only meshes with an instance in view (see prepareDraws, none with GPU driven culling)
+			for (const MeshDraw &meshDraw : meshDraws)
+			{
+				Mesh * mesh = meshDraw.mesh;
+
+				// Transform of the mesh's node within the model combined with the mesh's dequantisation of its packed vertices
+				Model meshModel = mesh->getModel();
+				meshModel.model = meshDraw.meshTransform * meshModel.model;
 
 				// "Push" constants to given shader stage directly (no buffer)
 				vkCmdPushConstants(
@@ -1109,34 +2003,86 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
 					VK_SHADER_STAGE_VERTEX_BIT,		// Stage to push constants to
 					0,								// Offset of push constants to update
 					sizeof(Model),					// Size of data being pushed
-					&modelMatrix);			// Actual data being pushed (can be array)
-
-				for (size_t k = 0; k < thisModel.getMeshCount(); k++) {
-					VkBuffer vertexBuffers[] = { thisModel.getMesh(k)->getVertexBuffer()};					// Buffers to bind
-					VkDeviceSize offsets[] = { 0 };												// Offsets into buffers being bound
-					vkCmdBindVertexBuffers(commandBuffers[currentImage], 0, 1, vertexBuffers, offsets);	// Command to bind vertex buffer before drawing with them
-
-					// Bind mesh index buffer, with 0 offset and using the uint32 type
-					vkCmdBindIndexBuffer(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-
-					// Dynamic Offset Amount
-					// uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment) * j;
+					&meshModel);					// Actual data being pushed (can be array)
+
+				// Arena vertices (only when the mesh is on another page)
+				if (mesh->getVertexBuffer() != boundVertexBuffer)
+				{
+					boundVertexBuffer = mesh->getVertexBuffer();
+					drawStats.bufferBinds++;
+					VkDeviceSize vertexBufferOffset = 0;
+					vkCmdBindVertexBuffers(commandBuffers[currentImage], 0, 1, &boundVertexBuffer, &vertexBufferOffset);
+				}
 
-					std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage],
-						samplerDescriptorSets[thisModel.getMesh(k)->getTexId()] };
+				// Arena indices of the mesh's index type (uint16 where it fits), again only when they change,
+				// or the indices of the meshlets that survived culling (always uint32)
+				if (meshDraw.meshletCulled)
+				{
+					vkCmdBindIndexBuffer(commandBuffers[currentImage], mesh->getCulledIndexBuffer(currentImage),
+						MESHLET_CULL_HEADER_SIZE, VK_INDEX_TYPE_UINT32);
+					boundIndexBuffer = VK_NULL_HANDLE;
+					drawStats.bufferBinds++;
+				}
+				else if (mesh->getIndexBuffer() != boundIndexBuffer || mesh->getIndexType() != boundIndexType)
+				{
+					boundIndexBuffer = mesh->getIndexBuffer();
+					boundIndexType = mesh->getIndexType();
+					vkCmdBindIndexBuffer(commandBuffers[currentImage], boundIndexBuffer, 0, boundIndexType);
+					drawStats.bufferBinds++;
+				}
 
-					// Bind Descriptor Sets
-					vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-						0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+				// Dynamic Offset Amount
+				// uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment) * j;
+
+				// Texture, only when it changes
+				if (mesh->getTexId() != boundTexId)
+				{
+					boundTexId = mesh->getTexId();
+					drawStats.textureBinds++;
+
+					if (bindlessTextures)
+					{
+						// Just tell the fragment shader which texture in the array to use
+						uint32_t textureId = static_cast<uint32_t>(boundTexId);
+						vkCmdPushConstants(commandBuffers[currentImage], pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT,
+							sizeof(Model), sizeof(uint32_t), &textureId);
+					}
+					else
+					{
+						std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage],
+							samplerDescriptorSets[boundTexId] };
+
+						// Bind Descriptor Sets
+						vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+							0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+					}
+				}
+				drawStats.draws++;
 
-					// Execute pipeline
-					vkCmdDrawIndexed(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);
+				// Execute pipeline (culling wrote the index count of a culled mesh's draw)
+				if (meshDraw.meshletCulled)
+				{
+					vkCmdDrawIndexedIndirect(commandBuffers[currentImage], mesh->getCulledIndexBuffer(currentImage),
+						0, 1, sizeof(VkDrawIndexedIndirectCommand));
+				}
+				else
+				{
+					// Mesh's range of the arena
+					const MeshLod &lod = mesh->getLod();
+					vkCmdDrawIndexed(commandBuffers[currentImage], lod.indexCount, meshDraw.instanceCount,
+						mesh->getFirstIndex() + lod.indexOffset, mesh->getVertexOffset(), meshDraw.firstInstance);
 				}
 			}
 
 		// End Render Pass
 		vkCmdEndRenderPass(commandBuffers[currentImage]);
 
+	// Rebuild the pyramid from the whole frame's depth (second phase's draws included) for next frame's first phase
+	if (gpuDriven && occlusionCulling)
+	{
+		depthPyramid.recordBuild(commandBuffers[currentImage]);
+	}
+
 	// Stop recording to command buffer
 	result = vkEndCommandBuffer(commandBuffers[currentImage]);
 	if (result != VK_SUCCESS)
@@ -1146,6 +2092,17 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
 	
 }
 
+void VulkanRenderer::recordIndirectDraws(uint32_t currentImage, uint32_t phase)
+{
+	vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipeline);
+
+	std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], bindlessDescriptorSet };
+	vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipelineLayout,
+		0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+
+	drawCuller.recordDraws(commandBuffers[currentImage], currentImage, indirectPipelineLayout, 2, phase);
+}
+
 void VulkanRenderer::getPhysicalDevice()
 {
 	// Enumerate Physical devices the vkInstance can access
@@ -1286,74 +2243,236 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 	return indices.isValid() && extensionsSupported && swapChainValid && deviceFeatures.samplerAnisotropy;
 }
 
-QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
+bool VulkanRenderer::checkBindlessTextureSupport(VkPhysicalDevice device, VkPhysicalDeviceDescriptorIndexingFeaturesEXT * indexingFeatures)
 {
-	QueueFamilyIndices indices;
+	// Feature/limit queries below need Vulkan 1.1 on both instance and device
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device, &deviceProperties);
+	if (instanceApiVersion < VK_API_VERSION_1_1 || deviceProperties.apiVersion < VK_API_VERSION_1_1)
+	{
+		return false;
+	}
 
-	// Get all Queue Family Property info for the given device
-	uint32_t queueFamilyCount = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	// Bindless fragment shader has to have been compiled (see Shaders/compile.bat)
+	if (!std::ifstream("Shaders/frag_bindless.spv").good())
+	{
+		return false;
+	}
 
-	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilyList.data());
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
 
-	// Go through each queue family and check if it has at least 1 of the required types of queue
-	int i = 0;
-	for (const auto &queueFamily : queueFamilyList)
+	bool hasExtension = false;
+	for (const auto &extension : extensions)
 	{
-		// First check if queue family has at least 1 queue in that family (could have no queues)
-		// Queue can be multiple types defined through bitfield. Need to bitwise AND with VK_QUEUE_*_BIT to check if has required type
-		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		if (strcmp(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, extension.extensionName) == 0)
 		{
-			indices.graphicsFamily = i;		// If queue family is valid, then get index
+			hasExtension = true;
+			break;
 		}
+	}
+	if (!hasExtension)
+	{
+		return false;
+	}
 
-		// Check if Queue Family supports presentation
-		VkBool32 presentationSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
-		// Check if queue is presentation type (can be both graphics and presentation)
-		if (queueFamily.queueCount > 0 && presentationSupport)
-		{
-			indices.presentationFamily = i;
-		}
+	// Check for the features the texture array needs
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
 
-		// Check if queue family indices are in a valid state, stop searching if so
-		if (indices.isValid())
-		{
-			break;
-		}
+	VkPhysicalDeviceFeatures2 deviceFeatures = {};
+	deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures.pNext = &supportedFeatures;
+	vkGetPhysicalDeviceFeatures2(device, &deviceFeatures);
 
-		i++;
+	if (!supportedFeatures.runtimeDescriptorArray || !supportedFeatures.descriptorBindingPartiallyBound ||
+		!supportedFeatures.descriptorBindingSampledImageUpdateAfterBind || !supportedFeatures.descriptorBindingUpdateUnusedWhilePending)
+	{
+		return false;
 	}
 
-	return indices;
-}
+	// Array size is limited by how many update-after-bind samplers a stage/set can have
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = {};
+	indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
 
-SwapChainDetails VulkanRenderer::getSwapChainDetails(VkPhysicalDevice device)
-{
-	SwapChainDetails swapChainDetails;
+	VkPhysicalDeviceProperties2 deviceProperties2 = {};
+	deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	deviceProperties2.pNext = &indexingProperties;
+	vkGetPhysicalDeviceProperties2(device, &deviceProperties2);
 
-	// -- CAPABILITIES --
-	// Get the surface capabilities for the given surface on the given physical device
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &swapChainDetails.surfaceCapabilities);
+	bindlessTextureCount = std::min({ MAX_BINDLESS_TEXTURES,
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers, indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSamplers, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages });
 
-	// -- FORMATS --
-	uint32_t formatCount = 0;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+	// Enable just what we use
+	indexingFeatures->runtimeDescriptorArray = VK_TRUE;
+	indexingFeatures->descriptorBindingPartiallyBound = VK_TRUE;
+	indexingFeatures->descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	indexingFeatures->descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
 
-	// If formats returned, get list of formats
-	if (formatCount != 0)
+	return true;
+}
+
+bool VulkanRenderer::checkMeshletCullingSupport(VkPhysicalDevice device)
+{
+	// Only needs compute on the graphics queue (always there, see getQueueFamilies), and the culling shader compiled (see Shaders/compile.bat)
+	if (!std::ifstream("Shaders/meshlet_cull.spv").good())
 	{
-		swapChainDetails.formats.resize(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, swapChainDetails.formats.data());
+		return false;
 	}
 
-	// -- PRESENTATION MODES --
-	uint32_t presentationCount = 0;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentationCount, nullptr);
+	// Culled draw starts at the mesh's instance in the frame's instance buffer
+	VkPhysicalDeviceFeatures deviceFeatures;
+	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+	return deviceFeatures.drawIndirectFirstInstance == VK_TRUE;
+}
 
-	// If presentation modes returned, get list of presentation modes
-	if (presentationCount != 0)
+bool VulkanRenderer::checkGpuDrivenCullingSupport(VkPhysicalDevice device, bool * drawIndirectCount)
+{
+	// Culling and indirect drawing shaders have to have been compiled (see Shaders/compile.bat)
+	if (!std::ifstream("Shaders/draw_cull.spv").good() || !std::ifstream("Shaders/vert_indirect.spv").good() ||
+		!std::ifstream("Shaders/frag_indirect.spv").good())
+	{
+		return false;
+	}
+
+	// Several draws per indirect draw, each starting at its own instance
+	VkPhysicalDeviceFeatures deviceFeatures;
+	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+	if (!deviceFeatures.multiDrawIndirect || !deviceFeatures.drawIndirectFirstInstance)
+	{
+		return false;
+	}
+
+	// Drawing only as many commands as the GPU wrote is optional (otherwise the unused ones are empty)
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+
+	*drawIndirectCount = false;
+	for (const auto &extension : extensions)
+	{
+		if (strcmp(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME, extension.extensionName) == 0)
+		{
+			*drawIndirectCount = true;
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool VulkanRenderer::checkOcclusionCullingSupport(VkPhysicalDevice device)
+{
+	// Culling and depth pyramid shaders have to have been compiled (see Shaders/compile.bat)
+	if (!std::ifstream("Shaders/draw_cull_occlusion.spv").good() || !std::ifstream("Shaders/hiz_reduce.spv").good())
+	{
+		return false;
+	}
+
+	// Depth pyramid is built by sampling the depth buffer (R32_SFLOAT storage images are always supported)
+	VkFormat depthFormat = chooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(device, depthFormat, &properties);
+	return (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
+
+QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
+{
+	QueueFamilyIndices indices;
+
+	// Get all Queue Family Property info for the given device
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilyList.data());
+
+	// Go through each queue family and check if it has at least 1 of the required types of queue
+	int i = 0;
+	for (const auto &queueFamily : queueFamilyList)
+	{
+		// First check if queue family has at least 1 queue in that family (could have no queues)
+		// Queue can be multiple types defined through bitfield. Need to bitwise AND with VK_QUEUE_*_BIT to check if has required type
+		// Graphics queue also runs compute work (meshlet culling), and there is always a family with both
+		if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
+		{
+			indices.graphicsFamily = i;		// If queue family is valid, then get index
+		}
+
+		// Check if Queue Family supports presentation
+		VkBool32 presentationSupport = false;
+		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+		// Check if queue is presentation type (can be both graphics and presentation)
+		if (queueFamily.queueCount > 0 && presentationSupport)
+		{
+			indices.presentationFamily = i;
+		}
+
+		// Check if queue family indices are in a valid state, stop searching if so
+		if (indices.isValid())
+		{
+			break;
+		}
+
+		i++;
+	}
+
+	// Prefer a transfer-only family (usually a dedicated DMA engine), so uploads don't queue behind rendering
+	i = 0;
+	for (const auto &queueFamily : queueFamilyList)
+	{
+		if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT)
+			&& !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			indices.transferFamily = i;
+			break;
+		}
+
+		i++;
+	}
+
+	// No dedicated transfer family, so graphics family (which always supports transfer) does uploads
+	if (indices.transferFamily < 0)
+	{
+		indices.transferFamily = indices.graphicsFamily;
+	}
+
+	return indices;
+}
+
+SwapChainDetails VulkanRenderer::getSwapChainDetails(VkPhysicalDevice device)
+{
+	SwapChainDetails swapChainDetails;
+
+	// -- CAPABILITIES --
+	// Get the surface capabilities for the given surface on the given physical device
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &swapChainDetails.surfaceCapabilities);
+
+	// -- FORMATS --
+	uint32_t formatCount = 0;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+
+	// If formats returned, get list of formats
+	if (formatCount != 0)
+	{
+		swapChainDetails.formats.resize(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, swapChainDetails.formats.data());
+	}
+
+	// -- PRESENTATION MODES --
+	uint32_t presentationCount = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentationCount, nullptr);
+
+	// If presentation modes returned, get list of presentation modes
+	if (presentationCount != 0)
 	{
 		swapChainDetails.presentationModes.resize(presentationCount);
 		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentationCount, swapChainDetails.presentationModes.data());
@@ -1453,7 +2572,7 @@ VkFormat VulkanRenderer::chooseSupportedFormat(const std::vector<VkFormat>& form
 	throw std::runtime_error("Failed to find a matching format!");
 }
 
-VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory * imageMemory)
+VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, DeviceAllocation * imageMemory, uint32_t mipLevels)
 {
 	// CREATE IMAGE
 	// Image Creation Info
@@ -1463,7 +2582,7 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	imageCreateInfo.extent.width = width;								// Width of image extent
 	imageCreateInfo.extent.height = height;								// Height of image extent
 	imageCreateInfo.extent.depth = 1;									// Depth of image (just 1, no 3D aspect)
-	imageCreateInfo.mipLevels = 1;										// Number of mipmap levels
+	imageCreateInfo.mipLevels = mipLevels;								// Number of mipmap levels
 	imageCreateInfo.arrayLayers = 1;									// Number of levels in image array
 	imageCreateInfo.format = format;									// Format type of image
 	imageCreateInfo.tiling = tiling;									// How image data should be "tiled" (arranged for optimal reading)
@@ -1486,25 +2605,17 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	VkMemoryRequirements memoryRequirements;
 	vkGetImageMemoryRequirements(mainDevice.logicalDevice, image, &memoryRequirements);
 
-	// Allocate memory using image requirements and user defined properties
-	VkMemoryAllocateInfo memoryAllocInfo = {};
-	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocInfo.allocationSize = memoryRequirements.size;
-	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
-
-	result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocInfo, nullptr, imageMemory);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate memory for image!");
-	}
+	// Sub-allocate memory using image requirements and user defined properties
+	// (optimal tiled images come from separate blocks to buffers, linear tiled ones can share with buffers)
+	*imageMemory = allocator.allocate(memoryRequirements, propFlags, tiling == VK_IMAGE_TILING_LINEAR);
 
 	// Connect memory to image
-	vkBindImageMemory(mainDevice.logicalDevice, image, *imageMemory, 0);
+	vkBindImageMemory(mainDevice.logicalDevice, image, imageMemory->memory, imageMemory->offset);
 
 	return image;
 }
 
-VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
 {
 	VkImageViewCreateInfo viewCreateInfo = {};
 	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1519,7 +2630,7 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
 	// Subresources allow the view to view only a part of an image
 	viewCreateInfo.subresourceRange.aspectMask = aspectFlags;				// Which aspect of image to view (e.g. COLOR_BIT for viewing colour)
 	viewCreateInfo.subresourceRange.baseMipLevel = 0;						// Start mipmap level to view from
-	viewCreateInfo.subresourceRange.levelCount = 1;							// Number of mipmap levels to view
+	viewCreateInfo.subresourceRange.levelCount = mipLevels;					// Number of mipmap levels to view
 	viewCreateInfo.subresourceRange.baseArrayLayer = 0;						// Start array level to view from
 	viewCreateInfo.subresourceRange.layerCount = 1;							// Number of array levels to view
 
@@ -1552,92 +2663,282 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 	return shaderModule;
 }
 
-int VulkanRenderer::createTextureImage(std::string fileName)
+VkImage VulkanRenderer::createTextureImage(TextureData * textureData, UploadBatch * uploadBatch, DeviceAllocation * imageMemory)
 {
-	// Load image file
-	int width, height;
-	VkDeviceSize imageSize;
-	stbi_uc * imageData = loadTextureFile(fileName, &width, &height, &imageSize);
+	int width = textureData->width;
+	int height = textureData->height;
+	uint32_t mipLevels = textureData->mipLevels;
 
-	// Create staging buffer to hold loaded data, ready to copy to device
-	VkBuffer imageStagingBuffer;
-	VkDeviceMemory imageStagingBufferMemory;
-	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&imageStagingBuffer, &imageStagingBufferMemory);
+	// Pre-built levels (from a KTX2 file) are copied straight in, in the format they were stored in
+	if (!textureData->levels.empty())
+	{
+		VkImage texImage = createImage(width, height, textureData->format, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			imageMemory, mipLevels);
 
-	// Copy image data to staging buffer
-	void *data;
-	vkMapMemory(mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, imageData, static_cast<size_t>(imageSize));
-	vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
+		uploadBatch->transitionImageLayout(texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
 
-	// Free original image data
-	stbi_image_free(imageData);
+		for (uint32_t i = 0; i < mipLevels; i++)
+		{
+			const TextureLevel &level = textureData->levels[i];
+			uploadBatch->uploadToImage(texImage, level.width, level.height, textureData->format, textureData->levelData.data() + level.offset, i);
+		}
 
-	// Create image to hold final texture
+		uploadBatch->releaseImage(texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+
+		// Free level data (it is in the staging ring now)
+		std::vector<unsigned char>().swap(textureData->levelData);
+		textureData->levels.clear();
+
+		return texImage;
+	}
+
+	// Otherwise image file already decoded (pixel data is freed once it is in the staging ring)
+	stbi_uc * imageData = textureData->pixels;
+
+	// Create image to hold final texture (also a transfer source, as each level is blitted from the one above)
 	VkImage texImage;
-	VkDeviceMemory texImageMemory;
 	texImage = createImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory);
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		imageMemory, mipLevels);
 
 
 	// COPY DATA TO IMAGE
-	// Transition image to be DST for copy operation
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, 
-		texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	// Transition every level to be DST for copy/blit operations
+	uploadBatch->transitionImageLayout(texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+
+	// Copy image data through the staging ring (may be split into row chunks if the ring is busy)
+	uploadBatch->uploadToImage(texImage, width, height, VK_FORMAT_R8G8B8A8_UNORM, imageData);
+
+	// Mip chain can be blitted on the GPU if the format supports linear filtered blits
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+	VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+	if ((formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures)
+	{
+		// Blit each level from the one above, ending with the whole image shader readable
+		uploadBatch->generateMipmaps(texImage, width, height, mipLevels);
+	}
+	else
+	{
+		// Otherwise box filter each level on the CPU and upload them all
+		std::vector<unsigned char> srcLevel(imageData, imageData + textureData->imageSize);
+		uint32_t levelWidth = width;
+		uint32_t levelHeight = height;
 
-	// Copy image data
-	copyImageBuffer(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, imageStagingBuffer, texImage, width, height);
+		for (uint32_t i = 1; i < mipLevels; i++)
+		{
+			uint32_t nextWidth = std::max(levelWidth / 2, 1u);
+			uint32_t nextHeight = std::max(levelHeight / 2, 1u);
 
-	// Transition image to be shader readable for shader usage
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool,
-		texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			std::vector<unsigned char> dstLevel(nextWidth * nextHeight * 4);
+			generateMipLevel(srcLevel.data(), levelWidth, levelHeight, dstLevel.data());
+			uploadBatch->uploadToImage(texImage, nextWidth, nextHeight, VK_FORMAT_R8G8B8A8_UNORM, dstLevel.data(), i);
 
-	// Add texture data to vector for reference
-	textureImages.push_back(texImage);
-	textureImageMemory.push_back(texImageMemory);
+			srcLevel.swap(dstLevel);
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+		}
 
-	// Destroy staging buffers
-	vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
+		// Transition image to be shader readable for shader usage (and hand it to the graphics queue)
+		uploadBatch->releaseImage(texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+	}
 
-	// Return index of new texture image
-	return textureImages.size() - 1;
+	// Free original image data
+	stbi_image_free(imageData);
+	textureData->pixels = nullptr;
+
+	return texImage;
 }
 
-int VulkanRenderer::createTexture(std::string fileName)
+int VulkanRenderer::createTexture(TextureData * textureData, UploadBatch * uploadBatch)
 {
-	// Create Texture Image and get its location in array
-	int textureImageLoc = createTextureImage(fileName);
+	// Texture data is freed once uploaded, so keep what the view needs
+	VkFormat format = textureData->format;
+	uint32_t mipLevels = textureData->mipLevels;
+
+	// Re-use the slot of a released texture if there is one, otherwise add a new slot to every texture list
+	int textureId;
+	if (!freeTextureIds.empty())
+	{
+		textureId = freeTextureIds.back();
+		freeTextureIds.pop_back();
+	}
+	else
+	{
+		textureId = static_cast<int>(textureImages.size());
+		textureImages.push_back(VK_NULL_HANDLE);
+		textureImageMemory.push_back(DeviceAllocation());
+		textureImageViews.push_back(VK_NULL_HANDLE);
+		samplerDescriptorSets.push_back(VK_NULL_HANDLE);
+		textureKeys.push_back("");
+		textureRefCounts.push_back(0);
+	}
 
-	// Create Image View and add to list
-	VkImageView imageView = createImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-	textureImageViews.push_back(imageView);
+	// Create Texture Image
+	textureImages[textureId] = createTextureImage(textureData, uploadBatch, &textureImageMemory[textureId]);
+
+	// Create Image View (covering every mip level)
+	textureImageViews[textureId] = createImageView(textureImages[textureId], format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
 
 	// Create Texture Descriptor
-	int descriptorLoc = createTextureDescriptor(imageView);
+	samplerDescriptorSets[textureId] = createTextureDescriptor(textureId, textureImageViews[textureId]);
+
+	// Return id of texture (location of its descriptor set)
+	return textureId;
+}
+
+int VulkanRenderer::acquireTexture(TextureData * textureData, UploadBatch * uploadBatch)
+{
+	std::string cacheKey = getTextureCacheKey(textureData->fileName);
+
+	{
+		std::unique_lock<std::mutex> lock(textureCacheMutex);
 
-	// Return location of set with texture
-	return descriptorLoc;
+		// Only the render thread acquires textures, and only this call makes pending entries, so one can't be seen here
+		auto cachedTexture = textureCache.find(cacheKey);
+		if (cachedTexture != textureCache.end() && cachedTexture->second == TEXTURE_PENDING)
+		{
+			throw std::runtime_error("Texture acquired while it is still being created!");
+		}
+
+		// Already loaded, so share it (and drop any pixels decoded before we knew)
+		if (cachedTexture != textureCache.end())
+		{
+			int textureId = cachedTexture->second;
+			textureRefCounts[textureId]++;
+			lock.unlock();
+
+			if (textureData->pixels != nullptr)
+			{
+				stbi_image_free(textureData->pixels);
+				textureData->pixels = nullptr;
+			}
+			std::vector<unsigned char>().swap(textureData->levelData);
+			textureData->levels.clear();
+
+			return textureId;
+		}
+
+		// Mark it pending, so the cache isn't locked while it is decoded and uploaded, but loader threads checking
+		// isTextureCached still skip decoding it
+		textureCache[cacheKey] = TEXTURE_PENDING;
+	}
+
+	int textureId;
+	try
+	{
+		// Loader skipped decoding because it was cached then, but it has been released since
+		if (textureData->pixels == nullptr && textureData->levels.empty())
+		{
+			*textureData = loadTextureData(textureData->fileName);
+		}
+
+		textureId = createTexture(textureData, uploadBatch);
+	}
+	catch (...)
+	{
+		// Drop the pending entry, so the next load of it tries again
+		{
+			std::lock_guard<std::mutex> lock(textureCacheMutex);
+			textureCache.erase(cacheKey);
+		}
+		throw;
+	}
+
+	// Publish it
+	{
+		std::lock_guard<std::mutex> lock(textureCacheMutex);
+		textureCache[cacheKey] = textureId;
+		textureKeys[textureId] = cacheKey;
+		textureRefCounts[textureId] = 1;
+	}
+
+	return textureId;
 }
 
-int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
+void VulkanRenderer::releaseTexture(int textureId)
+{
+	std::lock_guard<std::mutex> lock(textureCacheMutex);
+
+	textureRefCounts[textureId]--;
+	if (textureRefCounts[textureId] > 0)
+	{
+		return;
+	}
+
+	// Last user gone (caller makes sure GPU is no longer using it)
+	// (bindless array element is just left stale until the id is reused, which partially bound arrays allow)
+	if (samplerDescriptorSets[textureId] != VK_NULL_HANDLE)
+	{
+		vkFreeDescriptorSets(mainDevice.logicalDevice, samplerDescriptorPool, 1, &samplerDescriptorSets[textureId]);
+	}
+	vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[textureId], nullptr);
+	vkDestroyImage(mainDevice.logicalDevice, textureImages[textureId], nullptr);
+	allocator.free(textureImageMemory[textureId]);
+
+	samplerDescriptorSets[textureId] = VK_NULL_HANDLE;
+	textureImageViews[textureId] = VK_NULL_HANDLE;
+	textureImages[textureId] = VK_NULL_HANDLE;
+
+	textureCache.erase(textureKeys[textureId]);
+	textureKeys[textureId].clear();
+	freeTextureIds.push_back(textureId);
+}
+
+std::string VulkanRenderer::getTextureCacheKey(const std::string &fileName)
+{
+	// Same file can be named with either slash, and (on Windows) in any case
+	std::string cacheKey = "Textures/" + fileName;
+	std::replace(cacheKey.begin(), cacheKey.end(), '\\', '/');
+
+#ifdef _WIN32
+	std::transform(cacheKey.begin(), cacheKey.end(), cacheKey.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
+#endif
+
+	return cacheKey;
+}
+
+bool VulkanRenderer::isTextureCached(const std::string &fileName)
+{
+	std::string cacheKey = getTextureCacheKey(fileName);
+
+	std::lock_guard<std::mutex> lock(textureCacheMutex);
+	return textureCache.find(cacheKey) != textureCache.end();
+}
+
+VkDescriptorSet VulkanRenderer::createTextureDescriptor(int textureId, VkImageView textureImage)
 {
 	VkDescriptorSet descriptorSet;
+	uint32_t arrayElement = 0;
 
-	// Descriptor Set Allocation Info
-	VkDescriptorSetAllocateInfo setAllocInfo = {};
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = samplerDescriptorPool;
-	setAllocInfo.descriptorSetCount = 1;
-	setAllocInfo.pSetLayouts = &samplerSetLayout;
+	if (bindlessTextures)
+	{
+		// Texture goes in the bindless array at its id (no set of its own)
+		if (static_cast<uint32_t>(textureId) >= bindlessTextureCount)
+		{
+			throw std::runtime_error("Too many textures for the bindless texture array!");
+		}
 
-	// Allocate Descriptor Sets
-	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &descriptorSet);
-	if (result != VK_SUCCESS)
+		descriptorSet = bindlessDescriptorSet;
+		arrayElement = static_cast<uint32_t>(textureId);
+	}
+	else
 	{
-		throw std::runtime_error("Failed to allocate Texture Descriptor Sets!");
+		// Descriptor Set Allocation Info
+		VkDescriptorSetAllocateInfo setAllocInfo = {};
+		setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		setAllocInfo.descriptorPool = samplerDescriptorPool;
+		setAllocInfo.descriptorSetCount = 1;
+		setAllocInfo.pSetLayouts = &samplerSetLayout;
+
+		// Allocate Descriptor Sets
+		VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &descriptorSet);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate Texture Descriptor Sets!");
+		}
 	}
 
 	// Texture Image Info
@@ -1651,7 +2952,7 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
 	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	descriptorWrite.dstSet = descriptorSet;
 	descriptorWrite.dstBinding = 0;
-	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.dstArrayElement = arrayElement;
 	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	descriptorWrite.descriptorCount = 1;
 	descriptorWrite.pImageInfo = &imageInfo;
@@ -1659,57 +2960,554 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
 	// Update new descriptor set
 	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
 
-	// Add descriptor set to list
-	samplerDescriptorSets.push_back(descriptorSet);
-
-	// Return descriptor set location
-	return samplerDescriptorSets.size() - 1;
+	// Only return sets owned by this texture
+	return bindlessTextures ? VK_NULL_HANDLE : descriptorSet;
 }
 
 int VulkanRenderer::createMeshModel(std::string modelFile)
 {
-	// Import model scene
-	Assimp::Importer importer;
+	// Load the same way as a background load (so textures still decode in parallel), but wait for it here, until the
+	// model is resident
+	int modelId = createMeshModelAsync(modelFile);
 
-	const aiScene* scene = importer.ReadFile(modelFile, 
-		aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+	// Finish the geometry's load, unless it was already loaded for another model
+	for (size_t i = 0; i < pendingModelLoads.size(); i++)
+	{
+		if (pendingModelLoads[i].geometryId != modelGeometries[modelId])
+		{
+			continue;
+		}
 
-	if (!scene) {
-		throw std::runtime_error("error occurred while loadig model: " + modelFile);
+		PendingModelLoad pendingLoad = std::move(pendingModelLoads[i]);
+		pendingModelLoads.erase(pendingModelLoads.begin() + i);
+
+		// Returns once everything is recorded and submitted
+		updateModelLoad(&pendingLoad, true);
+		if (!pendingLoad.error.empty())
+		{
+			// Don't leave the placeholder (and its geometry reference) behind
+			destroyMeshModel(modelId);
+			throw std::runtime_error(pendingLoad.error);
+		}
+		break;
 	}
 
-	// Get vector of all materials with 1:1 ID placement
-	std::vector<std::string> textureNames = MeshModel::LoadMaterials(scene);
+	updateWaitingModels();
+
+	// Geometry still isn't there (an earlier load of the same file failed)
+	if (std::find(waitingModels.begin(), waitingModels.end(), modelId) != waitingModels.end() ||
+		geometries[modelGeometries[modelId]]->failed)
+	{
+		destroyMeshModel(modelId);
+		throw std::runtime_error("Failed to load model: " + modelFile);
+	}
+
+	// Wait for the upload, so the model is resident (drawn) straight away
+	modelUploads[modelId].wait();
+	modelResident[modelId] = true;
+	uploadingModels.erase(std::remove(uploadingModels.begin(), uploadingModels.end(), modelId), uploadingModels.end());
+	drawListChanged = true;
+
+	return modelId;
+}
+
+int VulkanRenderer::createMeshModelAsync(std::string modelFile)
+{
+	// Empty placeholder model, draws nothing until its geometry is loaded
+	int modelId = addModelSlot();
+	waitingModels.push_back(modelId);
+
+	// Models of the same file share one copy of its geometry, so only the first one loads it
+	bool created;
+	bool optimiseMeshes = meshOptimisation;
+	int geometryId = acquireGeometry(modelFile, optimiseMeshes, &created);
+	modelGeometries[modelId] = geometryId;
+	if (!created)
+	{
+		return modelId;
+	}
+
+	// Import on a loader thread (textures are decoded once the import tells us which ones the model needs)
+	PendingModelLoad pendingLoad;
+	pendingLoad.geometryId = geometryId;
+	pendingLoad.modelData = std::make_shared<ModelData>();
+	pendingLoad.imported = false;
+	pendingLoad.uploadBatch = UploadBatch(&stagingRing);
+	pendingLoad.cancelled = false;
+
+	std::shared_ptr<ModelData> modelData = pendingLoad.modelData;
+	pendingLoad.loaded = loaderPool.enqueue([this, modelFile, optimiseMeshes, modelData]() {
+		*modelData = loadModelData(modelFile, optimiseMeshes);
+	});
+
+	pendingModelLoads.push_back(std::move(pendingLoad));
+
+	// Handle is valid straight away (e.g. for updateModel)
+	return modelId;
+}
+
+void VulkanRenderer::destroyMeshModel(int modelId)
+{
+	if (modelId >= modelList.size()) return;
+
+	// Still waiting for its geometry: nothing has been made for it yet
+	auto waitingModel = std::find(waitingModels.begin(), waitingModels.end(), modelId);
+	if (waitingModel != waitingModels.end())
+	{
+		waitingModels.erase(waitingModel);
+	}
+	else
+	{
+		// GPU may still be uploading or drawing the model, so wait for it
+		modelUploads[modelId].wait();
+		vkQueueWaitIdle(graphicsQueue);
+
+		for (size_t i = 0; i < modelList[modelId].getMeshCount(); i++)
+		{
+			meshletCuller.destroyMeshCulling(modelList[modelId].getMesh(i));
+		}
+		modelList[modelId].destroyMeshModel();
+	}
+
+	// Drop model's geometry reference (geometry and its textures are freed when no model uses them)
+	if (modelGeometries[modelId] >= 0)
+	{
+		releaseGeometry(modelGeometries[modelId]);
+	}
+
+	// Slot becomes an empty model, so other model ids stay valid
+	modelList[modelId] = MeshModel();
+	modelUploads[modelId] = UploadBatch();
+	modelResident[modelId] = false;
+	modelGeometries[modelId] = -1;
+	uploadingModels.erase(std::remove(uploadingModels.begin(), uploadingModels.end(), modelId), uploadingModels.end());
+	drawListChanged = true;
+}
+
+void VulkanRenderer::setMeshOptimisation(bool enabled)
+{
+	// Only affects models loaded after this
+	meshOptimisation = enabled;
+}
+
+void VulkanRenderer::setGpuDrivenCulling(bool enabled)
+{
+	// Falls back to culling on the CPU if the device can't
+	gpuDrivenCullingEnabled = enabled;
+	drawListChanged = true;
+}
+
+void VulkanRenderer::updateModelLoads()
+{
+	// Move background loads along: upload textures as they finish decoding, then meshes once all are in (doesn't block)
+	for (size_t i = 0; i < pendingModelLoads.size();)
+	{
+		if (!updateModelLoad(&pendingModelLoads[i], false))
+		{
+			i++;
+			continue;
+		}
+
+		// Failed model stays an empty placeholder
+		if (!pendingModelLoads[i].error.empty())
+		{
+			printf("ERROR: %s\n", pendingModelLoads[i].error.c_str());
+		}
+
+		pendingModelLoads.erase(pendingModelLoads.begin() + i);
+	}
+
+	// Make the models whose geometry has just loaded
+	updateWaitingModels();
+
+	// Models become resident once their upload has finished on the GPU (polls fences, doesn't block)
+	for (size_t i = 0; i < uploadingModels.size();)
+	{
+		int modelId = uploadingModels[i];
+		if (modelUploads[modelId].isComplete())
+		{
+			modelResident[modelId] = true;
+			uploadingModels.erase(uploadingModels.begin() + i);
+			drawListChanged = true;
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+int VulkanRenderer::addModelSlot()
+{
+	modelList.push_back(MeshModel());
+	modelUploads.push_back(UploadBatch());
+	modelResident.push_back(false);
+	modelGeometries.push_back(-1);
+
+	return static_cast<int>(modelList.size()) - 1;
+}
+
+int VulkanRenderer::acquireGeometry(const std::string &modelFile, bool optimiseMeshes, bool * created)
+{
+	std::string cacheKey = getGeometryCacheKey(modelFile, optimiseMeshes);
+
+	// Already loaded (or loading), so share it
+	auto cachedGeometry = geometryCache.find(cacheKey);
+	if (cachedGeometry != geometryCache.end())
+	{
+		geometryRefCounts[cachedGeometry->second]++;
+		*created = false;
+		return cachedGeometry->second;
+	}
+
+	// Re-use the slot of a released geometry if there is one
+	int geometryId;
+	if (!freeGeometryIds.empty())
+	{
+		geometryId = freeGeometryIds.back();
+		freeGeometryIds.pop_back();
+	}
+	else
+	{
+		geometryId = static_cast<int>(geometries.size());
+		geometries.push_back(nullptr);
+		geometryKeys.push_back("");
+		geometryRefCounts.push_back(0);
+	}
+
+	geometries[geometryId].reset(new ModelGeometry());
+	geometryCache[cacheKey] = geometryId;
+	geometryKeys[geometryId] = cacheKey;
+	geometryRefCounts[geometryId] = 1;
+
+	*created = true;
+	return geometryId;
+}
+
+void VulkanRenderer::releaseGeometry(int geometryId)
+{
+	geometryRefCounts[geometryId]--;
+	if (geometryRefCounts[geometryId] > 0)
+	{
+		return;
+	}
+
+	// Nothing can share it from now on
+	auto cachedGeometry = geometryCache.find(geometryKeys[geometryId]);
+	if (cachedGeometry != geometryCache.end() && cachedGeometry->second == geometryId)
+	{
+		geometryCache.erase(cachedGeometry);
+	}
+
+	// Still loading: let the load finish in the background, but throw the result away (slot is freed then)
+	for (auto &pendingLoad : pendingModelLoads)
+	{
+		if (pendingLoad.geometryId == geometryId)
+		{
+			pendingLoad.cancelled = true;
+			return;
+		}
+	}
+
+	// Last user gone (caller makes sure GPU is no longer drawing it, but its upload may still be running)
+	ModelGeometry &geometry = *geometries[geometryId];
+	geometry.uploadBatch.wait();
+	for (auto &meshGeometry : geometry.meshes)
+	{
+		meshGeometry.destroyBuffers();
+	}
+	for (int textureId : geometry.textureIds)
+	{
+		releaseTexture(textureId);
+	}
+
+	freeGeometrySlot(geometryId);
+}
+
+void VulkanRenderer::freeGeometrySlot(int geometryId)
+{
+	geometries[geometryId].reset();
+	geometryKeys[geometryId].clear();
+	freeGeometryIds.push_back(geometryId);
+}
+
+std::string VulkanRenderer::getGeometryCacheKey(const std::string &modelFile, bool optimiseMeshes)
+{
+	// Same file can be named with either slash, and (on Windows) in any case
+	std::string cacheKey = modelFile;
+	std::replace(cacheKey.begin(), cacheKey.end(), '\\', '/');
+
+#ifdef _WIN32
+	std::transform(cacheKey.begin(), cacheKey.end(), cacheKey.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
+#endif
+
+	// Meshes imported without optimisation are different geometry
+	return optimiseMeshes ? cacheKey : cacheKey + "|unoptimised";
+}
+
+void VulkanRenderer::updateWaitingModels()
+{
+	for (size_t i = 0; i < waitingModels.size();)
+	{
+		int modelId = waitingModels[i];
+		ModelGeometry &geometry = *geometries[modelGeometries[modelId]];
+
+		// Failed model stays an empty placeholder
+		if (geometry.loaded)
+		{
+			createModelFromGeometry(modelId);
+		}
+		else if (!geometry.failed)
+		{
+			i++;
+			continue;
+		}
+
+		waitingModels.erase(waitingModels.begin() + i);
+	}
+}
+
+void VulkanRenderer::createModelFromGeometry(int modelId)
+{
+	ModelGeometry &geometry = *geometries[modelGeometries[modelId]];
+
+	// A mesh for every use of the geometry's meshes (with its own LOD and culling state), and the node each hangs from
+	std::vector<Mesh> modelMeshes;
+	std::vector<uint32_t> meshNodes;
+	for (const auto &meshReference : geometry.meshReferences) {
+		Mesh mesh(&allocator, mainDevice.logicalDevice, &geometry.meshes[meshReference.mesh], geometry.meshTexIds[meshReference.mesh]);
+
+		// Meshlets culled on the GPU (meshes whose culling can't be set up are just drawn whole)
+		if (mesh.getMeshletCount() > 0) {
+			mesh.createCulledIndexBuffers(static_cast<uint32_t>(swapChainImages.size()));
+			if (!meshletCuller.createMeshCulling(&mesh)) {
+				mesh.destroyCulledIndexBuffers();
+			}
+		}
+
+		modelMeshes.push_back(mesh);
+		meshNodes.push_back(meshReference.node);
+	}
+
+	// Replace placeholder with real model (keeping any transform and instances already set on the handle)
+	ModelInstances instances = modelList[modelId].getInstances();
+	modelList[modelId] = MeshModel(modelMeshes, geometry.nodes, meshNodes);
+	modelList[modelId].setInstances(instances);
+
+	// Drawn once the geometry's upload has finished
+	modelUploads[modelId] = geometry.uploadBatch;
+	uploadingModels.push_back(modelId);
+}
+
+void VulkanRenderer::startTextureDecodes(PendingModelLoad * pendingLoad)
+{
+	std::shared_ptr<ModelData> modelData = pendingLoad->modelData;
+	pendingLoad->textureIds.assign(modelData->textures.size(), -1);
+
+	// Decode each texture once (materials sharing it get it from the cache), skipping any that are already loaded
+	std::set<std::string> decodingKeys;
+	for (size_t i = 0; i < modelData->textures.size(); i++)
+	{
+		const std::string &fileName = modelData->textures[i].fileName;
+		if (fileName.empty() || isTextureCached(fileName) || !decodingKeys.insert(getTextureCacheKey(fileName)).second)
+		{
+			continue;
+		}
+
+		// Every texture is a separate task, so they decode in parallel across the loader threads
+		PendingTextureDecode textureDecode;
+		textureDecode.textureIndex = i;
+		textureDecode.decoded = loaderPool.enqueue([this, modelData, i]() {
+			// Only this task touches this texture until it is done
+			modelData->textures[i] = loadTextureData(modelData->textures[i].fileName);
+		});
+
+		pendingLoad->textureDecodes.push_back(std::move(textureDecode));
+	}
+}
+
+bool VulkanRenderer::updateModelLoad(PendingModelLoad * pendingLoad, bool wait)
+{
+	ModelData * modelData = pendingLoad->modelData.get();
+
+	// Once the scene is imported, start decoding its textures
+	if (!pendingLoad->imported)
+	{
+		if (!wait && pendingLoad->loaded.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			return false;
+		}
+
+		pendingLoad->imported = true;
+		try {
+			pendingLoad->loaded.get();		// Re-throws any error from the loader thread
+
+			if (!pendingLoad->cancelled) {
+				startTextureDecodes(pendingLoad);
+			}
+		}
+		catch (const std::exception &e) {
+			pendingLoad->error = e.what();
+		}
+	}
+
+	// Upload each texture as soon as its decode finishes, in whatever order they finish
+	bool texturesUploaded = false;
+	auto &textureDecodes = pendingLoad->textureDecodes;
+	while (!textureDecodes.empty())
+	{
+		auto textureDecode = std::find_if(textureDecodes.begin(), textureDecodes.end(), [](PendingTextureDecode &decode) {
+			return decode.decoded.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		});
+
+		if (textureDecode == textureDecodes.end())
+		{
+			if (!wait)
+			{
+				break;		// Rest are still decoding, try again next frame
+			}
+
+			textureDecodes.front().decoded.wait();
+			continue;
+		}
+
+		try {
+			textureDecode->decoded.get();		// Re-throws any error from the decode
+
+			// Still decode everything after an error (tasks write into modelData), but don't upload it
+			if (pendingLoad->error.empty() && !pendingLoad->cancelled) {
+				size_t textureIndex = textureDecode->textureIndex;
+				pendingLoad->textureIds[textureIndex] = acquireTexture(&modelData->textures[textureIndex], &pendingLoad->uploadBatch);
+				texturesUploaded = true;
+			}
+		}
+		catch (const std::exception &e) {
+			if (pendingLoad->error.empty()) {
+				pendingLoad->error = e.what();
+			}
+		}
+
+		textureDecodes.erase(textureDecode);
+	}
+
+	// Start copying the textures uploaded so far, rather than waiting for the rest
+	if (texturesUploaded)
+	{
+		pendingLoad->uploadBatch.submit();
+	}
+
+	if (!textureDecodes.empty())
+	{
+		return false;
+	}
+
+	// Everything decoded: finish the model, or undo what was uploaded if it can't be finished
+	if (!pendingLoad->error.empty() || pendingLoad->cancelled)
+	{
+		abandonModelLoad(pendingLoad);
+	}
+	else
+	{
+		uploadModelData(pendingLoad);
+	}
+
+	return true;
+}
+
+void VulkanRenderer::uploadModelData(PendingModelLoad * pendingLoad)
+{
+	ModelGeometry &geometry = *geometries[pendingLoad->geometryId];
+	ModelData * modelData = pendingLoad->modelData.get();
+
+	// Rest of the model's copies and barriers go into the same batch as its textures
+	UploadBatch &uploadBatch = pendingLoad->uploadBatch;
 
 	// Conversion from the materials list IDs to our descriptor Array IDs
-	std::vector<int> matToTex(textureNames.size());
+	std::vector<int> matToTex(modelData->textures.size());
 
-	// Loop over textureNames and create texture ids for them
-	for (size_t i = 0; i < textureNames.size(); i++) {
+	// Texture references the geometry holds (released with the geometry)
+	std::vector<int> textureIds;
+
+	// Loop over textures and create texture ids for them
+	for (size_t i = 0; i < modelData->textures.size(); i++) {
 		// If material had no texture, set 0 to indicate no texture, texture 0 be reserved a default texture
-		if (textureNames[i].empty()) {
+		if (modelData->textures[i].fileName.empty()) {
 			matToTex[i] = 0;
 		}
 		else {
-			// Otherwise, create texture and set value to index of new texture from descriptor set
-			matToTex[i] = createTexture(textureNames[i]);
+			// Otherwise use the texture uploaded when it was decoded, or get it from the cache (shared/already loaded textures)
+			if (pendingLoad->textureIds[i] < 0) {
+				pendingLoad->textureIds[i] = acquireTexture(&modelData->textures[i], &uploadBatch);
+			}
+			matToTex[i] = pendingLoad->textureIds[i];
+			textureIds.push_back(matToTex[i]);
+		}
+	}
+
+	// Upload each distinct mesh once (nodes using the same mesh share it)
+	geometry.meshes.reserve(modelData->meshes.size());
+	for (auto &meshData : modelData->meshes) {
+		// Packed vertices are 0-1 across the mesh's bounds/UV range, so scale them back out when drawn
+		Model dequantisation;
+		dequantisation.model = glm::scale(glm::translate(glm::mat4(1.0f), meshData.boundsMin), meshData.boundsMax - meshData.boundsMin);
+		dequantisation.texTransform = meshData.texTransform;
+
+		MeshGeometry meshGeometry(&allocator, mainDevice.logicalDevice, &geometryArena, &uploadBatch,
+			meshData.getVertexData(), meshData.getVertexCount(), meshData.getIndexData(), meshData.getIndexCount(), meshData.indexType,
+			dequantisation);
+		meshGeometry.setBounds(meshData.boundsMin, meshData.boundsMax, meshData.boundingSphere);
+		meshGeometry.setLods(meshData.lods);
+
+		// Meshlets for the GPU to cull (only if it can)
+		if (meshletCulling && !meshData.meshlets.empty()) {
+			meshGeometry.createMeshletBuffer(&uploadBatch, meshData.meshlets.data(), meshData.meshlets.size());
 		}
+
+		geometry.meshes.push_back(meshGeometry);
+		geometry.meshTexIds.push_back(matToTex[meshData.materialIndex]);
 	}
+	geometry.meshReferences = modelData->meshReferences;
+	geometry.nodes = modelData->nodes;
+	geometry.textureIds = textureIds;
+
+	// Send the rest of the model's copies to the GPU, without waiting for it (models using it are made next update)
+	uploadBatch.submit();
+	geometry.uploadBatch = uploadBatch;
+	geometry.loaded = true;
+}
 
-	// Load in all our meshes
-	std::vector<Mesh> modelMeshes = MeshModel::LoadNode(
-		mainDevice.physicalDevice, 
-		mainDevice.logicalDevice, 
-		graphicsQueue, 
-		graphicsCommandPool, scene->mRootNode, scene, matToTex);
+void VulkanRenderer::abandonModelLoad(PendingModelLoad * pendingLoad)
+{
+	// Textures uploaded so far may still be copying, so wait before dropping them
+	pendingLoad->uploadBatch.wait();
 
-	// Create mesh model and add to list
-	MeshModel meshModel = MeshModel(modelMeshes);
-	modelList.push_back(meshModel);
+	for (int textureId : pendingLoad->textureIds)
+	{
+		if (textureId >= 0)
+		{
+			releaseTexture(textureId);
+		}
+	}
 
-	int modelListSize = static_cast<int>(modelList.size());
+	freeModelData(pendingLoad->modelData.get());
 
-	return modelListSize - 1;
+	// Nothing uses a cancelled geometry, but models waiting on a failed one keep it (empty) until they are destroyed
+	int geometryId = pendingLoad->geometryId;
+	if (pendingLoad->cancelled)
+	{
+		freeGeometrySlot(geometryId);
+	}
+	else
+	{
+		geometries[geometryId]->failed = true;
+
+		// Later loads of the file try again
+		auto cachedGeometry = geometryCache.find(geometryKeys[geometryId]);
+		if (cachedGeometry != geometryCache.end() && cachedGeometry->second == geometryId)
+		{
+			geometryCache.erase(cachedGeometry);
+		}
+	}
 }
 
 stbi_uc * VulkanRenderer::loadTextureFile(std::string fileName, int * width, int * height, VkDeviceSize * imageSize)
@@ -1731,3 +3529,165 @@ stbi_uc * VulkanRenderer::loadTextureFile(std::string fileName, int * width, int
 
 	return image;
 }
+
+TextureData VulkanRenderer::loadTextureData(std::string fileName)
+{
+	TextureData textureData;
+	textureData.fileName = fileName;
+
+	// Use the pre-compressed version of the texture if there is one the device can sample
+	if (loadCompressedTextureFile(fileName, &textureData))
+	{
+		return textureData;
+	}
+
+	// Otherwise decode to RGBA8, and generate a full mip chain once uploaded
+	textureData.pixels = loadTextureFile(fileName, &textureData.width, &textureData.height, &textureData.imageSize);
+	textureData.format = VK_FORMAT_R8G8B8A8_UNORM;
+	textureData.mipLevels = getMipLevelCount(textureData.width, textureData.height);
+
+	return textureData;
+}
+
+bool VulkanRenderer::loadCompressedTextureFile(std::string fileName, TextureData * textureData)
+{
+	// Compressed version sits next to the original image with a .ktx2 extension (e.g. Textures/pine.ktx2 for pine.jpg)
+	std::string ktxFileName = fileName.substr(0, fileName.find_last_of('.')) + ".ktx2";
+	std::string fileLoc = "Textures/" + ktxFileName;
+	if (!std::ifstream(fileLoc).good())
+	{
+		return false;
+	}
+
+	Ktx2File ktxFile;
+	ktxFile.load(fileLoc);
+
+	// Device can't sample this format, so fall back to the original image (unless there isn't one)
+	if (!isTextureFormatSupported(ktxFile.getFormat()))
+	{
+		if (ktxFileName == fileName)
+		{
+			throw std::runtime_error("Texture format is not supported by this device! (" + fileName + ")");
+		}
+		return false;
+	}
+
+	textureData->width = static_cast<int>(ktxFile.getWidth());
+	textureData->height = static_cast<int>(ktxFile.getHeight());
+	textureData->format = ktxFile.getFormat();
+	textureData->mipLevels = static_cast<uint32_t>(ktxFile.getLevels().size());
+	textureData->imageSize = ktxFile.getData().size();
+	textureData->levels.swap(ktxFile.getLevels());
+	textureData->levelData.swap(ktxFile.getData());
+
+	return true;
+}
+
+bool VulkanRenderer::isTextureFormatSupported(VkFormat format)
+{
+	// Needs to be sampled with linear filtering (compressed formats also need their device feature, enabled when supported)
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, format, &properties);
+
+	VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (properties.optimalTilingFeatures & requiredFeatures) == requiredFeatures;
+}
+
+ModelData VulkanRenderer::loadModelData(std::string modelFile, bool optimiseMeshes)
+{
+	ModelData modelData;
+	uint32_t processingFlags = optimiseMeshes ? MESH_CACHE_OPTIMISED : 0;
+
+	// Use processed meshes cached by an earlier load if the model hasn't changed since (skips Assimp entirely)
+	if (MeshCache::Load(modelFile, processingFlags, &modelData)) {
+		return modelData;
+	}
+
+	// Import model scene (importer is per call, so this is safe on any thread)
+	Assimp::Importer importer;
+
+	const aiScene* scene = importer.ReadFile(modelFile, 
+		aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+
+	if (!scene) {
+		throw std::runtime_error("error occurred while loadig model: " + modelFile);
+	}
+
+	// Get vector of all materials with 1:1 ID placement (textures are decoded separately, in parallel)
+	std::vector<std::string> textureNames = MeshModel::LoadMaterials(scene);
+	modelData.textures.resize(textureNames.size());
+	for (size_t i = 0; i < textureNames.size(); i++) {
+		modelData.textures[i].fileName = textureNames[i];
+	}
+
+	// Every node and every use of a mesh in the node tree
+	MeshModel::FlattenNodes(scene, &modelData.nodes, &modelData.meshReferences);
+
+	// Each scene mesh is converted once however many nodes use it (references are renumbered to the meshes kept)
+	std::vector<uint32_t> sceneMeshSlots(scene->mNumMeshes, UINT32_MAX);
+	std::vector<const aiMesh *> sceneMeshes;
+	for (auto &meshReference : modelData.meshReferences) {
+		if (sceneMeshSlots[meshReference.mesh] == UINT32_MAX) {
+			sceneMeshSlots[meshReference.mesh] = static_cast<uint32_t>(sceneMeshes.size());
+			sceneMeshes.push_back(scene->mMeshes[meshReference.mesh]);
+		}
+		meshReference.mesh = sceneMeshSlots[meshReference.mesh];
+	}
+
+	// Then convert them in parallel (each mesh is independent, and has its own slot)
+	modelData.meshes.resize(sceneMeshes.size());
+	std::vector<VertexCacheStats> statsBefore(sceneMeshes.size()), statsAfter(sceneMeshes.size());
+
+	loaderPool.parallelFor(sceneMeshes.size(), [&](size_t i) {
+		MeshData &meshData = modelData.meshes[i];
+		MeshModel::LoadMesh(sceneMeshes[i], &meshData);
+
+		// Reorder for the vertex cache, overdraw and vertex fetch
+		if (optimiseMeshes) {
+			MeshOptimiser::OptimiseMesh(&meshData, &statsBefore[i], &statsAfter[i]);
+		}
+
+		// Simplified LODs, after the full mesh in the index list, and meshlets of the full mesh for culling
+		MeshSimplifier::GenerateLods(&meshData);
+		if (optimiseMeshes) {
+			MeshOptimiser::OptimiseLods(&meshData);
+		}
+		MeshletBuilder::BuildMeshlets(&meshData);
+
+		// Convert to the compact GPU vertex/index formats
+		MeshModel::PackMesh(&meshData);
+	});
+
+	// Report how the vertex cache does before/after optimising
+	if (optimiseMeshes) {
+		VertexCacheStats totalBefore, totalAfter;
+		for (size_t i = 0; i < sceneMeshes.size(); i++) {
+			totalBefore.triangleCount += statsBefore[i].triangleCount;
+			totalBefore.vertexCount += statsBefore[i].vertexCount;
+			totalBefore.cacheMisses += statsBefore[i].cacheMisses;
+			totalAfter.triangleCount += statsAfter[i].triangleCount;
+			totalAfter.vertexCount += statsAfter[i].vertexCount;
+			totalAfter.cacheMisses += statsAfter[i].cacheMisses;
+		}
+
+		printf("Optimised %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", modelFile.c_str(),
+			totalBefore.getAcmr(), totalAfter.getAcmr(), totalBefore.getAtvr(), totalAfter.getAtvr());
+	}
+
+	// Cache the result for next time
+	MeshCache::Save(modelFile, processingFlags, modelData);
+
+	return modelData;
+}
+
+void VulkanRenderer::freeModelData(ModelData * modelData)
+{
+	for (auto &textureData : modelData->textures)
+	{
+		if (textureData.pixels != nullptr)
+		{
+			stbi_image_free(textureData.pixels);
+			textureData.pixels = nullptr;
+		}
+	}
+}
@@ -15,11 +15,29 @@
 #include <set>
 #include <algorithm>
 #include <array>
+#include <memory>
+#include <future>
+#include <map>
+#include <mutex>
 
 #include "stb_image.h"
 
 #include "Mesh.h"
 #include "MeshModel.h"
+#include "StagingRing.h"
+#include "UploadBatch.h"
+#include "ThreadPool.h"
+#include "Ktx2File.h"
+#include "MeshCache.h"
+#include "MeshOptimiser.h"
+#include "MeshSimplifier.h"
+#include "MeshletBuilder.h"
+#include "MeshletCuller.h"
+#include "FrustumCuller.h"
+#include "DrawCuller.h"
+#include "DepthPyramid.h"
+#include "GeometryArena.h"
+#include "DrawSorter.h"
 
 #include "Utilities.h"
 
@@ -30,8 +48,37 @@ public:
 
 	int init(GLFWwindow * newWindow);
 
-	int createMeshModel(std::string modelFile);
+	int createMeshModel(std::string modelFile);			// Returns once the model is resident (throws if it can't be loaded)
+	int createMeshModelAsync(std::string modelFile);	// Returns straight away, the model is drawn once it has loaded
+	void destroyMeshModel(int modelId);
+
+	void setMeshOptimisation(bool enabled);		// Optimise meshes for the vertex cache/overdraw when importing (on by default)
+	void setGpuDrivenCulling(bool enabled);		// Cull and draw on the GPU where the device can (on by default)
+	bool isMeshModelReady(int modelId);
 	void updateModel(int modelId, glm::mat4 newModel);
+	void updateModelNode(int modelId, size_t node, glm::mat4 newTransform);	// Local transform of one node of the model's node tree
+
+	// Extra copies of a model, sharing its GPU data and drawn in the same draws (model id itself is instance 0)
+	int createInstance(int modelId);
+	void updateInstance(int modelId, int instanceId, glm::mat4 newTransform);
+	void destroyInstance(int modelId, int instanceId);
+
+	// Meshes (one per instance) drawn, frustum culled and occlusion culled in the last frame
+	// (GPU driven culling: the last frame to finish, occlusion culling needs it too)
+	struct CullingStats {
+		uint32_t visibleMeshes;
+		uint32_t culledMeshes;
+		uint32_t occludedMeshes;
+	};
+	CullingStats getCullingStats();
+
+	// Draws recorded in the last frame and the binds they needed (CPU culling only, GPU driven culling draws per batch)
+	struct DrawStats {
+		uint32_t draws;
+		uint32_t textureBinds;			// Descriptor set binds, or texture id pushes with bindless textures
+		uint32_t bufferBinds;			// Every vertex and index buffer bind (instance buffer included)
+	};
+	DrawStats getDrawStats();
 
 	void draw();
 	void cleanup();
@@ -45,6 +92,39 @@ private:
 
 	// Scene objects
 	std::vector<MeshModel> modelList;
+	std::vector<UploadBatch> modelUploads;		// Upload batch for each model in modelList (same index)
+	std::vector<bool> modelResident;			// Model's upload has finished on the GPU, so it can be drawn
+	std::vector<int> uploadingModels;			// Models with an upload batch still in flight
+	std::vector<int> modelGeometries;			// Geometry id each model in modelList draws (-1 for none)
+	std::vector<int> waitingModels;				// Models whose geometry is still loading (made once it is)
+
+	// Geometry Cache (GPU meshes shared by every model loaded from the same file, index = geometry id)
+	std::vector<std::unique_ptr<ModelGeometry>> geometries;	// nullptr = slot free
+	std::map<std::string, int> geometryCache;	// Normalised path -> geometry id (while loading or loaded)
+	std::vector<std::string> geometryKeys;		// Geometry id -> normalised path
+	std::vector<int> geometryRefCounts;			// Geometry id -> number of models using it
+	std::vector<int> freeGeometryIds;			// Released slots to re-use
+	GeometryArena geometryArena;				// Vertices and indices of every geometry's meshes, in shared buffers
+
+	// Background model loading
+	struct PendingTextureDecode {
+		size_t textureIndex;					// Texture in modelData being decoded
+		std::future<void> decoded;				// Ready once the texture is decoded (or holds the decode error)
+	};
+	struct PendingModelLoad {
+		int geometryId;							// Geometry being loaded (models using it are made once it is)
+		std::shared_ptr<ModelData> modelData;	// Filled in by loader threads
+		std::future<void> loaded;				// Ready once the scene is imported (or holds the import error)
+		bool imported;							// Import finished and texture decodes started
+		std::vector<PendingTextureDecode> textureDecodes;	// Decodes whose texture isn't uploaded yet
+		std::vector<int> textureIds;			// Texture acquired for each material (-1 if not yet)
+		UploadBatch uploadBatch;				// Textures as each decode finishes, then meshes
+		std::string error;						// First error from import/decode (load is abandoned)
+		bool cancelled;							// Every model using it was destroyed before load finished, so don't upload it
+	};
+	ThreadPool loaderPool;
+	bool meshOptimisation = true;
+	std::vector<PendingModelLoad> pendingModelLoads;
 
 	// Scene Settings
 	struct UboViewProjection {
@@ -62,6 +142,8 @@ private:
 	} mainDevice;
 	VkQueue graphicsQueue;
 	VkQueue presentationQueue;
+	VkQueue transferQueue;
+	DeviceAllocator allocator;
 	VkSurfaceKHR surface;
 	VkSwapchainKHR swapchain;
 
@@ -70,7 +152,7 @@ private:
 	std::vector<VkCommandBuffer> commandBuffers;
 
 	VkImage depthBufferImage;
-	VkDeviceMemory depthBufferImageMemory;
+	DeviceAllocation depthBufferImageMemory;
 	VkImageView depthBufferImageView;
 
 	VkSampler textureSampler;
@@ -79,14 +161,73 @@ private:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSetLayout samplerSetLayout;
 	VkPushConstantRange pushConstantRange;
+	VkPushConstantRange textureIdPushConstantRange;		// Bindless only: texture of current draw
 
 	VkDescriptorPool descriptorPool;
 	VkDescriptorPool samplerDescriptorPool;
 	std::vector<VkDescriptorSet> descriptorSets;
-	std::vector<VkDescriptorSet> samplerDescriptorSets;
+	std::vector<VkDescriptorSet> samplerDescriptorSets;		// One per texture (not used with bindless textures)
+
+	// - Bindless Textures (every texture in one descriptor array, indexed by texture id)
+	uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+	bool bindlessTextures = false;
+	uint32_t bindlessTextureCount = 0;
+	VkDescriptorSet bindlessDescriptorSet = VK_NULL_HANDLE;
+
+	// - Meshlet Culling (compute pass culls full detail meshes' meshlets, then they are drawn indirectly)
+	bool meshletCulling = false;
+	MeshletCuller meshletCuller;
 
 	std::vector<VkBuffer> vpUniformBuffer;
-	std::vector<VkDeviceMemory> vpUniformBufferMemory;
+	std::vector<DeviceAllocation> vpUniformBufferMemory;
+
+	// - Instances (per swapchain image: transforms of the instances in view, read at instance rate)
+	std::vector<VkBuffer> instanceBuffers;
+	std::vector<DeviceAllocation> instanceBufferMemory;
+	std::vector<size_t> instanceBufferCapacities;		// In instances
+
+	// - Frame Draws (what survived frustum culling this frame, and where its visible instances are in the instance buffer)
+	struct MeshDraw {
+		Mesh * mesh;
+		glm::mat4 meshTransform;			// Mesh's node within its model
+		uint32_t firstInstance;				// Visible instances are packed together in this frame's instance buffer
+		uint32_t instanceCount;
+		bool meshletCulled;					// Drawn from its culled index buffer (only when one instance is visible)
+	};
+	FrustumCuller frustumCuller;
+	std::vector<MeshDraw> meshDraws;
+	std::vector<MeshletCullDraw> meshletCullDraws;
+	CullingStats cullingStats = {};
+
+	// - Draw Sorting (visible draws are recorded in sort key order, see DrawSorter)
+	DrawSorter drawSorter;
+	std::vector<uint64_t> drawSortKeys;
+	std::vector<uint32_t> drawSortOrder;
+	std::vector<MeshDraw> sortedMeshDraws;
+	DrawStats drawStats = {};
+
+	// - GPU Driven Culling (compute pass culls every draw and writes indirect commands, one indirect draw per batch)
+	bool gpuDrivenCulling = false;				// Device can (needs bindless textures and multi draw indirect)
+	bool gpuDrivenCullingEnabled = true;
+	bool drawListChanged = true;				// Something appeared or went since the draw list was built (rebuilds it)
+
+	// Draw records of each model (index = model id), so moving a model or instance rewrites just its own records
+	struct ModelDraws {
+		std::vector<uint32_t> drawIndices;		// Record of each instance's meshes (instance slot * mesh count + mesh)
+		std::vector<uint32_t> movedSlots;		// Instance slots moved since their records were written
+		bool nodesMoved = false;				// Node transforms changed, so every instance's records are stale
+	};
+	std::vector<ModelDraws> modelDraws;
+	DrawCuller drawCuller;
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;	// Only with VK_KHR_draw_indirect_count
+	VkPipeline indirectPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout indirectPipelineLayout = VK_NULL_HANDLE;
+
+	// - Occlusion Culling (GPU driven culling in two phases, around a Hi-Z pyramid of the first phase's depth)
+	bool occlusionCulling = false;				// Device can (needs GPU driven culling and a depth format it can sample)
+	DepthPyramid depthPyramid;
+	VkRenderPass firstPhaseRenderPass = VK_NULL_HANDLE;		// Clears, and keeps the depth for the pyramid
+	VkRenderPass secondPhaseRenderPass = VK_NULL_HANDLE;	// Draws on top of the first phase, then presents
 
 	std::vector<VkBuffer> modelDUniformBuffer;
 	std::vector<VkDeviceMemory> modelDUniformBufferMemory;
@@ -97,9 +238,16 @@ private:
 
 	// - Assets
 	std::vector<VkImage> textureImages;
-	std::vector<VkDeviceMemory> textureImageMemory;
+	std::vector<DeviceAllocation> textureImageMemory;
 	std::vector<VkImageView> textureImageViews;
 
+	// - Texture Cache (textures are shared by every model naming the same file, index = texture id)
+	std::map<std::string, int> textureCache;	// Normalised path -> texture id (or TEXTURE_PENDING while being created)
+	std::vector<std::string> textureKeys;		// Texture id -> normalised path
+	std::vector<int> textureRefCounts;			// Texture id -> number of references (0 = slot free)
+	std::vector<int> freeTextureIds;			// Released slots to re-use
+	std::mutex textureCacheMutex;				// Loader threads check the cache to skip decoding
+
 	// - Pipeline
 	VkPipeline graphicsPipeline;
 	VkPipelineLayout pipelineLayout;
@@ -107,6 +255,10 @@ private:
 
 	// - Pools
 	VkCommandPool graphicsCommandPool;
+	VkCommandPool transferCommandPool;
+
+	// - Uploads
+	StagingRing stagingRing;
 
 	// - Utility
 	VkFormat swapChainImageFormat;
@@ -124,24 +276,36 @@ private:
 	void createSurface();
 	void createSwapChain();
 	void createRenderPass();
+	void createOcclusionRenderPasses();
 	void createDescriptorSetLayout();
 	void createPushConstantRange();
 	void createGraphicsPipeline();
 	void createDepthBufferImage();
+	void createDepthPyramid();
 	void createFramebuffers();
 	void createCommandPool();
 	void createCommandBuffers();
 	void createSynchronisation();
 	void createTextureSampler();
+	void createStagingRing();
+	void createMeshletCuller();
+	void createDrawCuller();
 
 	void createUniformBuffers();
+	void createInstanceBuffer(uint32_t imageIndex, size_t capacity);
 	void createDescriptorPool();
 	void createDescriptorSets();
 
 	void updateUniformBuffers(uint32_t imageIndex);
+	void prepareDraws(uint32_t imageIndex);
+	void prepareIndirectDraws();
+	void updateIndirectDraws();
+	void setIndirectDrawTransform(IndirectDraw * draw, Mesh * mesh, const glm::mat4 & meshTransform);
+	void updateModelLoads();
 
 	// - Record Functions
 	void recordCommands(uint32_t currentImage);
+	void recordIndirectDraws(uint32_t currentImage, uint32_t phase);
 
 	// - Get Functions
 	void getPhysicalDevice();
@@ -155,6 +319,10 @@ private:
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device);
 	bool checkValidationLayerSupport();
 	bool checkDeviceSuitable(VkPhysicalDevice device);
+	bool checkBindlessTextureSupport(VkPhysicalDevice device, VkPhysicalDeviceDescriptorIndexingFeaturesEXT * indexingFeatures);
+	bool checkMeshletCullingSupport(VkPhysicalDevice device);
+	bool checkGpuDrivenCullingSupport(VkPhysicalDevice device, bool * drawIndirectCount);
+	bool checkOcclusionCullingSupport(VkPhysicalDevice device);
 
 	// -- Getter Functions
 	QueueFamilyIndices getQueueFamilies(VkPhysicalDevice device);
@@ -168,17 +336,39 @@ private:
 
 	// -- Create Functions
 	VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags,
-		VkMemoryPropertyFlags propFlags, VkDeviceMemory *imageMemory);
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
+		VkMemoryPropertyFlags propFlags, DeviceAllocation *imageMemory, uint32_t mipLevels = 1);
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1);
 	VkShaderModule createShaderModule(const std::vector<char> &code);
 
-	int createTextureImage(std::string fileName);
-	int createTexture(std::string fileName);
-	int createTextureDescriptor(VkImageView textureImage);
-
-
-	// -- Loader Functions
+	VkImage createTextureImage(TextureData * textureData, UploadBatch * uploadBatch, DeviceAllocation * imageMemory);
+	int createTexture(TextureData * textureData, UploadBatch * uploadBatch);
+	VkDescriptorSet createTextureDescriptor(int textureId, VkImageView textureImage);
+
+	int acquireTexture(TextureData * textureData, UploadBatch * uploadBatch);
+	void releaseTexture(int textureId);
+	std::string getTextureCacheKey(const std::string &fileName);
+	bool isTextureCached(const std::string &fileName);
+
+
+	int addModelSlot();
+	int acquireGeometry(const std::string &modelFile, bool optimiseMeshes, bool * created);
+	void releaseGeometry(int geometryId);
+	void freeGeometrySlot(int geometryId);
+	std::string getGeometryCacheKey(const std::string &modelFile, bool optimiseMeshes);
+	void updateWaitingModels();
+	void createModelFromGeometry(int modelId);
+	void startTextureDecodes(PendingModelLoad * pendingLoad);
+	bool updateModelLoad(PendingModelLoad * pendingLoad, bool wait);
+	void uploadModelData(PendingModelLoad * pendingLoad);
+	void abandonModelLoad(PendingModelLoad * pendingLoad);
+
+	// -- Loader Functions (don't touch renderer state, so safe to call from loader threads)
 	stbi_uc * loadTextureFile(std::string fileName, int * width, int * height, VkDeviceSize * imageSize);
+	bool loadCompressedTextureFile(std::string fileName, TextureData * textureData);
+	bool isTextureFormatSupported(VkFormat format);
+	TextureData loadTextureData(std::string fileName);
+	ModelData loadModelData(std::string modelFile, bool optimiseMeshes);
+	void freeModelData(ModelData * modelData);
 
 };
 
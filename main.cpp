@@ -40,7 +40,8 @@ int main()
 	float deltaTime = 0.0f;
 	float lastTime = 0.0f;
 
-	int modelListPosition = vulkanRenderer.createMeshModel("Models/13463_Australian_Cattle_Dog_v3.obj");
+	// Load in the background, model appears once it is on the GPU
+	int modelListPosition = vulkanRenderer.createMeshModelAsync("Models/13463_Australian_Cattle_Dog_v3.obj");
 
 
 	// Loop until closed